@@ -0,0 +1,330 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+#include "engine.h"
+#include "placements.h"
+
+// How many times each operation goes through the whole corpus.
+const int BENCHMARK_PASSES = 20;
+// How many operations are timed together, so that the clock is read far less
+// often than the operations run. Percentiles are taken over the batches.
+const int BATCH_SIZE = 64;
+// How many random inputs a falling piece is moved by before a state is kept.
+const int MAX_SHUFFLE_INPUTS = 8;
+
+// The operations which are timed.
+const int MOVE_PIECE = 0;
+const int ROTATE_PIECE = 1;
+const int CLEAR_LINES = 2;
+const int SPAWN_PIECE = 3;
+const int COLLAPSE_PIECE = 4;
+const int DROP_DISTANCE = 5;
+const int SNAPSHOT = 6;
+const int RESTORE = 7;
+const int OPERATION_COUNT = 8;
+
+const char *OPERATION_NAMES[OPERATION_COUNT] = {
+  "move_piece", "rotate_piece", "clear_lines", "spawn_piece",
+  "collapse_piece", "drop_distance", "snapshot", "restore"
+};
+
+// The corpora the operations are timed on.
+const int EMPTY_CORPUS = 0;
+const int STACK_CORPUS = 1;
+const int CLEARABLE_CORPUS = 2;
+const int CORPUS_COUNT = 3;
+
+const char *CORPUS_NAMES[CORPUS_COUNT] = {"empty", "stacks", "clearable"};
+
+// The state the snapshot operation copies games into, and restore from.
+GameState saved_state;
+
+// The timings of one operation on one corpus, in nanoseconds per operation.
+struct benchmark_result {
+  int corpus;
+  int operation;
+  double mean;
+  double p50;
+  double p99;
+};
+
+/**
+ * Moves the falling piece by a few random inputs, so that the states of a
+ * corpus do not all have their piece at the spawn position.
+ * @param game
+ * @param random
+ */
+void shuffle_piece(GameState &game, PieceGenerator &random) {
+  int inputs = random.next_below(MAX_SHUFFLE_INPUTS + 1);
+
+  for (int i = 0; i < inputs; i++) {
+    switch (random.next_below(3)) {
+      case 0:
+        game.move_piece(random.next_below(2) ? 1 : -1);
+        break;
+      case 1:
+        game.rotate_piece();
+        break;
+      default:
+        // Only move down while it cannot land the piece.
+        if (game.drop_distance() > 0) {
+          game.move_piece(0);
+        }
+    }
+  }
+}
+
+/**
+ * Collects game states with a falling piece. The empty corpus has nothing on
+ * the board; the stack corpus has the boards reached by random placements,
+ * which are kept evenly across stack heights; the clearable corpus is the
+ * stack corpus with some lines under the surface filled in, so that landing
+ * any piece clears them.
+ * @param corpus
+ * @param count the number of states to collect
+ * @param seed
+ * @param states filled in with the states
+ */
+void build_corpus(int corpus, int count, uint64_t seed,
+                  vector<GameState> &states) {
+  PlacementSearch *search = new PlacementSearch();
+  PieceGenerator random;
+  GameState game;
+  // How many states have been kept for each stack height.
+  vector<int> kept(GAME_BOARD_HEIGHT + 1, 0);
+  int found;
+  int height;
+
+  random.seed(seed + corpus, UNIFORM_PIECES);
+  game.initialise(1, random.next(), UNIFORM_PIECES);
+  while ((int)states.size() < count) {
+    game.move_piece(0);
+    if (game.game_over) {
+      game.initialise(1, random.next(), UNIFORM_PIECES);
+      continue;
+    }
+
+    if (corpus == EMPTY_CORPUS) {
+      GameState state = game;
+      shuffle_piece(state, random);
+      states.push_back(state);
+      game.initialise(1, random.next(), UNIFORM_PIECES);
+      continue;
+    }
+
+    height = *max_element(game.column_heights,
+                          game.column_heights + GAME_BOARD_WIDTH);
+    // Keep a state only while its height has no more than its share.
+    if (kept[height] <= (int)states.size() / (GAME_BOARD_HEIGHT / 2)) {
+      GameState state = game;
+      if (corpus == CLEARABLE_CORPUS) {
+        // Fill up to four random lines below the piece.
+        int lines = 1 + random.next_below(4);
+        for (int i = 0; i < lines; i++) {
+          int y = random.next_below(min(height + 1, 16));
+          state.board_rows[y] = FULL_ROW;
+          for (int x = 0; x < GAME_BOARD_WIDTH; x++) {
+            state.board_colours[y][x] = CYAN + random.next_below(7);
+          }
+        }
+        state.update_column_heights();
+      }
+      if (state.piece_fits(state.current_piece_type, state.piece_rotation,
+                           state.piece_x, state.piece_y)) {
+        shuffle_piece(state, random);
+        states.push_back(state);
+        kept[height]++;
+      }
+    }
+
+    found = search->find_placements(game);
+    if (!found) {
+      game.initialise(1, random.next(), UNIFORM_PIECES);
+      continue;
+    }
+    const Placement &placement = search->placements[random.next_below(found)];
+    game.place_piece(placement.rotation, placement.x, placement.y);
+  }
+  delete search;
+}
+
+/**
+ * Applies an operation to a state. clear_lines() and spawn_piece() are
+ * applied to the state after its piece has landed, the way move_piece()
+ * calls them. snapshot copies the state aside and restore copies the last
+ * one kept over it, as rolling a game back does.
+ * @param operation
+ * @param game
+ * @return a value which depends on the result, so that it is not optimised
+ *         away
+ */
+inline int run_operation(int operation, GameState &game) {
+  switch (operation) {
+    case MOVE_PIECE:
+      game.move_piece(game.piece_x & 1 ? 1 : -1);
+      return game.piece_x;
+    case ROTATE_PIECE:
+      game.rotate_piece();
+      return game.piece_rotation;
+    case CLEAR_LINES:
+      return game.clear_lines();
+    case SPAWN_PIECE:
+      game.spawn_piece();
+      return game.next_piece_type;
+    case COLLAPSE_PIECE:
+      game.collapse_piece();
+      return game.board_rows[0];
+    case SNAPSHOT:
+      saved_state = game;
+      return saved_state.piece_y;
+    case RESTORE:
+      game = saved_state;
+      return game.piece_y;
+    default:
+      return game.drop_distance();
+  }
+}
+
+/**
+ * Times an operation over a corpus, one batch of states at a time. Each
+ * batch is copied before it is timed, so every operation starts from a state
+ * of the corpus.
+ * @param operation
+ * @param states
+ * @param result filled in with the timings
+ * @param checksum
+ */
+void time_operation(int operation, const vector<GameState> &states,
+                    benchmark_result &result, long &checksum) {
+  vector<GameState> batch(BATCH_SIZE);
+  vector<double> samples;
+  double total = 0.0;
+  int batches = states.size() / BATCH_SIZE;
+
+  for (int pass = 0; pass < BENCHMARK_PASSES; pass++) {
+    for (int b = 0; b < batches; b++) {
+      copy(states.begin() + b * BATCH_SIZE,
+           states.begin() + (b + 1) * BATCH_SIZE, batch.begin());
+      // Land the pieces first, for the operations which follow a landing.
+      if (operation == CLEAR_LINES || operation == SPAWN_PIECE) {
+        for (int i = 0; i < BATCH_SIZE; i++) {
+          batch[i].collapse_piece();
+        }
+      }
+
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      for (int i = 0; i < BATCH_SIZE; i++) {
+        checksum += run_operation(operation, batch[i]);
+      }
+      chrono::duration<double, nano> elapsed =
+          chrono::steady_clock::now() - start;
+      samples.push_back(elapsed.count() / BATCH_SIZE);
+      total += elapsed.count();
+    }
+  }
+
+  sort(samples.begin(), samples.end());
+  result.operation = operation;
+  result.mean = total / ((double)batches * BATCH_SIZE * BENCHMARK_PASSES);
+  result.p50 = samples[samples.size() / 2];
+  result.p99 = samples[min(samples.size() - 1, samples.size() * 99 / 100)];
+}
+
+/**
+ * Writes the results as JSON, so that they can be compared across builds.
+ * @param file
+ * @param results
+ * @param count the number of states in each corpus
+ * @param seed
+ * @return false if they could not be written
+ */
+bool write_json(FILE *file, const vector<benchmark_result> &results,
+                int count, uint64_t seed) {
+  fprintf(file, "{\n  \"states\": %d,\n  \"seed\": %llu,\n"
+          "  \"passes\": %d,\n  \"results\": [", count,
+          (unsigned long long)seed, BENCHMARK_PASSES);
+  for (size_t i = 0; i < results.size(); i++) {
+    const benchmark_result &result = results[i];
+    fprintf(file, "%s\n    {\"corpus\": \"%s\", \"operation\": \"%s\", "
+            "\"ns_per_op\": %.3f, \"p50_ns\": %.3f, \"p99_ns\": %.3f, "
+            "\"ops_per_sec\": %.0f}", i ? "," : "",
+            CORPUS_NAMES[result.corpus], OPERATION_NAMES[result.operation],
+            result.mean, result.p50, result.p99, 1e9 / result.mean);
+  }
+  fprintf(file, "\n  ]\n}\n");
+  return !ferror(file);
+}
+
+/**
+ * Prints how to use the program.
+ * @param program
+ */
+void print_usage(const char *program) {
+  fprintf(stderr, "Usage: %s [--states N] [--seed N] [--json FILE]\n",
+          program);
+}
+
+int main(int argc, char *argv[]) {
+  int count = 16384;
+  uint64_t seed = 1;
+  const char *json_path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 < argc && !strcmp(argv[i], "--states")) {
+      count = atoi(argv[++i]);
+    } else if (i + 1 < argc && !strcmp(argv[i], "--seed")) {
+      seed = strtoull(argv[++i], NULL, 10);
+    } else if (i + 1 < argc && !strcmp(argv[i], "--json")) {
+      json_path = argv[++i];
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  // The corpora are timed in whole batches.
+  count -= count % BATCH_SIZE;
+  if (count <= 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  vector<benchmark_result> results;
+  long checksum = 0;
+
+  printf("states: %d per corpus\n", count);
+  printf("%-10s %-15s %9s %9s %9s %14s\n", "corpus", "operation", "ns/op",
+         "p50", "p99", "ops/sec");
+  for (int corpus = 0; corpus < CORPUS_COUNT; corpus++) {
+    vector<GameState> states;
+    build_corpus(corpus, count, seed, states);
+
+    for (int operation = 0; operation < OPERATION_COUNT; operation++) {
+      benchmark_result result;
+      result.corpus = corpus;
+      time_operation(operation, states, result, checksum);
+      results.push_back(result);
+      printf("%-10s %-15s %9.2f %9.2f %9.2f %14.0f\n", CORPUS_NAMES[corpus],
+             OPERATION_NAMES[operation], result.mean, result.p50, result.p99,
+             1e9 / result.mean);
+    }
+  }
+  // Printed so that the timed loops cannot be optimised away.
+  printf("checksum: %ld\n", checksum);
+
+  if (json_path) {
+    FILE *file = fopen(json_path, "w");
+    if (!file || !write_json(file, results, count, seed)) {
+      fprintf(stderr, "Cannot write %s.\n", json_path);
+      return 1;
+    }
+    fclose(file);
+  }
+  return 0;
+}
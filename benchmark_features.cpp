@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+#include "engine.h"
+#include "features.h"
+#include "placements.h"
+
+// How many times each kernel goes through the whole corpus.
+const int BENCHMARK_PASSES = 20;
+
+// A board in the layout the game used before the row bitmasks: one colour
+// index per cell, indexed by [column][line], with 0 for an empty cell.
+struct grid_board {
+  int game_board[GAME_BOARD_WIDTH][GAME_BOARD_HEIGHT];
+};
+
+/**
+ * Computes the features of a board with plain loops over every cell, the way
+ * the game's board used to be scanned. It is the reference that the kernels
+ * are checked and timed against.
+ * @param board
+ * @param features filled in with the features
+ */
+void get_grid_features(const grid_board &board, board_features &features) {
+  int heights[GAME_BOARD_WIDTH];
+  bool inside;
+  int left;
+  int right;
+
+  features.aggregate_height = 0;
+  features.holes = 0;
+  for (int i = 0; i < GAME_BOARD_WIDTH; i++) {
+    heights[i] = 0;
+    for (int j = GAME_BOARD_HEIGHT - 1; j >= 0; j--) {
+      if (board.game_board[i][j]) {
+        heights[i] = j + 1;
+        break;
+      }
+    }
+    for (int j = 0; j < heights[i]; j++) {
+      if (!board.game_board[i][j]) {
+        features.holes++;
+      }
+    }
+    features.aggregate_height += heights[i];
+  }
+
+  features.bumpiness = 0;
+  features.wells = 0;
+  for (int i = 0; i < GAME_BOARD_WIDTH; i++) {
+    if (i + 1 < GAME_BOARD_WIDTH) {
+      features.bumpiness += abs(heights[i] - heights[i + 1]);
+    }
+    left = i > 0 ? heights[i - 1] : GAME_BOARD_HEIGHT;
+    right = i + 1 < GAME_BOARD_WIDTH ? heights[i + 1] : GAME_BOARD_HEIGHT;
+    if (heights[i] < left && heights[i] < right) {
+      features.wells += min(left, right) - heights[i];
+    }
+  }
+
+  features.row_transitions = 0;
+  for (int j = 0; j < GAME_BOARD_HEIGHT; j++) {
+    // The wall on the left counts as occupied.
+    inside = true;
+    for (int i = 0; i < GAME_BOARD_WIDTH; i++) {
+      if ((board.game_board[i][j] != 0) != inside) {
+        features.row_transitions++;
+        inside = !inside;
+      }
+    }
+    if (!inside) {
+      features.row_transitions++;
+    }
+  }
+}
+
+/**
+ * Collects every placement board reached while playing random games, which
+ * gives a reproducible mix of low, high, tidy and messy boards.
+ * @param count the number of boards to collect
+ * @param seed
+ * @param boards filled in with the boards
+ */
+void build_corpus(int count, uint64_t seed,
+                  vector<vector<uint16_t> > &boards) {
+  PlacementSearch *search = new PlacementSearch();
+  PieceGenerator random;
+  GameState game;
+  int found;
+
+  random.seed(seed, UNIFORM_PIECES);
+  game.initialise(1, seed, UNIFORM_PIECES);
+  while ((int)boards.size() < count) {
+    game.move_piece(0);
+    found = game.game_over ? 0 : search->find_placements(game);
+    if (!found) {
+      game.initialise(1, random.next(), UNIFORM_PIECES);
+      continue;
+    }
+    for (int i = 0; i < found && (int)boards.size() < count; i++) {
+      const uint16_t *rows = search->placements[i].board_rows;
+      boards.push_back(vector<uint16_t>(rows, rows + GAME_BOARD_HEIGHT));
+    }
+    const Placement &placement = search->placements[random.next_below(found)];
+    game.place_piece(placement.rotation, placement.x, placement.y);
+  }
+  delete search;
+}
+
+/**
+ * Returns true if two sets of features are the same.
+ * @param a
+ * @param b
+ * @return
+ */
+bool same_features(const board_features &a, const board_features &b) {
+  return a.aggregate_height == b.aggregate_height && a.holes == b.holes &&
+         a.bumpiness == b.bumpiness && a.wells == b.wells &&
+         a.row_transitions == b.row_transitions;
+}
+
+/**
+ * Prints how to use the program.
+ * @param program
+ */
+void print_usage(const char *program) {
+  fprintf(stderr, "Usage: %s [--boards N] [--seed N]\n", program);
+}
+
+int main(int argc, char *argv[]) {
+  int count = 100000;
+  uint64_t seed = 1;
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 < argc && !strcmp(argv[i], "--boards")) {
+      count = atoi(argv[++i]);
+    } else if (i + 1 < argc && !strcmp(argv[i], "--seed")) {
+      seed = strtoull(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (count <= 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  vector<vector<uint16_t> > rows;
+  build_corpus(count, seed, rows);
+
+  // The same boards in each layout.
+  vector<const uint16_t *> boards(count);
+  vector<grid_board> grids(count);
+  for (int k = 0; k < count; k++) {
+    boards[k] = rows[k].data();
+    for (int i = 0; i < GAME_BOARD_WIDTH; i++) {
+      for (int j = 0; j < GAME_BOARD_HEIGHT; j++) {
+        grids[k].game_board[i][j] = rows[k][j] >> i & 1 ? CYAN : 0;
+      }
+    }
+  }
+
+  vector<board_features> expected(count);
+  vector<board_features> features(count);
+  double reference_ns;
+  double ns;
+  long checksum = 0;
+
+  printf("boards: %d\n", count);
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (int pass = 0; pass < BENCHMARK_PASSES; pass++) {
+    for (int k = 0; k < count; k++) {
+      get_grid_features(grids[k], expected[k]);
+    }
+    checksum += expected[pass % count].holes;
+  }
+  chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+  reference_ns = elapsed.count() / ((double)count * BENCHMARK_PASSES);
+  printf("%-8s %8.2f ns/board %12.0f boards/sec %6.2fx\n", "grid",
+         reference_ns, 1e9 / reference_ns, 1.0);
+
+  int selected = get_feature_kernel();
+  bool agree = true;
+  for (int kernel = SCALAR_KERNEL; kernel <= AVX2_KERNEL; kernel++) {
+    if (!select_feature_kernel(kernel)) {
+      printf("%-8s unsupported\n", get_feature_kernel_name(kernel));
+      continue;
+    }
+
+    start = chrono::steady_clock::now();
+    for (int pass = 0; pass < BENCHMARK_PASSES; pass++) {
+      get_board_features(boards.data(), count, features.data());
+      checksum += features[pass % count].holes;
+    }
+    elapsed = chrono::steady_clock::now() - start;
+    ns = elapsed.count() / ((double)count * BENCHMARK_PASSES);
+
+    for (int k = 0; k < count; k++) {
+      if (!same_features(features[k], expected[k])) {
+        printf("%s disagrees with the reference on board %d\n",
+               get_feature_kernel_name(kernel), k);
+        agree = false;
+        break;
+      }
+    }
+    printf("%-8s %8.2f ns/board %12.0f boards/sec %6.2fx\n",
+           get_feature_kernel_name(kernel), ns, 1e9 / ns, reference_ns / ns);
+  }
+  select_feature_kernel(selected);
+  printf("selected: %s\n", get_feature_kernel_name(selected));
+  // Printed so that the timed loops cannot be optimised away.
+  printf("checksum: %ld\n", checksum);
+
+  return agree ? 0 : 1;
+}
@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+#include "leaderboard.h"
+#include "piece_generator.h"
+
+// How many times each query is timed.
+const int QUERIES = 1000000;
+// How many games a top K query copies, as on the high scores screen.
+const int TOP_K = 10;
+// The highest score a benchmark game has.
+const uint32_t MAX_SCORE = 100000;
+
+/**
+ * Checks the leaderboard's answers against those found by scanning every
+ * game, for every difficulty: the count, the top K, and the rank and
+ * percentile of some scores.
+ * @param leaderboard
+ * @param games the games added, in order
+ * @param random picks the scores queried
+ * @return the number of answers which differ
+ */
+long check_queries(const Leaderboard &leaderboard,
+                   const vector<leaderboard_record> &games,
+                   PieceGenerator &random) {
+  leaderboard_record top[TOP_K];
+  long mismatches = 0;
+
+  // Every game, then the games of each starting difficulty.
+  for (int d = ANY_DIFFICULTY; d <= MAX_STARTING_DIFFICULTY; d++) {
+    vector<int> scores;
+    vector<int> order;
+
+    if (!d) {
+      continue;
+    }
+    for (size_t i = 0; i < games.size(); i++) {
+      if (d == ANY_DIFFICULTY || games[i].difficulty == d) {
+        scores.push_back(games[i].score);
+        order.push_back(i);
+      }
+    }
+    // The highest scores first, and the earliest game of those the same.
+    stable_sort(order.begin(), order.end(), [&games](int a, int b) {
+      return games[a].score > games[b].score;
+    });
+
+    mismatches += leaderboard.get_count(d) != (long)scores.size();
+    int count = leaderboard.get_top(top, TOP_K, d);
+    mismatches += count != min<int>(TOP_K, order.size());
+    for (int i = 0; i < count && i < (int)order.size(); i++) {
+      mismatches += memcmp(&top[i], &games[order[i]], sizeof(top[i])) != 0;
+    }
+
+    for (int q = 0; q < 100; q++) {
+      int score = random.next_below(MAX_SCORE + 2);
+      long higher = 0;
+      long equal = 0;
+
+      for (size_t i = 0; i < scores.size(); i++) {
+        higher += scores[i] > score;
+        equal += scores[i] == score;
+      }
+      double percentile = scores.empty() ? 100.0 :
+          100.0 * (scores.size() - higher - equal * 0.5) / scores.size();
+      mismatches += leaderboard.get_rank(score, d) != higher;
+      mismatches += fabs(leaderboard.get_percentile(score, d) - percentile) >
+          1e-9;
+    }
+  }
+  return mismatches;
+}
+
+/**
+ * Prints how to use the program.
+ * @param program
+ */
+void print_usage(const char *program) {
+  fprintf(stderr, "Usage: %s [--games N] [--seed N] [--file PATH]\n",
+          program);
+}
+
+int main(int argc, char *argv[]) {
+  int count = 100000;
+  uint64_t seed = 1;
+  const char *path = "benchmark_leaderboard.dat";
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 < argc && !strcmp(argv[i], "--games")) {
+      count = atoi(argv[++i]);
+    } else if (i + 1 < argc && !strcmp(argv[i], "--seed")) {
+      seed = strtoull(argv[++i], NULL, 10);
+    } else if (i + 1 < argc && !strcmp(argv[i], "--file")) {
+      path = argv[++i];
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (count <= 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  Leaderboard leaderboard;
+  PieceGenerator random;
+  vector<leaderboard_record> games(count);
+  leaderboard_record top[TOP_K];
+  long mismatches;
+  long checksum = 0;
+
+  random.seed(seed, UNIFORM_PIECES);
+  for (int i = 0; i < count; i++) {
+    memset(&games[i], 0, sizeof(games[i]));
+    games[i].score = random.next_below(MAX_SCORE + 1);
+    games[i].difficulty = 1 + random.next_below(MAX_STARTING_DIFFICULTY);
+    games[i].time = i;
+    games[i].pieces_spawned = games[i].score / 10;
+    games[i].duration = games[i].score * 20;
+    snprintf(games[i].name, LEADERBOARD_NAME_SIZE, "player%d", i % 1000);
+  }
+
+  // The benchmark starts from an empty leaderboard, which it removes after.
+  unlink(path);
+  if (!leaderboard.open(path)) {
+    fprintf(stderr, "Cannot open %s\n", path);
+    return 1;
+  }
+  printf("games: %d\n", count);
+
+  /**
+   * Every add syncs its record to the file, so the adds are timed in tenths,
+   * to show whether they slow down as the leaderboard grows.
+   */
+  for (int tenth = 0; tenth < 10; tenth++) {
+    int first = (long)count * tenth / 10;
+    int last = (long)count * (tenth + 1) / 10;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = first; i < last; i++) {
+      if (!leaderboard.add(games[i])) {
+        fprintf(stderr, "Cannot add to %s\n", path);
+        unlink(path);
+        return 1;
+      }
+    }
+    chrono::duration<double, micro> elapsed =
+        chrono::steady_clock::now() - start;
+    if (tenth == 0 || tenth == 9) {
+      printf("add, %s tenth: %.2f us/game\n", tenth ? "last" : "first",
+             elapsed.count() / max(1, last - first));
+    }
+  }
+  mismatches = check_queries(leaderboard, games, random);
+
+  // Reopening builds the indexes from the file.
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  leaderboard.close();
+  if (!leaderboard.open(path)) {
+    fprintf(stderr, "Cannot open %s again\n", path);
+    unlink(path);
+    return 1;
+  }
+  chrono::duration<double, milli> opened = chrono::steady_clock::now() - start;
+  printf("open: %.2f ms\n", opened.count());
+  mismatches += check_queries(leaderboard, games, random);
+
+  vector<int> scores(QUERIES);
+  for (int i = 0; i < QUERIES; i++) {
+    scores[i] = random.next_below(MAX_SCORE + 1);
+  }
+  start = chrono::steady_clock::now();
+  for (int i = 0; i < QUERIES; i++) {
+    checksum += leaderboard.get_rank(scores[i], i % 2 ? ANY_DIFFICULTY :
+                                     1 + i % MAX_STARTING_DIFFICULTY);
+  }
+  chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+  printf("get_rank: %.1f ns\n", elapsed.count() / QUERIES);
+
+  start = chrono::steady_clock::now();
+  for (int i = 0; i < QUERIES; i++) {
+    checksum += leaderboard.get_percentile(scores[i], i % 2 ? ANY_DIFFICULTY :
+                                           1 + i % MAX_STARTING_DIFFICULTY);
+  }
+  elapsed = chrono::steady_clock::now() - start;
+  printf("get_percentile: %.1f ns\n", elapsed.count() / QUERIES);
+
+  start = chrono::steady_clock::now();
+  for (int i = 0; i < QUERIES; i++) {
+    int found = leaderboard.get_top(top, TOP_K, i % 2 ? ANY_DIFFICULTY :
+                                    1 + i % MAX_STARTING_DIFFICULTY);
+    checksum += found ? top[found - 1].score : 0;
+  }
+  elapsed = chrono::steady_clock::now() - start;
+  printf("get_top %d: %.1f ns\n", TOP_K, elapsed.count() / QUERIES);
+
+  leaderboard.close();
+  unlink(path);
+  printf("mismatches: %ld\n", mismatches);
+  // Printed so that the timed loops cannot be optimised away.
+  printf("checksum: %ld\n", checksum);
+  return mismatches ? 1 : 0;
+}
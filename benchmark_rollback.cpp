@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <vector>
+
+using namespace std;
+
+#include "bot.h"
+#include "rollback.h"
+
+// How long each match is played for, unless told otherwise, in frames.
+const int DEFAULT_FRAMES = 30000;
+// The most frames a peer which has fallen behind simulates in one tick.
+const int MAX_CATCH_UP_FRAMES = 2;
+// How many ticks a match may take, as a multiple of its frames, before the
+// peers are given up on. Stalled peers take several times their frames.
+const int MAX_TICKS_PER_FRAME = 100;
+
+// The network conditions and input delay of one run.
+struct scenario {
+  int latency; // The one-way latency, in ticks.
+  int jitter; // Packets are delayed up to this much more or less.
+  int loss; // The percentage of packets lost.
+  int input_delay;
+};
+
+// The scenarios run when none is given on the command line.
+const scenario DEFAULT_SCENARIOS[] = {
+  {0, 0, 0, 0}, {20, 5, 0, 2}, {50, 10, 0, 2}, {50, 10, 5, 4},
+  {100, 20, 5, 4}
+};
+
+// A packet on its way, and when it arrives.
+struct packet_in_flight {
+  long arrival;
+  long order; // Breaks ties, so packets due at once arrive in order.
+  rollback_packet packet;
+
+  bool operator>(const packet_in_flight &other) const {
+    return arrival > other.arrival ||
+        (arrival == other.arrival && order > other.order);
+  }
+};
+
+/**
+ * One direction of an in-process link between two sessions, which delays
+ * each packet by the latency plus or minus a random jitter, so that packets
+ * can arrive out of order, and loses some of them.
+ */
+class LoopbackLink {
+ public:
+  LoopbackLink(const scenario &conditions, uint64_t seed)
+      : conditions(conditions), sent(0) {
+    random.seed(seed, UNIFORM_PIECES);
+  }
+
+  /**
+   * Sends a packet.
+   * @param packet
+   * @param now the current tick
+   */
+  void send(const rollback_packet &packet, long now) {
+    packet_in_flight flight;
+    int jitter = conditions.jitter ?
+        (int)random.next_below(2 * conditions.jitter + 1) - conditions.jitter :
+        0;
+
+    if ((int)random.next_below(100) < conditions.loss) {
+      return;
+    }
+    flight.arrival = now + max(0, conditions.latency + jitter);
+    flight.order = sent++;
+    flight.packet = packet;
+    in_flight.push(flight);
+  }
+
+  /**
+   * Takes the next packet which has arrived.
+   * @param now the current tick
+   * @param packet filled in with the packet
+   * @return false if none has
+   */
+  bool receive(long now, rollback_packet &packet) {
+    if (in_flight.empty() || in_flight.top().arrival > now) {
+      return false;
+    }
+    packet = in_flight.top().packet;
+    in_flight.pop();
+    return true;
+  }
+
+ private:
+  scenario conditions;
+  PieceGenerator random;
+  long sent;
+  priority_queue<packet_in_flight, vector<packet_in_flight>,
+                 greater<packet_in_flight> > in_flight;
+};
+
+// One side of a match: its session, and the bot playing it.
+struct peer {
+  RollbackSession *session;
+  int player;
+  Bot *bot;
+  int plan[MAX_DEMO_INPUTS];
+  int plan_size;
+  int next_input;
+  int planned_piece; // The piece the plan is for, by its spawn count.
+  int slept; // The time since the bot's last input, in microseconds.
+  // Every input scheduled, and the frame it was scheduled for.
+  vector<pair<int, int> > inputs;
+  vector<double> frame_times; // The time each tick took, in microseconds.
+};
+
+/**
+ * Makes the bot's next input, if it is time to, on the match as the peer
+ * predicts it. The bot plans each piece once it has spawned, then makes the
+ * inputs of its plan at the pace of the demo, ending with a drop.
+ * @param player
+ */
+void play_bot(peer &player) {
+  const GameState &game = player.session->get_match().games[player.player];
+
+  player.slept += TICK_LENGTH;
+  if (player.slept < DEMO_INPUT_DELAY || game.new_piece || game.game_over) {
+    return;
+  }
+  player.slept = 0;
+  if (game.pieces_spawned != player.planned_piece) {
+    player.plan_size = player.bot->plan_inputs(game, player.plan,
+                                               MAX_DEMO_INPUTS);
+    player.next_input = 0;
+    player.planned_piece = game.pieces_spawned;
+  }
+  if (player.next_input <= player.plan_size) {
+    int input = player.next_input < player.plan_size ?
+        player.plan[player.next_input] : INPUT_DROP;
+    int frame = player.session->add_local_input(input);
+
+    if (frame >= 0) {
+      player.inputs.push_back(make_pair(frame, input));
+      player.next_input++;
+    }
+  }
+}
+
+/**
+ * Returns whether two games are in the same state, as far as the players
+ * can see or the rest of the match depends on.
+ * @param a
+ * @param b
+ * @return
+ */
+bool same_game(const GameState &a, const GameState &b) {
+  bool has_piece = !a.new_piece && !a.game_over;
+
+  return !memcmp(a.board_rows, b.board_rows, sizeof(a.board_rows)) &&
+      !memcmp(a.board_colours, b.board_colours, sizeof(a.board_colours)) &&
+      a.new_piece == b.new_piece && a.game_over == b.game_over &&
+      (!has_piece || (a.current_piece_type == b.current_piece_type &&
+                      a.piece_rotation == b.piece_rotation &&
+                      a.piece_x == b.piece_x && a.piece_y == b.piece_y)) &&
+      a.next_piece_type == b.next_piece_type && a.score == b.score &&
+      a.difficulty == b.difficulty && a.total_lines == b.total_lines &&
+      a.pieces_spawned == b.pieces_spawned;
+}
+
+/**
+ * Plays a match between two bots over a loopback link, then checks that both
+ * peers end up in the state the match reaches in lock-step with every input
+ * known, and prints how the rollbacks went.
+ * @param conditions
+ * @param frames how many frames the match is played for
+ * @param seed
+ * @return false if the peers disagree
+ */
+bool run_scenario(const scenario &conditions, int frames, uint64_t seed) {
+  peer peers[2];
+  LoopbackLink links[2] = {LoopbackLink(conditions, mix_seed(seed)),
+                           LoopbackLink(conditions, mix_seed(seed + 1))};
+  VersusMatch *reference = new VersusMatch();
+  vector<double> times;
+  long tick;
+  bool agree = true;
+
+  for (int p = 0; p < 2; p++) {
+    peers[p].session = new RollbackSession();
+    peers[p].session->start(seed, 1, p, conditions.input_delay);
+    peers[p].player = p;
+    peers[p].bot = new Bot(NULL, 4);
+    peers[p].plan_size = 0;
+    peers[p].next_input = 0;
+    peers[p].planned_piece = -1;
+    peers[p].slept = 0;
+  }
+
+  /**
+   * Each tick, a peer takes the packets which have arrived, plays, simulates
+   * the frames it is due and sends a packet.
+   */
+  for (tick = 0; tick < (long)frames * MAX_TICKS_PER_FRAME; tick++) {
+    bool settled = true;
+
+    for (int p = 0; p < 2; p++) {
+      RollbackSession &session = *peers[p].session;
+      rollback_packet packet;
+
+      while (links[1 - p].receive(tick, packet)) {
+        session.receive(packet);
+      }
+      if (tick < frames) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int i = 0; i < MAX_CATCH_UP_FRAMES &&
+                        session.get_frame() <= tick && session.advance();
+             i++) {
+        }
+        chrono::duration<double, micro> elapsed =
+            chrono::steady_clock::now() - start;
+        peers[p].frame_times.push_back(elapsed.count());
+        play_bot(peers[p]);
+      } else {
+        // After the last tick, the peers only catch up to the last frame.
+        for (int i = 0; i < MAX_CATCH_UP_FRAMES &&
+                        session.get_frame() < frames && session.advance();
+             i++) {
+        }
+        session.synchronise();
+      }
+      settled = settled && session.get_frame() == frames &&
+          session.get_confirmed_frame() == frames;
+      session.make_packet(packet);
+      links[p].send(packet, tick);
+    }
+    if (tick >= frames && settled) {
+      break;
+    }
+  }
+
+  // Play the match again in lock-step, with every input known.
+  reference->start(seed, 1);
+  for (int p = 0; p < 2; p++) {
+    sort(peers[p].inputs.begin(), peers[p].inputs.end());
+  }
+  size_t next[2] = {0, 0};
+  for (int f = 0; f < frames; f++) {
+    for (int p = 0; p < 2; p++) {
+      if (next[p] < peers[p].inputs.size() &&
+          peers[p].inputs[next[p]].first == f) {
+        reference->apply_input(p, peers[p].inputs[next[p]++].second);
+      }
+    }
+    reference->step(TICK_LENGTH);
+  }
+  for (int p = 0; p < 2; p++) {
+    const VersusMatch &match = peers[p].session->get_match();
+    agree = agree && peers[p].session->get_frame() == frames &&
+        same_game(match.games[0], reference->games[0]) &&
+        same_game(match.games[1], reference->games[1]);
+    times.insert(times.end(), peers[p].frame_times.begin(),
+                 peers[p].frame_times.end());
+  }
+  sort(times.begin(), times.end());
+
+  RollbackSession &a = *peers[0].session;
+  RollbackSession &b = *peers[1].session;
+  printf("%4d %4d %4d%% %5d %9ld %9.1f %6d %7ld %8.2f %8.2f %8.2f %7d %7d "
+         "%s\n", conditions.latency, conditions.jitter, conditions.loss,
+         conditions.input_delay, a.rollbacks + b.rollbacks,
+         a.rollbacks + b.rollbacks ?
+             (double)(a.resimulated_frames + b.resimulated_frames) /
+                 (a.rollbacks + b.rollbacks) : 0.0,
+         max(a.max_rollback, b.max_rollback), a.stalls + b.stalls,
+         times[times.size() / 2], times[(times.size() - 1) * 99 / 100],
+         times.back(), reference->games[0].pieces_spawned,
+         reference->games[1].pieces_spawned, agree ? "yes" : "NO");
+
+  for (int p = 0; p < 2; p++) {
+    delete peers[p].session;
+    delete peers[p].bot;
+  }
+  delete reference;
+  return agree;
+}
+
+/**
+ * Prints how to use the program.
+ * @param program
+ */
+void print_usage(const char *program) {
+  fprintf(stderr, "Usage: %s [--frames N] [--seed N] [--latency N --jitter N "
+          "--loss N --delay N]\n", program);
+}
+
+int main(int argc, char *argv[]) {
+  int frames = DEFAULT_FRAMES;
+  uint64_t seed = 1;
+  scenario chosen = {-1, 0, 0, 2};
+  bool agree = true;
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 < argc && !strcmp(argv[i], "--frames")) {
+      frames = atoi(argv[++i]);
+    } else if (i + 1 < argc && !strcmp(argv[i], "--seed")) {
+      seed = strtoull(argv[++i], NULL, 10);
+    } else if (i + 1 < argc && !strcmp(argv[i], "--latency")) {
+      chosen.latency = atoi(argv[++i]);
+    } else if (i + 1 < argc && !strcmp(argv[i], "--jitter")) {
+      chosen.jitter = atoi(argv[++i]);
+    } else if (i + 1 < argc && !strcmp(argv[i], "--loss")) {
+      chosen.loss = atoi(argv[++i]);
+    } else if (i + 1 < argc && !strcmp(argv[i], "--delay")) {
+      chosen.input_delay = atoi(argv[++i]);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (frames <= 0 || chosen.jitter < 0 || chosen.loss < 0 ||
+      chosen.loss >= 100 || chosen.input_delay < 0 ||
+      chosen.input_delay > MAX_INPUT_DELAY) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  printf("frames: %d of %d us per match\n", frames, TICK_LENGTH);
+  printf("%4s %4s %5s %5s %9s %9s %6s %7s %8s %8s %8s %7s %7s %s\n", "lat",
+         "jit", "loss", "delay", "rollbacks", "frames/rb", "max", "stalls",
+         "tick p50", "p99 us", "max us", "pieces", "pieces", "agree");
+  if (chosen.latency >= 0) {
+    agree = run_scenario(chosen, frames, seed);
+  } else {
+    for (size_t i = 0;
+         i < sizeof(DEFAULT_SCENARIOS) / sizeof(DEFAULT_SCENARIOS[0]); i++) {
+      agree = run_scenario(DEFAULT_SCENARIOS[i], frames, seed) && agree;
+    }
+  }
+  return agree ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+#include <algorithm>
+
+using namespace std;
+
+#include "bot.h"
+
+// The score of a board on which the next piece cannot be placed.
+const double LOSING_SCORE = -1e9;
+
+Bot::Bot(ThreadPool *pool, int beam_width, const bot_weights &weights)
+    : pool(pool), beam_width(max(1, beam_width)), weights(weights),
+      next_piece_type(0), searches(pool ? pool->size() : 1),
+      order(PIECE_POSITIONS), first_scores(PIECE_POSITIONS),
+      beam_scores(this->beam_width) {
+}
+
+double Bot::score_board(const uint16_t board_rows[GAME_BOARD_HEIGHT],
+                        int lines_cleared) const {
+  board_features features;
+
+  get_board_features(board_rows, features);
+  return score_features(features, lines_cleared);
+}
+
+double Bot::score_features(const board_features &features,
+                           int lines_cleared) const {
+  return weights.aggregate_height * features.aggregate_height +
+         weights.holes * features.holes +
+         weights.bumpiness * features.bumpiness +
+         weights.lines_cleared * lines_cleared +
+         weights.wells * features.wells +
+         weights.row_transitions * features.row_transitions;
+}
+
+void Bot::get_search_features(scored_search &scored) {
+  for (int i = 0; i < scored.search.count; i++) {
+    scored.boards[i] = scored.search.placements[i].board_rows;
+  }
+  get_board_features(scored.boards, scored.search.count, scored.features);
+}
+
+int Bot::choose_placement(const GameState &game) {
+  int count = first_search.search.find_placements(game);
+  int beam_size = min(beam_width, count);
+  int best = 0;
+
+  if (!count) {
+    return -1;
+  }
+
+  // Score every placement of the falling piece on its own.
+  get_search_features(first_search);
+  for (int i = 0; i < count; i++) {
+    order[i] = i;
+    first_scores[i] = score_features(
+        first_search.features[i],
+        first_search.search.placements[i].lines_cleared);
+  }
+  // Without a lookahead, the best first score is the answer.
+  if (game.new_piece) {
+    return max_element(first_scores.begin(), first_scores.begin() + count) -
+           first_scores.begin();
+  }
+
+  // Keep the best placements, and search the next piece on each of them.
+  partial_sort(order.begin(), order.begin() + beam_size,
+               order.begin() + count, [this](int a, int b) {
+    return first_scores[a] > first_scores[b];
+  });
+  next_piece_type = game.next_piece_type;
+  if (pool) {
+    pool->parallel_for(beam_size, 1, [this](long begin, long end, int worker) {
+      for (long i = begin; i < end; i++) {
+        beam_scores[i] = search_next_piece(order[i], worker);
+      }
+    });
+  } else {
+    for (int i = 0; i < beam_size; i++) {
+      beam_scores[i] = search_next_piece(order[i], 0);
+    }
+  }
+
+  for (int i = 1; i < beam_size; i++) {
+    if (beam_scores[i] > beam_scores[best]) {
+      best = i;
+    }
+  }
+  return order[best];
+}
+
+int Bot::plan_inputs(const GameState &game, int inputs[], int max_inputs) {
+  int choice = choose_placement(game);
+  int count = choice < 0 ? 0 : first_search.search.get_inputs(
+      choice, inputs, max_inputs);
+
+  while (count > 0 && inputs[count - 1] == INPUT_DOWN) {
+    count--;
+  }
+  return max(count, 0);
+}
+
+double Bot::search_next_piece(int candidate, int worker) {
+  const Placement &placement = first_search.search.placements[candidate];
+  scored_search &scored = searches[worker];
+  int count = scored.search.find_placements(placement.board_rows,
+                                            next_piece_type, 0, 4, 19);
+  double best = LOSING_SCORE;
+
+  get_search_features(scored);
+  for (int i = 0; i < count; i++) {
+    best = max(best, score_features(scored.features[i],
+                                    placement.lines_cleared +
+                                    scored.search.placements[i].lines_cleared));
+  }
+  return best;
+}
+
+BotPlayer::BotPlayer() : slept(0), input_count(0), next_input(0) {
+}
+
+void BotPlayer::reset() {
+  slept = 0;
+  input_count = 0;
+  next_input = 0;
+}
+
+bool BotPlayer::tick(GameState &game, Bot &bot) {
+  slept += TICK_LENGTH;
+  if (slept < DEMO_INPUT_DELAY) {
+    return false;
+  }
+  step(game, bot);
+  slept = 0;
+  return true;
+}
+
+void BotPlayer::step(GameState &game, Bot &bot) {
+  if (game.new_piece) {
+    game.move_piece(0);
+    if (game.game_over) {
+      return;
+    }
+    input_count = bot.plan_inputs(game, inputs, MAX_DEMO_INPUTS);
+    next_input = 0;
+  } else if (next_input < input_count) {
+    game.apply_input(inputs[next_input++]);
+  } else {
+    game.collapse_piece();
+  }
+}
@@ -0,0 +1,156 @@
+#ifndef BOT_H
+#define BOT_H
+
+#include <cstdint>
+#include <vector>
+
+#include "structs.h"
+#include "constants.h"
+#include "engine.h"
+#include "features.h"
+#include "placements.h"
+#include "thread_pool.h"
+
+// The weight of each board feature when scoring a placement.
+struct bot_weights {
+  double aggregate_height;
+  double holes;
+  double bumpiness;
+  double lines_cleared;
+  double wells;
+  double row_transitions;
+};
+
+const bot_weights DEFAULT_BOT_WEIGHTS = {-0.51, -0.36, -0.18, 0.76, -0.25,
+                                         0.0};
+
+/**
+ * Plays the game by itself. Every placement of the falling piece is scored by
+ * a weighted sum of board features; the best ones form a beam, and each is
+ * scored again by the best placement of the next piece (the lookahead shown
+ * in the sidebar) on the board it leaves. The beam is searched in parallel
+ * on a thread pool, if one is given.
+ */
+class Bot {
+ public:
+  /**
+   * @param pool the pool to search the beam on, or NULL to search it on the
+   *        calling thread
+   * @param beam_width how many placements of the falling piece are searched
+   *        with the next piece
+   * @param weights
+   */
+  explicit Bot(ThreadPool *pool = NULL, int beam_width = 8,
+               const bot_weights &weights = DEFAULT_BOT_WEIGHTS);
+
+  /**
+   * Chooses where to place the falling piece of a game, or the next piece if
+   * a new piece has been requested.
+   * @param game
+   * @return the index of the chosen placement in placements(), or -1 if the
+   *         piece cannot be placed
+   */
+  int choose_placement(const GameState &game);
+
+  /**
+   * Chooses where to place the falling piece, and plans the inputs which take
+   * it there. Moves down at the end are left out, since the piece is dropped
+   * once the plan has been played.
+   * @param game
+   * @param inputs filled in with INPUT_ codes
+   * @param max_inputs the size of the inputs array
+   * @return the number of inputs, or 0 if the piece is to be dropped where it
+   *         is
+   */
+  int plan_inputs(const GameState &game, int inputs[], int max_inputs);
+
+  /**
+   * Returns the placements found by the last choose_placement() call.
+   * @return
+   */
+  const PlacementSearch &placements() const {
+    return first_search.search;
+  }
+
+  /**
+   * Scores a board with the bot's weights; higher is better.
+   * @param board_rows
+   * @param lines_cleared the number of lines cleared to reach the board
+   * @return
+   */
+  double score_board(const uint16_t board_rows[GAME_BOARD_HEIGHT],
+                     int lines_cleared) const;
+
+ private:
+  // A placement search and the buffers to score its placements in a batch.
+  struct scored_search {
+    PlacementSearch search;
+    const uint16_t *boards[PIECE_POSITIONS];
+    board_features features[PIECE_POSITIONS];
+  };
+
+  double score_features(const board_features &features,
+                        int lines_cleared) const;
+  void get_search_features(scored_search &scored);
+  double search_next_piece(int candidate, int worker);
+
+  ThreadPool *pool;
+  int beam_width;
+  bot_weights weights;
+  int next_piece_type;
+  // The placements of the falling piece.
+  scored_search first_search;
+  // The search for the next piece's placements used by each worker.
+  std::vector<scored_search> searches;
+  // The placements of the falling piece, ordered by their own score.
+  std::vector<int> order;
+  std::vector<double> first_scores;
+  // The score of each placement in the beam after searching the next piece.
+  std::vector<double> beam_scores;
+};
+
+/**
+ * Plays a game with a bot one input at a time, the way a player would: it
+ * spawns each piece, plans the inputs which take it to the bot's placement,
+ * makes one input every DEMO_INPUT_DELAY, then drops the piece. Many players
+ * can share one bot, e.g. those of the multi-board mode.
+ */
+class BotPlayer {
+ public:
+  BotPlayer();
+
+  /**
+   * Forgets the plan and the time passed, e.g. when a new game starts.
+   */
+  void reset();
+
+  /**
+   * Lets a tick pass, and makes the next step once the input delay is up.
+   * @param game
+   * @param bot
+   * @return true if a step was made
+   */
+  bool tick(GameState &game, Bot &bot);
+
+  /**
+   * Makes the next step: spawning a piece and planning where to place it,
+   * moving the piece along the planned inputs, or dropping it once it is
+   * above its placement.
+   * @param game
+   * @param bot
+   */
+  void step(GameState &game, Bot &bot);
+
+  // How much time is left until the next step, in microseconds.
+  int get_time_left() const {
+    return DEMO_INPUT_DELAY - slept;
+  }
+
+ private:
+  int slept; // How much time has passed since the last step.
+  int inputs[MAX_DEMO_INPUTS];
+  int input_count;
+  int next_input;
+};
+
+#endif
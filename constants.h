@@ -1,3 +1,6 @@
+#ifndef CONSTANTS_H
+#define CONSTANTS_H
+
 // Colours used in the game, taken from http://www.flatuicolorpicker.com.
 const struct colour colours[] = {
   {0.992f, 0.890f, 0.655f},
@@ -36,12 +39,27 @@ const int PREGAME = 1;
 const int GAME = 2;
 const int GAME_OVER = 3;
 const int HIGH_SCORE = 4;
+const int MULTI_BOARD = 5;
 // Menu button codes.
 const int PLAY_BUTTON = 0;
 const int HIGH_SCORES_BUTTON = 1;
 const int EXIT_BUTTON = 2;
 // Maximum difficulty.
 const int MAX_DIFFICULTY = 50;
+// How long a game tick lasts, in microseconds. Replays count time in ticks.
+const int TICK_LENGTH = 1000;
+// The most ticks the game catches up on at once, e.g. after being suspended.
+const int MAX_CATCH_UP_TICKS = 1000;
+// How many frames the heap allocations are reported for at a time.
+const int ALLOCATION_REPORT_FRAMES = 100;
+// How many of the latest frames the frame timing overlay averages over.
+const int OVERLAY_FRAMES = 60;
+// How long the bot waits between inputs in a demo game, in microseconds.
+const int DEMO_INPUT_DELAY = 40000;
+// The maximum number of inputs the bot plans for a piece in a demo game.
+const int MAX_DEMO_INPUTS = 64;
+// The most games the multi-board mode runs side by side.
+const int MAX_BOARDS = 16;
 /**
  * Standard block sizes, divided into inner block (the "bumped square"),
  * and the outer block (the whole square, including the shaded "sloped" edges).
@@ -64,6 +82,8 @@ const float LINE_WIDTH = 2.5f;
  */
 const int GAME_BOARD_WIDTH = 10;
 const int GAME_BOARD_HEIGHT = 22;
+// A board row in which every column is occupied.
+const uint16_t FULL_ROW = (1 << GAME_BOARD_WIDTH) - 1;
 // Game pieces indices.
 const int I_PIECE = 0;
 const int J_PIECE = 1;
@@ -73,7 +93,7 @@ const int S_PIECE = 4;
 const int T_PIECE = 5;
 const int Z_PIECE = 6;
 // The coordinates for each game piece relative to its centre, {0, 0}.
-const int GAME_PIECES[][2] = {
+constexpr int GAME_PIECES[][2] = {
   // I piece.
   {0, 0}, {-1, 0}, {1, 0}, {2, 0},
   // J piece.
@@ -89,3 +109,5 @@ const int GAME_PIECES[][2] = {
   // Z piece.
   {0, 0}, {-1, 0}, {0, -1}, {1, -1}
 };
+
+#endif
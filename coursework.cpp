@@ -5,38 +5,182 @@
 #endif
 
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <fstream>
+#include <ctime>
 #include <iostream>
-#include <string>
-#include <unistd.h>
+#include <new>
 #include <vector>
 
 using namespace std;
 
 #include "structs.h"
 #include "constants.h"
+#include "bot.h"
+#include "engine.h"
+#include "high_scores.h"
+#include "leaderboard.h"
+#ifdef HAVE_EGL
+#include "headless.h"
+#endif
+#include "profiler.h"
+#include "renderer.h"
+#include "replay.h"
+#include "spectator.h"
 #include "util.h"
 
-int game_board[GAME_BOARD_WIDTH][GAME_BOARD_HEIGHT];
-int piece_blocks[4][2];
+/**
+ * How many times the heap has been allocated from by this thread. It is
+ * counted by the replacement operator new below, to check that frames do not
+ * allocate once the game is running.
+ */
+thread_local long heap_allocations;
+
+/**
+ * The replacement operators are not inlined, so that the compiler does not
+ * pair the free() below with a new expression and warn of a mismatch.
+ */
+__attribute__((noinline)) void *operator new(size_t size) {
+  void *memory = malloc(size ? size : 1);
+
+  if (!memory) {
+    throw bad_alloc();
+  }
+  heap_allocations++;
+  return memory;
+}
+
+__attribute__((noinline)) void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void *memory) noexcept {
+  free(memory);
+}
+
+__attribute__((noinline)) void operator delete[](void *memory) noexcept {
+  operator delete(memory);
+}
+
+__attribute__((noinline)) void operator delete(void *memory,
+                                               size_t) noexcept {
+  operator delete(memory);
+}
+
+__attribute__((noinline)) void operator delete[](void *memory,
+                                                 size_t) noexcept {
+  operator delete(memory);
+}
+
+GameState game;
+// Collects the blocks of each frame, so they are drawn in one call.
+BlockBatch block_batch;
+// The parts of the screens which only change when the window is resized.
+StaticLayer menu_layer;
+StaticLayer game_layer;
+StaticLayer grid_layer;
+StaticLayer boards_layer;
+// The rectangles of the display which must be redrawn in the next frame.
+DirtyRegion dirty_region;
+int drawn_screen = -1; // The screen shown when a redraw was last asked for.
+uint32_t projection_rows; // The lines the piece projection was drawn on.
+// The seed for the next game, and how its pieces are generated.
+uint64_t game_seed;
+uint64_t current_game_seed; // The seed of the current game.
+int generator_mode = UNIFORM_PIECES;
+// Picks the colours of the menu blocks, without touching the game's pieces.
+PieceGenerator colour_generator;
 int current_screen = MENU;
 int highlighted_button = PLAY_BUTTON;
-int difficulty;
-int score;
-int next_piece_type;
-int current_piece_type;
 int slept; // How much time has passed since the last piece descent.
-int pieces_spawned; // How many pieces have been spawned.
 int countdown; // Time left until resuming or starting a game.
 int paused_slept; // Elapsed time since last piece descent when pausing.
-bool new_piece; // True if a new piece is requested.
 bool grid_enabled; // True if grid view is enabled.
 bool projection_enabled; // True if piece projection is enabled.
 bool paused; // True if the game is paused.
 bool has_high_score; // True if the current score is a high score.
-vector<int> high_scores;
+// The high scores, which are stored in the high_scores.txt file.
+HighScoreStore high_scores("high_scores.txt");
+// Every finished game, which is stored in the leaderboard.dat file.
+Leaderboard leaderboard;
+bool leaderboard_open; // True if the leaderboard file could be opened.
+// The name the games are added to the leaderboard under.
+const char *player_name;
+int starting_difficulty; // The difficulty the current game started at.
+// Where the last game ranks at its starting difficulty, shown at game over.
+char rank_text[64];
+// The starting difficulty whose games the high scores screen shows, or
+// ANY_DIFFICULTY for every game.
+int high_score_difficulty = ANY_DIFFICULTY;
+// The bot which plays demo games, and how it is playing the demo game.
+Bot *demo_bot;
+bool demo_mode; // True if the bot is playing a demo game.
+BotPlayer demo;
+// One of the games of the multi-board mode, which has its own gravity timer.
+struct board_game {
+  GameState game;
+  bool bot; // True if the bot plays this board, rather than the player.
+  int slept; // How much time has passed since the last piece descent.
+  BotPlayer player; // Plays the board if the bot does.
+  number_text score_text;
+};
+board_game boards[MAX_BOARDS];
+int board_count;
+// The room each board takes in the multi-board mode, in game blocks: its
+// border, its score above it and a gap around them.
+const float BOARD_CELL_WIDTH = 13.0f;
+const float BOARD_CELL_HEIGHT = 23.0f;
+/**
+ * How the boards are laid out: how many there are to a row, and how much
+ * they are scaled down by to fit.
+ */
+int board_columns;
+float board_scale;
+// How much time has passed in the current game, in replay ticks.
+long game_ticks;
+// The file the games played are recorded to, if any.
+FILE *record_file;
+ReplayRecorder recorder;
+bool recording; // True if the current game is being recorded.
+// The replay being played back, if any, and its next event.
+FILE *replay_file;
+ReplayReader *replay_reader;
+PlacementSearch *replay_search; // Checks the placements of the replay.
+bool replay_mode; // True if a replay is being played back.
+replay_event next_replay_event;
+/**
+ * The broadcast of the games to spectators, if any, and how many ticks they
+ * have been stepped since it started. Its index is written when it is
+ * destroyed at exit.
+ */
+SpectatorWriter broadcast;
+long broadcast_ticks;
+// The text of the numbers shown on the game screen, kept between frames.
+number_text score_text;
+number_text difficulty_text;
+number_text countdown_text;
+// True if the heap allocations made by each frame are reported.
+bool counting_allocations;
+long frames_counted;
+long frame_allocations;
+// Times each frame, and shows the timings over the screen if enabled.
+FrameProfiler profiler;
+bool overlay_enabled;
+// The files the frame timings are exported to on exit, if any.
+const char *profile_csv_path;
+const char *profile_trace_path;
+// Where the overlay is shown, over the top left corner.
+const rectangle OVERLAY_AREA = {10.0f, DISPLAY_HEIGHT - 200.0f, 330.0f,
+                                DISPLAY_HEIGHT - 10.0f};
+// The frames the overlay averages over.
+frame_profile overlay_frames[OVERLAY_FRAMES];
+// When the game time was last brought up to date, on a monotonic clock.
+chrono::steady_clock::time_point last_update;
+// Identifies the latest update timer, so that earlier ones are ignored.
+int timer_generation;
 
 /**
  * Returns true if the game is running, i.e. if the current screen is the game
@@ -48,28 +192,51 @@ bool is_game_running() {
 }
 
 /**
- * Returns true if the block at the given coordinates is part of the currently
- * falling piece.
- * @param x the block's column
- * @param y the block's line
- * @return true if it is part of the piece, false otherwise
+ * Returns whether game time passes, i.e. whether a game, or the boards of
+ * the multi-board mode, are being played and not paused.
+ * @return
  */
-bool is_block_in_piece(int x, int y) {
-  for (int i = 0; i < 4; i++) {
-    if (piece_blocks[i][0] == x && piece_blocks[i][1] == y) {
-      return true;
-    }
+bool is_clock_running() {
+  return (current_screen == GAME || current_screen == MULTI_BOARD) && !paused;
+}
+
+/**
+ * Records an input or a gravity step of the current game, if it is being
+ * recorded.
+ * @param code one of the INPUT_ codes or REPLAY_GRAVITY
+ */
+void record_event(int code) {
+  if (recording) {
+    recorder.record(game_ticks, code);
+  }
+}
+
+/**
+ * Ends the recording of the current game, and writes it to the replay file.
+ */
+void end_recording() {
+  if (!recording) {
+    return;
+  }
+  recording = false;
+  recorder.end_game(game_ticks, game);
+  if (!recorder.write_replay(record_file) || fflush(record_file)) {
+    cerr << "Cannot write the replay file." << endl;
   }
-  return false;
 }
 
 /**
  * Displays a window containing the top 10 high scores sorted in descending
- * order.
+ * order. They are the games of the leaderboard, with their players, either
+ * every game or those started at one difficulty, which the left and right
+ * keys choose; without a leaderboard they are the stored high scores.
  */
 void display_high_scores() {
-  string score;
-  int counter = 1;
+  leaderboard_record top[MAX_HIGH_SCORES];
+  // The text of a row, e.g. "1. 250  name", or of the difficulty shown.
+  char row[NUMBER_TEXT_SIZE * 2 + LEADERBOARD_NAME_SIZE + 4];
+  char *end;
+  int count;
 
   // Display the window.
   display_subscreen(DISPLAY_WIDTH * 0.15f, DISPLAY_HEIGHT * 0.15f,
@@ -85,12 +252,34 @@ void display_high_scores() {
       draw_text("Press ESC to go back.", true, 0.25f, 0.2f);
     glPopMatrix();
 
-    for (vector<int>::iterator it = high_scores.begin();
-         it < high_scores.end(); it++) {
-      score = int_to_string(counter) + ". " + int_to_string(*it);
-      glTranslatef(0.0f, -DISPLAY_HEIGHT * 0.05f, 0.0f);
-      draw_text(score, true, 0.3f, 0.25f);
-      counter++;
+    if (!leaderboard_open) {
+      for (int i = 0; i < high_scores.get_count(); i++) {
+        end = format_number(i + 1, row);
+        *end++ = '.';
+        *end++ = ' ';
+        format_number(high_scores.get_scores()[i], end);
+        glTranslatef(0.0f, -DISPLAY_HEIGHT * 0.05f, 0.0f);
+        draw_text(row, true, 0.3f, 0.25f);
+      }
+      glPopMatrix();
+      return;
+    }
+
+    // Display which games are shown.
+    if (high_score_difficulty == ANY_DIFFICULTY) {
+      strcpy(row, "< All difficulties >");
+    } else {
+      snprintf(row, sizeof(row), "< Difficulty %d >", high_score_difficulty);
+    }
+    glTranslatef(0.0f, -DISPLAY_HEIGHT * 0.06f, 0.0f);
+    draw_text(row, true, 0.2f, 0.2f);
+
+    count = leaderboard.get_top(top, MAX_HIGH_SCORES, high_score_difficulty);
+    for (int i = 0; i < count; i++) {
+      snprintf(row, sizeof(row), "%d. %d  %s", i + 1, top[i].score,
+               top[i].name);
+      glTranslatef(0.0f, -DISPLAY_HEIGHT * 0.045f, 0.0f);
+      draw_text(row, true, 0.2f, 0.25f);
     }
   glPopMatrix();
 }
@@ -100,8 +289,8 @@ void display_high_scores() {
  * tells the player whether it is a high score or not.
  */
 void display_game_over() {
-  string score_string = "Score: " + int_to_string(score);
-  float score_offset = get_offset(score_string);
+  const char *score_string = get_number_text(score_text, game.score);
+  float score_offset = get_offset("Score: ") + get_offset(score_string);
 
   // Display the pregame window.
   display_subscreen(DISPLAY_WIDTH * 0.25f, DISPLAY_HEIGHT * 0.35f,
@@ -117,9 +306,17 @@ void display_game_over() {
       draw_text("Score: ", false, 0.3f, 0.25f);
       glColor3f(colours[GREEN].r, colours[GREEN].g, colours[GREEN].b);
       glTranslatef(get_offset("Score: ") * 0.6f, 0.0f, 0.0f);
-      draw_text(int_to_string(score), false, 0.3f, 0.25f);
+      draw_text(score_string, false, 0.3f, 0.25f);
     glPopMatrix();
 
+    // Display where the score ranks among the games at its difficulty.
+    if (rank_text[0]) {
+      glPushMatrix();
+        glTranslatef(0.0f, -DISPLAY_HEIGHT * 0.125f, 0.0f);
+        draw_text(rank_text, true, 0.2f, 0.25f);
+      glPopMatrix();
+    }
+
     // Display a help message.
     glPushMatrix();
       glColor3f(colours[BLACK].r, colours[BLACK].g, colours[BLACK].b);
@@ -141,7 +338,8 @@ void display_game_over() {
  */
 void display_game_countdown() {
   // If paused, display an appropriate message. Else, display the countdown.
-  string countdown_string = paused ? "Paused" : int_to_string(countdown);
+  const char *countdown_string =
+      paused ? "Paused" : get_number_text(countdown_text, countdown);
   // Scale the message appropriately.
   float scale = paused ? 1.0f : 3.0f;
 
@@ -158,49 +356,20 @@ void display_game_countdown() {
  * its current position.
  */
 void display_game_projection() {
-  int projection_distance = 25;
-  int height;
-
   // Find the distance between the piece and the projection.
-  for (int i = 0; i < 4; i++) {
-    if (piece_blocks[i][1] == 0) {
-      projection_distance = min(projection_distance, 1);
-      continue;
-    }
-    height = piece_blocks[i][1];
-    while (height) {
-      height--;
-      if (game_board[piece_blocks[i][0]][height]) {
-        if (!is_block_in_piece(piece_blocks[i][0], height)) {
-          projection_distance = min(projection_distance,
-                                    piece_blocks[i][1] - height);
-        }
-        break;
-      }
-      if (height == 0) {
-        projection_distance = min(projection_distance, piece_blocks[i][1] + 1);
-      }
-    }
-  }
+  int projection_distance = game.drop_distance();
+  int piece_blocks[4][2];
+
+  game.get_piece_blocks(piece_blocks);
 
-  // Print the projection blocks.
+  // Print the projection blocks as frames in the colour of the piece.
   for (int i = 0; i < 4; i++) {
-    glPushMatrix();
-      glTranslatef(GAME_BLOCK_SIZE * (float)(piece_blocks[i][0] + 2) -
-                   GAME_BLOCK_SIZE_HALF,
-                   GAME_BLOCK_SIZE * (float)(piece_blocks[i][1] -
-                   projection_distance + 3) - GAME_BLOCK_SIZE_HALF, 0.0f);
-      glScalef(GAME_BLOCK_SCALE, GAME_BLOCK_SCALE, 0.0f);
-      glColor3f(colours[current_piece_type + CYAN].r,
-                colours[current_piece_type + CYAN].g,
-                colours[current_piece_type + CYAN].b);
-      glBegin(GL_LINE_LOOP);
-        glVertex2f(-OUTER_BLOCK_SIZE_HALF, OUTER_BLOCK_SIZE_HALF);
-        glVertex2f(OUTER_BLOCK_SIZE_HALF, OUTER_BLOCK_SIZE_HALF);
-        glVertex2f(OUTER_BLOCK_SIZE_HALF, -OUTER_BLOCK_SIZE_HALF);
-        glVertex2f(-OUTER_BLOCK_SIZE_HALF, -OUTER_BLOCK_SIZE_HALF);
-      glEnd();
-    glPopMatrix();
+    block_batch.add_frame(game.current_piece_type + CYAN,
+                          GAME_BLOCK_SIZE * (float)(piece_blocks[i][0] + 2) -
+                          GAME_BLOCK_SIZE_HALF,
+                          GAME_BLOCK_SIZE * (float)(piece_blocks[i][1] -
+                          projection_distance + 2) - GAME_BLOCK_SIZE_HALF,
+                          GAME_BLOCK_SCALE);
   }
 }
 
@@ -208,19 +377,35 @@ void display_game_projection() {
  * Displays the game board, i.e. the squares which already contain blocks.
  */
 void display_game_board() {
-  for (int i = 0; i < 10; i++) {
-    for (int j = 0; j < 20; j++) {
-      if (!game_board[i][j]) {
+  int piece_blocks[4][2];
+
+  for (int j = 0; j < 20; j++) {
+    for (int i = 0; i < 10; i++) {
+      if (!(game.board_rows[j] & (1 << i))) {
         continue;
       }
-      glPushMatrix();
-        glTranslatef(GAME_BLOCK_SIZE * (float)(i + 2) - GAME_BLOCK_SIZE * 0.5f,
-                     GAME_BLOCK_SIZE * (float)(j + 2) - GAME_BLOCK_SIZE * 0.5f,
-                     0.0f);
-        glScalef(GAME_BLOCK_SCALE, GAME_BLOCK_SCALE, 0.0f);
-        draw_block(colours[game_board[i][j]]);
-      glPopMatrix();
+      block_batch.add_block(game.board_colours[j][i],
+                            GAME_BLOCK_SIZE * (float)(i + 2) -
+                            GAME_BLOCK_SIZE_HALF,
+                            GAME_BLOCK_SIZE * (float)(j + 2) -
+                            GAME_BLOCK_SIZE_HALF, GAME_BLOCK_SCALE);
+    }
+  }
+
+  // The falling piece is not part of the board until it lands.
+  if (game.new_piece) {
+    return;
+  }
+  game.get_piece_blocks(piece_blocks);
+  for (int i = 0; i < 4; i++) {
+    if (piece_blocks[i][1] >= 20) {
+      continue;
     }
+    block_batch.add_block(game.current_piece_type + CYAN,
+                          GAME_BLOCK_SIZE * (float)(piece_blocks[i][0] + 2) -
+                          GAME_BLOCK_SIZE_HALF,
+                          GAME_BLOCK_SIZE * (float)(piece_blocks[i][1] + 2) -
+                          GAME_BLOCK_SIZE_HALF, GAME_BLOCK_SCALE);
   }
 }
 
@@ -229,7 +414,7 @@ void display_game_board() {
  * @param text the input text
  * @param colour the colour of the text
  */
-void draw_sidebar_text(string text, int colour) {
+void draw_sidebar_text(const char *text, int colour) {
   float sidebar_width = DISPLAY_HEIGHT / 21.0f * 5.0f;
   float text_width = get_offset(text) * 2.0f;
   float text_scale_x = 0.3f;
@@ -248,66 +433,89 @@ void draw_sidebar_text(string text, int colour) {
   glPopMatrix();
 }
 
+// The number of lines of text on the sidebar.
+const int SIDEBAR_LINES = 12;
+// The sidebar lines which show the score and the difficulty.
+const int SCORE_LINE = 2;
+const int DIFFICULTY_LINE = 4;
+// Downward translations that must be made between lines of text.
+const float SIDEBAR_LINE_SPACING[SIDEBAR_LINES] = {
+  GAME_BLOCK_SIZE * 2.0f - DISPLAY_HEIGHT, GAME_BLOCK_SIZE * 4.0f,
+  GAME_BLOCK_SIZE, GAME_BLOCK_SIZE * 1.5f, GAME_BLOCK_SIZE,
+  GAME_BLOCK_SIZE * 1.5f, GAME_BLOCK_SIZE, GAME_BLOCK_SIZE,
+  GAME_BLOCK_SIZE, GAME_BLOCK_SIZE, GAME_BLOCK_SIZE,
+  GAME_BLOCK_SIZE * 3.5f
+};
+
+/**
+ * Returns the height of the baseline of a line of text on the sidebar.
+ * @param line
+ * @return
+ */
+float get_sidebar_line_y(int line) {
+  float y = 0.0f;
+
+  for (int i = 0; i <= line; i++) {
+    y -= SIDEBAR_LINE_SPACING[i];
+  }
+  return y;
+}
+
 /**
  * Displays the game sidebar, which shows the next piece, the score, the
- * difficulty and the game controls.
+ * difficulty and the game controls. The labels and controls never change, so
+ * they are drawn separately from the values, into the static layer.
+ * @param labels true to draw the labels and controls, false to draw the next
+ *        piece, the score and the difficulty
  */
-void display_game_sidebar() {
-  // The number of messages to be displayed on the sidebar.
-  int number_of_messages = 12;
+void display_game_sidebar(bool labels) {
   // The messages that will be displayed on the sidebar.
-  string messages[] = {
-    "Next piece:", "Score:", int_to_string(score), "Difficulty:",
-    int_to_string(difficulty), "Controls:", "Arrows: move piece.",
+  const char *messages[] = {
+    "Next piece:", "Score:", get_number_text(score_text, game.score),
+    "Difficulty:", get_number_text(difficulty_text, game.difficulty),
+    "Controls:", "Arrows: move piece.",
     "Space: drop piece.", "P: pause/resume game.", "G: toggle grid view.",
     "H: toggle piece projection.", "ESC: quit."
   };
-  // Downward translations that must be made between lines of text.
-  float y_translations[] = {
-    GAME_BLOCK_SIZE * 2.0f - DISPLAY_HEIGHT, GAME_BLOCK_SIZE * 4.0f,
-    GAME_BLOCK_SIZE, GAME_BLOCK_SIZE * 1.5f, GAME_BLOCK_SIZE,
-    GAME_BLOCK_SIZE * 1.5f, GAME_BLOCK_SIZE, GAME_BLOCK_SIZE,
-    GAME_BLOCK_SIZE, GAME_BLOCK_SIZE, GAME_BLOCK_SIZE,
-    GAME_BLOCK_SIZE * 3.5f
-  };
 
   glPushMatrix();
     // Translate to the width centre of the sidebar.
     glTranslatef(GAME_BLOCK_SIZE * 14.5f, 0.0f, 0.0f);
 
-    for (int i = 0; i < number_of_messages; i++) {
-      glTranslatef(0.0f, -y_translations[i], 0.0f);
+    for (int i = 0; i < SIDEBAR_LINES; i++) {
+      glTranslatef(0.0f, -SIDEBAR_LINE_SPACING[i], 0.0f);
 
       // Draw the score and difficulty in green, everything else in black.
-      if (i == 2 || i == 4) {
-        draw_sidebar_text(messages[i], GREEN);
-      } else {
+      if (i == SCORE_LINE || i == DIFFICULTY_LINE) {
+        if (!labels) {
+          draw_sidebar_text(messages[i], GREEN);
+        }
+      } else if (labels) {
         draw_sidebar_text(messages[i], BLACK);
       }
-
-      // Display the piece lookahead.
-      if (i == 0) {
-        glPushMatrix();
-          // Ensure the next piece is centered.
-          float piece_translate_x = -GAME_BLOCK_SIZE;
-          float piece_translate_y = -GAME_BLOCK_SIZE;
-
-          if (next_piece_type == 0) {
-            piece_translate_x *= 0.5f;
-            piece_translate_y *= 1.5f;
-          } else if (next_piece_type == 3) {
-            piece_translate_x *= 0.5f;
-          } else {
-            piece_translate_x = 0.0f;
-          }
-
-          glTranslatef(piece_translate_x, piece_translate_y, 0.0f);
-          glScalef(GAME_BLOCK_SCALE, GAME_BLOCK_SCALE, 0.0f);
-          draw_piece(next_piece_type);
-        glPopMatrix();
-      }
     }
   glPopMatrix();
+
+  if (labels) {
+    return;
+  }
+
+  // Display the piece lookahead under the first message, centred.
+  float piece_translate_x = -GAME_BLOCK_SIZE;
+  float piece_translate_y = -GAME_BLOCK_SIZE;
+
+  if (game.next_piece_type == 0) {
+    piece_translate_x *= 0.5f;
+    piece_translate_y *= 1.5f;
+  } else if (game.next_piece_type == 3) {
+    piece_translate_x *= 0.5f;
+  } else {
+    piece_translate_x = 0.0f;
+  }
+  block_batch.add_piece(game.next_piece_type,
+                        GAME_BLOCK_SIZE * 14.5f + piece_translate_x,
+                        get_sidebar_line_y(0) + piece_translate_y,
+                        GAME_BLOCK_SCALE);
 }
 
 /**
@@ -319,39 +527,35 @@ void display_game_border() {
   // How many blocks make up the border.
   int height_in_blocks = 21;
   int width_in_blocks = 18;
-  // Translations for drawing various parts of the border.
-  float translate_x1 = OUTER_BLOCK_SIZE * 11.0f;
-  float translate_x2 = OUTER_BLOCK_SIZE * 6.0f;
-  float translate_y = OUTER_BLOCK_SIZE * 20.0f;
-
-  glPushMatrix();
-    glScalef(GAME_BLOCK_SCALE, GAME_BLOCK_SCALE, 0.0f);
-    glTranslatef(OUTER_BLOCK_SIZE_HALF, OUTER_BLOCK_SIZE_HALF, 0.0f);
-
-    // Draw the vertical borders.
-    glPushMatrix();
-      for (int i = 0; i < height_in_blocks; i++) {
-        draw_block(colours[GREY]);
-        glTranslatef(translate_x1, 0.0f, 0.0f);
-        draw_block(colours[GREY]);
-        glTranslatef(translate_x2, 0.0f, 0.0f);
-        draw_block(colours[GREY]);
-        glTranslatef(-translate_x1 - translate_x2, OUTER_BLOCK_SIZE, 0.0f);
-      }
-    glPopMatrix();
-
-    // Draw the horizontal borders.
-    for (int i = 0; i < width_in_blocks; i++) {
-      draw_block(colours[GREY]);
-      if (i > 11) {
-        glTranslatef(0.0f, translate_y, 0.0f);
-        draw_block(colours[GREY]);
-        glTranslatef(0.0f, -translate_y, 0.0f);
-      }
-      glTranslatef(OUTER_BLOCK_SIZE, 0.0f, 0.0f);
+  // The columns of the vertical borders, and the row of the sidebar's top.
+  int border_columns[] = {0, 11, 17};
+  int top_row = 20;
+
+  // Draw the vertical borders.
+  for (int i = 0; i < height_in_blocks; i++) {
+    for (int k = 0; k < 3; k++) {
+      block_batch.add_block(GREY,
+                            GAME_BLOCK_SIZE * border_columns[k] +
+                            GAME_BLOCK_SIZE_HALF,
+                            GAME_BLOCK_SIZE * i + GAME_BLOCK_SIZE_HALF,
+                            GAME_BLOCK_SCALE);
     }
+  }
 
-  glPopMatrix();
+  // Draw the horizontal borders, between the vertical ones.
+  for (int i = 0; i < width_in_blocks; i++) {
+    if (i == border_columns[0] || i == border_columns[1] ||
+        i == border_columns[2]) {
+      continue;
+    }
+    block_batch.add_block(GREY, GAME_BLOCK_SIZE * i + GAME_BLOCK_SIZE_HALF,
+                          GAME_BLOCK_SIZE_HALF, GAME_BLOCK_SCALE);
+    if (i > 11) {
+      block_batch.add_block(GREY, GAME_BLOCK_SIZE * i + GAME_BLOCK_SIZE_HALF,
+                            GAME_BLOCK_SIZE * top_row + GAME_BLOCK_SIZE_HALF,
+                            GAME_BLOCK_SCALE);
+    }
+  }
 }
 
 /**
@@ -359,27 +563,16 @@ void display_game_border() {
  * pieces are going and how much free space there is.
  */
 void display_game_grid() {
-  glPushMatrix();
-    glColor3f(colours[WHITE].r, colours[WHITE].g, colours[WHITE].b);
-    for (int i = 0; i < 10; i++) {
-      for (int j = 0; j < 20; j++) {
-        glPushMatrix();
-          glTranslatef(GAME_BLOCK_SIZE * (float)(i + 2) -
-                       GAME_BLOCK_SIZE * 0.5f,
-                       GAME_BLOCK_SIZE * (float)(j + 2) -
-                       GAME_BLOCK_SIZE * 0.5f, 0.0f);
-          glScalef(GAME_BLOCK_SCALE, GAME_BLOCK_SCALE, 0.0f);
-          // The grid is displayed by drawing frames for each game square.
-          glBegin(GL_LINE_LOOP);
-            glVertex2f(-OUTER_BLOCK_SIZE_HALF, OUTER_BLOCK_SIZE_HALF);
-            glVertex2f(OUTER_BLOCK_SIZE_HALF, OUTER_BLOCK_SIZE_HALF);
-            glVertex2f(OUTER_BLOCK_SIZE_HALF, -OUTER_BLOCK_SIZE_HALF);
-            glVertex2f(-OUTER_BLOCK_SIZE_HALF, -OUTER_BLOCK_SIZE_HALF);
-          glEnd();
-        glPopMatrix();
-      }
+  // The grid is displayed by drawing frames for each game square.
+  for (int i = 0; i < 10; i++) {
+    for (int j = 0; j < 20; j++) {
+      block_batch.add_frame(WHITE,
+                            GAME_BLOCK_SIZE * (float)(i + 2) -
+                            GAME_BLOCK_SIZE_HALF,
+                            GAME_BLOCK_SIZE * (float)(j + 2) -
+                            GAME_BLOCK_SIZE_HALF, GAME_BLOCK_SCALE);
     }
-  glPopMatrix();
+  }
 }
 
 /**
@@ -389,32 +582,177 @@ void display_game_grid() {
 void display_game() {
   glMatrixMode(GL_MODELVIEW);
   // If the game isn't paused, display the grid if enabled.
-  if (grid_enabled && is_game_running()) {
+  profiler.begin_phase(PHASE_GRID);
+  if (grid_enabled && is_game_running() && grid_layer.begin()) {
     display_game_grid();
+    block_batch.draw();
+    grid_layer.end();
+  }
+  profiler.end_phase(PHASE_GRID);
+  // Display the border and sidebar labels, which are cached.
+  if (game_layer.begin()) {
+    display_game_border();
+    block_batch.draw();
+    display_game_sidebar(true);
+    game_layer.end();
   }
-  // Display the border and sidebar.
-  display_game_border();
-  display_game_sidebar();
+  profiler.begin_phase(PHASE_SIDEBAR);
+  display_game_sidebar(false);
+  profiler.end_phase(PHASE_SIDEBAR);
   // If the game isn't paused, display the game board.
   if (is_game_running()) {
+    profiler.begin_phase(PHASE_BOARD);
     display_game_board();
+    profiler.end_phase(PHASE_BOARD);
   }
   // If the game isn't paused, display the piece projection if enabled.
-  if (projection_enabled && !new_piece && is_game_running()) {
+  if (projection_enabled && !game.new_piece && is_game_running()) {
+    profiler.begin_phase(PHASE_PROJECTION);
     display_game_projection();
+    profiler.end_phase(PHASE_PROJECTION);
   }
+  // Draw all the blocks at once, under the countdown.
+  profiler.begin_phase(PHASE_BLOCKS);
+  block_batch.draw();
+  profiler.end_phase(PHASE_BLOCKS);
   // Display the countdown for starting/resuming a game, if necessary.
   if (countdown) {
     display_game_countdown();
   }
 }
 
+/**
+ * Returns where a board of the multi-board mode is drawn: its bottom left
+ * corner and its scale, which the game's coordinates are transformed by.
+ * @param index
+ * @return
+ */
+BlockTransform get_board_transform(int index) {
+  float cell_width = BOARD_CELL_WIDTH * GAME_BLOCK_SIZE * board_scale;
+  float cell_height = BOARD_CELL_HEIGHT * GAME_BLOCK_SIZE * board_scale;
+  int rows = (board_count + board_columns - 1) / board_columns;
+  BlockTransform transform;
+
+  // The boards are centred, filling rows from the top.
+  transform.translate(
+      (DISPLAY_WIDTH - cell_width * board_columns) * 0.5f +
+      cell_width * (index % board_columns) + GAME_BLOCK_SIZE_HALF * board_scale,
+      (DISPLAY_HEIGHT + cell_height * rows) * 0.5f -
+      cell_height * (index / board_columns + 1) +
+      GAME_BLOCK_SIZE_HALF * board_scale);
+  transform.scale(board_scale, board_scale);
+  return transform;
+}
+
+/**
+ * Adds a block of a board of the multi-board mode to the batch.
+ * @param colour
+ * @param board the transform of the board
+ * @param x the column of the block, counting the border as column 0
+ * @param y the row of the block, counting the border as row 0
+ * @param frame true to add only the block's frame
+ */
+void add_board_block(int colour, const BlockTransform &board, int x, int y,
+                     bool frame) {
+  BlockTransform transform = board;
+
+  transform.translate(GAME_BLOCK_SIZE * x + GAME_BLOCK_SIZE_HALF,
+                      GAME_BLOCK_SIZE * y + GAME_BLOCK_SIZE_HALF);
+  transform.scale(GAME_BLOCK_SCALE, GAME_BLOCK_SCALE);
+  if (frame) {
+    block_batch.add_frame(colour, transform);
+  } else {
+    block_batch.add_block(colour, transform);
+  }
+}
+
+/**
+ * Displays the boards of the multi-board mode side by side, with each
+ * board's score above it. The blocks of all the boards are transformed on
+ * the CPU and drawn in one batch, and their borders are kept in a static
+ * layer, so the draw calls do not grow with the number of boards; only the
+ * scores are drawn one by one.
+ */
+void display_boards() {
+  int piece_blocks[4][2];
+  int distance;
+
+  glMatrixMode(GL_MODELVIEW);
+  if (boards_layer.begin()) {
+    for (int b = 0; b < board_count; b++) {
+      BlockTransform transform = get_board_transform(b);
+      for (int j = 0; j < 21; j++) {
+        add_board_block(GREY, transform, 0, j, false);
+        add_board_block(GREY, transform, 11, j, false);
+      }
+      for (int i = 1; i < 11; i++) {
+        add_board_block(GREY, transform, i, 0, false);
+      }
+    }
+    block_batch.draw();
+    boards_layer.end();
+  }
+
+  for (int b = 0; b < board_count; b++) {
+    const GameState &state = boards[b].game;
+    BlockTransform transform = get_board_transform(b);
+
+    for (int j = 0; j < 20; j++) {
+      for (int i = 0; i < 10; i++) {
+        if (state.board_rows[j] & (1 << i)) {
+          add_board_block(state.board_colours[j][i], transform, i + 1, j + 1,
+                          false);
+        }
+      }
+    }
+    if (state.new_piece || state.game_over) {
+      continue;
+    }
+    // The falling piece, and its projection as frames.
+    state.get_piece_blocks(piece_blocks);
+    distance = state.drop_distance();
+    for (int i = 0; i < 4; i++) {
+      if (piece_blocks[i][1] - distance < 20) {
+        add_board_block(state.current_piece_type + CYAN, transform,
+                        piece_blocks[i][0] + 1,
+                        piece_blocks[i][1] - distance + 1, true);
+      }
+      if (piece_blocks[i][1] < 20) {
+        add_board_block(state.current_piece_type + CYAN, transform,
+                        piece_blocks[i][0] + 1, piece_blocks[i][1] + 1, false);
+      }
+    }
+  }
+  block_batch.draw();
+
+  // The player's score is green, and the bot's are black.
+  for (int b = 0; b < board_count; b++) {
+    board_game &board = boards[b];
+    BlockTransform transform = get_board_transform(b);
+
+    glPushMatrix();
+      glTranslatef(transform.origin[0] +
+                   GAME_BLOCK_SIZE * 6.0f * board_scale - DISPLAY_WIDTH_HALF,
+                   transform.origin[1] +
+                   GAME_BLOCK_SIZE * 21.25f * board_scale, 0.0f);
+      if (!board.bot) {
+        glColor3f(colours[GREEN].r, colours[GREEN].g, colours[GREEN].b);
+      }
+      draw_text(board.game.game_over && !board.bot ? "Press ENTER" :
+                get_number_text(board.score_text, board.game.score),
+                true, 0.3f * board_scale, 0.3f * board_scale);
+      glColor3f(colours[BLACK].r, colours[BLACK].g, colours[BLACK].b);
+    glPopMatrix();
+  }
+}
+
 /**
  * Displays the difficulty selection screen before the game starts.
  */
 void display_pregame() {
   // The current difficulty as a string.
-  string difficulty_string = int_to_string(difficulty);
+  const char *difficulty_string =
+      get_number_text(difficulty_text, game.difficulty);
   // How much offset is required to print the difficulty centered.
   float difficulty_offset = get_offset(difficulty_string);
 
@@ -435,23 +773,21 @@ void display_pregame() {
     glPopMatrix();
 
     // Print arrows to indicate how to adjust difficulty.
-    glPushMatrix();
-      glTranslatef(DISPLAY_WIDTH_HALF, -DISPLAY_HEIGHT * 0.05f, 0.0f);
-      glScalef(0.6f, 0.5f, 0.0f);
-
-      for (float sign = -1.0f; sign <= 1.0f; sign += 2.0f) {
-        glPushMatrix();
-          glTranslatef(OUTER_BLOCK_SIZE * 4.0f * -sign, 0.0f, 0.0f);
-          glRotatef(45.0f, 0.0f, 0.0f, 1.0f);
-          draw_block(get_random_piece_colour());
-          glTranslatef(OUTER_BLOCK_SIZE * sign, 0.0f, 0.0f);
-          draw_block(get_random_piece_colour());
-          glTranslatef(OUTER_BLOCK_SIZE * -sign, OUTER_BLOCK_SIZE * -sign,
-                       0.0f);
-          draw_block(get_random_piece_colour());
-        glPopMatrix();
-      }
-    glPopMatrix();
+    BlockTransform arrows;
+    arrows.translate(DISPLAY_WIDTH_HALF, DISPLAY_HEIGHT * 0.6f);
+    arrows.scale(0.6f, 0.5f);
+
+    for (float sign = -1.0f; sign <= 1.0f; sign += 2.0f) {
+      BlockTransform arrow = arrows;
+      arrow.translate(OUTER_BLOCK_SIZE * 4.0f * -sign, 0.0f);
+      arrow.rotate(45.0f);
+      block_batch.add_block(get_random_piece_colour(colour_generator), arrow);
+      arrow.translate(OUTER_BLOCK_SIZE * sign, 0.0f);
+      block_batch.add_block(get_random_piece_colour(colour_generator), arrow);
+      arrow.translate(OUTER_BLOCK_SIZE * -sign, OUTER_BLOCK_SIZE * -sign);
+      block_batch.add_block(get_random_piece_colour(colour_generator), arrow);
+    }
+    block_batch.draw();
 
     // Print help messages.
     glColor3f(colours[BLACK].r, colours[BLACK].g, colours[BLACK].b);
@@ -480,19 +816,17 @@ void display_menu_border() {
   // How much to translate between the top and bottom borders.
   float translate_y = DISPLAY_HEIGHT / scale - OUTER_BLOCK_SIZE;
 
-  glPushMatrix();
-    glScalef(scale, scale, 0.0f);
-    glTranslatef(OUTER_BLOCK_SIZE_HALF, OUTER_BLOCK_SIZE_HALF, 0.0f);
-    for (int i = 0; i < number_of_blocks; i++) {
-      // Bottom row.
-      draw_block(get_random_piece_colour());
-      // Top row.
-      glTranslatef(0.0f, translate_y, 0.0f);
-      draw_block(get_random_piece_colour());
-      // Go back up to the next position.
-      glTranslatef(OUTER_BLOCK_SIZE, -translate_y, 0.0f);
-    }
-  glPopMatrix();
+  for (int i = 0; i < number_of_blocks; i++) {
+    // Bottom row.
+    block_batch.add_block(get_random_piece_colour(colour_generator),
+                          border_block_size * (i + 0.5f),
+                          border_block_size * 0.5f, scale);
+    // Top row.
+    block_batch.add_block(get_random_piece_colour(colour_generator),
+                          border_block_size * (i + 0.5f),
+                          border_block_size * 0.5f + translate_y * scale,
+                          scale);
+  }
 }
 
 /**
@@ -548,13 +882,12 @@ void display_menu_title() {
       {OUTER_BLOCK_SIZE, 0.0f}
     };
 
-  glPushMatrix();
-    glScalef(scale, scale, 0.0f);
-    for (int i = 0; i < title_size; i++) {
-      glTranslatef(translations[i][0], translations[i][1], 0.0f);
-      draw_block(get_random_piece_colour());
-    }
-  glPopMatrix();
+  BlockTransform block;
+  block.scale(scale, scale);
+  for (int i = 0; i < title_size; i++) {
+    block.translate(translations[i][0], translations[i][1]);
+    block_batch.add_block(get_random_piece_colour(colour_generator), block);
+  }
 }
 
 /**
@@ -572,23 +905,18 @@ void display_menu_buttons() {
   float text_scale_y = 0.35f;
   // The text should be centered vertically on the button.
   float text_translate_y = DISPLAY_HEIGHT * 0.2f - 18.0f;
-  // Arrows should be centered vertically with the button, and on its sides.
-  float arrow_translate_x = DISPLAY_WIDTH_HALF -
-                            (button_scale_x * OUTER_BLOCK_SIZE / 2) * 1.1f;
-  float arrow_translate_y = DISPLAY_HEIGHT * 0.2f +
-                            (float)(2 - highlighted_button) *
-                            button_translate_y * button_scale_y;
 
   // Draw the buttons as rectangular blocks.
-  glPushMatrix();
-    glTranslatef(DISPLAY_WIDTH_HALF, DISPLAY_HEIGHT * 0.2f, 0.0f);
-    glScalef(button_scale_x, button_scale_y, 0.0f);
-    draw_block(colours[RED]);
-    glTranslatef(0.0f, button_translate_y, 0.0f);
-    draw_block(colours[GREEN]);
-    glTranslatef(0.0f, button_translate_y, 0.0f);
-    draw_block(colours[BLUE]);
-  glPopMatrix();
+  BlockTransform button;
+  button.translate(DISPLAY_WIDTH_HALF, DISPLAY_HEIGHT * 0.2f);
+  button.scale(button_scale_x, button_scale_y);
+  block_batch.add_block(RED, button);
+  button.translate(0.0f, button_translate_y);
+  block_batch.add_block(GREEN, button);
+  button.translate(0.0f, button_translate_y);
+  block_batch.add_block(BLUE, button);
+  // The text goes over the buttons, so they are drawn first.
+  block_batch.draw();
 
   /**
    * Write text on each button. This is done in separate matrices, as it is
@@ -606,363 +934,707 @@ void display_menu_buttons() {
     glTranslatef(0.0f, button_translate_y * button_scale_y, 0.0f);
     draw_text("Play", true, 0.8f, text_scale_y);
   glPopMatrix();
+}
+
+/**
+ * Displays the arrows on both sides of the highlighted menu button, in random
+ * colours.
+ */
+void display_menu_arrows() {
+  float button_scale_x = 25.0f;
+  float button_scale_y = 4.0f;
+  // Spacing between buttons.
+  float button_translate_y = (OUTER_BLOCK_SIZE * (button_scale_y + 1.0)) /
+                              button_scale_y;
+  // Arrows should be centered vertically with the button, and on its sides.
+  float arrow_translate_x = DISPLAY_WIDTH_HALF -
+                            (button_scale_x * OUTER_BLOCK_SIZE / 2) * 1.1f;
+  float arrow_translate_y = DISPLAY_HEIGHT * 0.2f +
+                            (float)(2 - highlighted_button) *
+                            button_translate_y * button_scale_y;
 
-  // Display the arrows for the highlighted button.
   for (float sign = -1.0f; sign <= 1.0f; sign += 2.0f) {
     float x_translate = sign < 0.0f ? arrow_translate_x :
                                       DISPLAY_WIDTH - arrow_translate_x;
-    glPushMatrix();
-      glTranslatef(x_translate, arrow_translate_y, 0.0f);
-      glRotatef(45.0f, 0.0f, 0.0f, -sign * 1.0f);
-      draw_block(get_random_piece_colour());
-      glTranslatef(sign * OUTER_BLOCK_SIZE, 0.0f, 0.0f);
-      draw_block(get_random_piece_colour());
-      glTranslatef(-sign * OUTER_BLOCK_SIZE, OUTER_BLOCK_SIZE, 0.0f);
-      draw_block(get_random_piece_colour());
-    glPopMatrix();
+    BlockTransform arrow;
+    arrow.translate(x_translate, arrow_translate_y);
+    arrow.rotate(-sign * 45.0f);
+    block_batch.add_block(get_random_piece_colour(colour_generator), arrow);
+    arrow.translate(sign * OUTER_BLOCK_SIZE, 0.0f);
+    block_batch.add_block(get_random_piece_colour(colour_generator), arrow);
+    arrow.translate(-sign * OUTER_BLOCK_SIZE, OUTER_BLOCK_SIZE);
+    block_batch.add_block(get_random_piece_colour(colour_generator), arrow);
   }
+  block_batch.draw();
 }
 
 /**
  * Displays the game menu, which allows the user to start a new game, look at
- * high scores, or close the game.
+ * high scores, or close the game. Everything but the arrows is cached, so the
+ * colours of the border and title are only picked again on resizing.
  */
 void display_menu() {
-  string help_message =
+  const char *help_message =
       "Press ENTER to select an option. Navigate using the arrow keys.";
 
-  display_menu_border();
-  display_menu_title();
-  display_menu_buttons();
+  if (menu_layer.begin()) {
+    display_menu_border();
+    display_menu_title();
+    display_menu_buttons();
 
-  // Print help message.
-  glPushMatrix();
-    glTranslatef(0.0f, OUTER_BLOCK_SIZE * 3.0f, 0.0f);
-    draw_text(help_message, true, 0.185f, 0.25f);
-  glPopMatrix();
+    // Print help message.
+    glPushMatrix();
+      glColor3f(colours[BLACK].r, colours[BLACK].g, colours[BLACK].b);
+      glTranslatef(0.0f, OUTER_BLOCK_SIZE * 3.0f, 0.0f);
+      draw_text(help_message, true, 0.185f, 0.25f);
+    glPopMatrix();
+    menu_layer.end();
+  }
+  display_menu_arrows();
 }
 
 /**
- * Spawns the piece shown in the lookahead in the sidebar.
+ * Adds the game which has just ended to the leaderboard, and finds where it
+ * ranks among the games started at the same difficulty. Games played back
+ * from a replay never end through check_game_over(), so are not added again.
  */
-void spawn_piece() {
-  // Set the coordinates for the piece blocks.
-  for (int i = 0; i < 4; i++) {
-    piece_blocks[i][0] = 4 + GAME_PIECES[next_piece_type * 4 + i][0];
-    piece_blocks[i][1] = 19 + GAME_PIECES[next_piece_type * 4 + i][1];
+void add_to_leaderboard() {
+  leaderboard_record record;
+  long rank;
+
+  rank_text[0] = '\0';
+  if (!leaderboard_open) {
+    return;
+  }
+  memset(&record, 0, sizeof(record));
+  record.score = game.score;
+  record.difficulty = starting_difficulty;
+  record.time = time(NULL);
+  record.pieces_spawned = game.pieces_spawned;
+  record.duration = game_ticks * TICK_LENGTH / 1000;
+  strncpy(record.name, player_name, LEADERBOARD_NAME_SIZE - 1);
+  if (!leaderboard.add(record)) {
+    cerr << "Cannot write the leaderboard file." << endl;
   }
 
-  // Try to spawn the piece.
-  for (int i = 0; i < 4; i++) {
-    // If the position is occupied, then the game is over.
-    if (game_board[piece_blocks[i][0]][piece_blocks[i][1]]) {
-      current_screen = GAME_OVER;
-      // Determine if the score is a high score.
-      if (high_scores.size() < 10) {
-        high_scores.push_back(score);
-        sort(high_scores.begin(), high_scores.end(), greater<int>());
-        has_high_score = true;
-      } else {
-        for (vector<int>::iterator it = high_scores.begin();
-             it < high_scores.end(); it++) {
-          if (score > *it) {
-            // Add the high score to the list and sort the list.
-            high_scores.push_back(score);
-            sort(high_scores.begin(), high_scores.end(), greater<int>());
-            // Remove the lowest high score if there are more than 10.
-            if (high_scores.size() > 10) {
-              high_scores.pop_back();
-            }
-            has_high_score = true;
-            break;
-          }
-        }
-      }
-      return;
-    }
-    game_board[piece_blocks[i][0]][piece_blocks[i][1]] = next_piece_type + CYAN;
+  rank = leaderboard.get_rank(game.score, starting_difficulty) + 1;
+  snprintf(rank_text, sizeof(rank_text), "Rank %ld of %ld, top %.0f%%", rank,
+           leaderboard.get_count(starting_difficulty),
+           max(1.0, 100.0 - leaderboard.get_percentile(game.score,
+                                                       starting_difficulty)));
+}
+
+/**
+ * Moves the game to the game over screen if the last piece could not be
+ * spawned, and determines if the score is a high score.
+ */
+void check_game_over() {
+  if (!game.game_over || current_screen != GAME) {
+    return;
   }
 
-  current_piece_type = next_piece_type;
-  pieces_spawned++;
-  // If 10 pieces have been spawned, increase difficulty.
-  if (pieces_spawned && pieces_spawned % 10 == 0 &&
-      difficulty < MAX_DIFFICULTY) {
-    difficulty++;
+  // Demo games go straight back to the menu, and do not set high scores.
+  if (demo_mode) {
+    demo_mode = false;
+    current_screen = MENU;
+    return;
   }
 
-  // Get the net piece type.
-  next_piece_type = rand() % 7;
+  end_recording();
+  current_screen = GAME_OVER;
+  // Add the score if it is a high score, which stores it straight away.
+  has_high_score = high_scores.add(game.score) >= 0;
+  add_to_leaderboard();
 }
 
 /**
- * Checks if lines have been filled, and clears them and shifts remaining
- * blocks.
+ * Sets up all the necessary variables for a new game, e.g. clearing the board
+ * and resetting the score.
  */
-void clear_lines() {
-  bool clear;
-  // Count how many times each row must be lowered.
-  int lower_row[20];
-  int lines_cleared = 0;
+void initialise_new_game() {
+  // Reset the difficulty, the score and the game board.
+  current_game_seed = game_seed++;
+  game.initialise(1, current_game_seed, generator_mode);
+  // Reset game flags.
+  grid_enabled = false;
+  projection_enabled = false;
+  paused = false;
+  has_high_score = false;
+  // Reset the timer.
+  slept = 0;
+  game_ticks = 0;
+  // Reset the countdown.
+  countdown = 3;
+  // Reset the pause timer.
+  paused_slept = game.get_gravity_interval();
+}
 
-  memset(lower_row, 0, sizeof(lower_row));
+/**
+ * Starts a game played by the bot, as a demo from the menu.
+ */
+void start_demo() {
+  initialise_new_game();
+  demo_mode = true;
+  demo.reset();
+  countdown = 0;
+  projection_enabled = true;
+  current_screen = GAME;
+}
 
-  // Check which lines need to be cleared.
-  for (int j = 0; j < 20; j++) {
-    clear = true;
-    for (int i = 0; i < 10; i++) {
-      if (!game_board[i][j]) {
-        clear = false;
-        break;
-      }
+/**
+ * Starts a new game on a board of the multi-board mode.
+ * @param board
+ */
+void start_board(board_game &board) {
+  board.game.initialise(1, game_seed++, generator_mode);
+  board.slept = 0;
+  board.player.reset();
+}
+
+/**
+ * Starts the multi-board mode, and lays the boards out in the rows and
+ * columns which let them be drawn the largest.
+ * @param count the number of boards, from 1 to MAX_BOARDS
+ * @param bots_only true if the bot plays every board, false if the player
+ *        plays the first one
+ */
+void start_multi_board(int count, bool bots_only) {
+  float scale;
+
+  board_count = count;
+  for (int i = 0; i < board_count; i++) {
+    boards[i].bot = bots_only || i > 0;
+    start_board(boards[i]);
+  }
+  board_scale = 0.0f;
+  for (int columns = 1; columns <= board_count; columns++) {
+    int rows = (board_count + columns - 1) / columns;
+    scale = min(DISPLAY_WIDTH / (columns * BOARD_CELL_WIDTH),
+                DISPLAY_HEIGHT / (rows * BOARD_CELL_HEIGHT)) / GAME_BLOCK_SIZE;
+    if (scale > board_scale) {
+      board_scale = scale;
+      board_columns = columns;
     }
-    if (clear) {
-      lines_cleared++;
-      for (int k = 0; k < 10; k++) {
-        game_board[k][j] = 0;
-      }
-      // The rows above the cleared line must be shifted one line down.
-      for (int k = j + 1; k < 20; k++) {
-        lower_row[k]++;
+  }
+  boards_layer.invalidate();
+  current_screen = MULTI_BOARD;
+}
+
+/**
+ * Applies an input of the player to their board in the multi-board mode.
+ * @param input one of the INPUT_ codes
+ */
+void apply_board_input(int input) {
+  board_game &board = boards[0];
+
+  if (board.bot || board.game.game_over) {
+    return;
+  }
+  board.game.apply_input(input);
+  // A dropped piece is followed by the next one straight away.
+  if (input == INPUT_DROP) {
+    board.slept = board.game.get_gravity_interval();
+  }
+}
+
+/**
+ * Advances every board of the multi-board mode by one tick. Each board
+ * lowers its piece on its own gravity timer, and the bot makes its inputs on
+ * the boards it plays. The bot starts a new game as soon as one of its games
+ * is over; the player starts theirs again with ENTER.
+ */
+void step_boards() {
+  for (int i = 0; i < board_count; i++) {
+    board_game &board = boards[i];
+
+    if (board.game.game_over) {
+      if (board.bot) {
+        start_board(board);
       }
+      continue;
+    }
+    if (board.bot) {
+      board.player.tick(board.game, *demo_bot);
+    }
+    board.slept += TICK_LENGTH;
+    if (board.slept >= board.game.get_gravity_interval()) {
+      board.game.move_piece(0);
+      board.slept = 0;
     }
   }
+}
 
-  // Shift the lines above the cleared lines.
-  for (int j = 0; j < 20; j++) {
-    for (int i = 0; i < 10; i++) {
-      if (lower_row[j]) {
-        game_board[i][j - lower_row[j]] = game_board[i][j];
-        game_board[i][j] = 0;
+/**
+ * Starts playing back the next game of the replay file.
+ * @return false if there are no more games
+ */
+bool play_next_replay_game() {
+  replay_game settings;
+
+  if (!replay_reader->read_game(settings) ||
+      !replay_reader->read_event(next_replay_event)) {
+    return false;
+  }
+  initialise_new_game();
+  start_replay_game(game, settings);
+  starting_difficulty = settings.difficulty;
+  replay_mode = true;
+  countdown = 0;
+  current_screen = GAME;
+  return true;
+}
+
+/**
+ * Applies the events of the replay which are due by the current tick. At the
+ * end of each game, the score is checked against the recorded one, and the
+ * next game is started.
+ */
+void step_replay() {
+  while (replay_mode && next_replay_event.tick <= game_ticks) {
+    if (!apply_replay_event(game, next_replay_event, *replay_search)) {
+      cerr << "The replay file is truncated or corrupt." << endl;
+      replay_mode = false;
+      current_screen = MENU;
+      break;
+    }
+    if (next_replay_event.code == REPLAY_END) {
+      if (!is_replay_verified(game, next_replay_event)) {
+        cerr << "Replayed score " << game.score << " does not match the "
+             << "recorded score " << next_replay_event.score << "." << endl;
       }
+      if (!play_next_replay_game()) {
+        // Show the final score of the last game.
+        replay_mode = false;
+        current_screen = GAME_OVER;
+      }
+    } else if (!replay_reader->read_event(next_replay_event)) {
+      cerr << "The replay file is truncated or corrupt." << endl;
+      replay_mode = false;
+      current_screen = MENU;
     }
   }
+}
 
-  // Increment the score.
-  score += lines_cleared * difficulty;
+/**
+ * Stops a demo game or a replay, if one is playing, and returns to the menu.
+ * @return true if one was stopped
+ */
+bool stop_playing() {
+  if (!demo_mode && !replay_mode) {
+    return false;
+  }
+  demo_mode = false;
+  replay_mode = false;
+  current_screen = MENU;
+  return true;
 }
 
 /**
- * Performs a clockwise rotation on the current piece.
+ * Marks the given lines of the game area to be redrawn.
+ * @param rows a mask with bit y set for each line y
  */
-void rotate_piece() {
-  // If the piece is a square, do not rotate it.
-  if (current_piece_type == 3) {
+void mark_board_rows(uint32_t rows) {
+  // Only the lines under the sidebar's top are drawn.
+  rows &= (1u << 20) - 1;
+  if (!rows) {
     return;
   }
 
-  bool can_rotate = true;
-  int centre_x = piece_blocks[0][0];
-  int centre_y = piece_blocks[0][1];
-  int new_piece_blocks[4][2];
-  int type = game_board[piece_blocks[0][0]][piece_blocks[0][1]];
-  int diff_x;
-  int diff_y;
+  int bottom = __builtin_ctz(rows);
+  int top = 31 - __builtin_clz(rows);
+  rectangle area = {GAME_BLOCK_SIZE, GAME_BLOCK_SIZE * (float)(bottom + 1),
+                    GAME_BLOCK_SIZE * 11.0f,
+                    GAME_BLOCK_SIZE * (float)(top + 2)};
+  dirty_region.add(area);
+}
 
-  /**
-   * Compute the x and y differences between the piece blocks and the
-   * piece centre, and then compute the rotated block positions.
-   */
-  for (int i = 0; i < 4; i++) {
-    diff_x = piece_blocks[i][0] - piece_blocks[0][0];
-    diff_y = piece_blocks[i][1] - piece_blocks[0][1];
-    new_piece_blocks[i][0] = centre_x - diff_y;
-    new_piece_blocks[i][1] = centre_y + diff_x;
+/**
+ * Marks the whole game area to be redrawn, e.g. when the grid is toggled.
+ */
+void mark_game_area() {
+  mark_board_rows(ALL_ROWS);
+}
+
+/**
+ * Marks the part of the sidebar around a line of text to be redrawn.
+ * @param line
+ * @param below how far below the baseline the part reaches
+ * @param above how far above the baseline the part reaches
+ */
+void mark_sidebar_line(int line, float below, float above) {
+  float y = get_sidebar_line_y(line);
+  rectangle area = {GAME_BLOCK_SIZE * 12.0f, y - below,
+                    GAME_BLOCK_SIZE * 17.0f, y + above};
+  dirty_region.add(area);
+}
+
+/**
+ * Returns the lines covered by the piece projection, if it is displayed.
+ * @return
+ */
+uint32_t get_projection_rows() {
+  if (!projection_enabled || game.new_piece || !is_game_running()) {
+    return 0;
   }
+  return game.get_piece_rows() >> game.drop_distance();
+}
 
-  // Check if the piece can be rotated.
-  for (int i = 0; i < 4; i++) {
-    if (new_piece_blocks[i][0] < 0 || new_piece_blocks[i][0] > 9 ||
-        new_piece_blocks[i][1] < 0 || new_piece_blocks[i][1] > 21) {
-      can_rotate = false;
-      break;
+/**
+ * Works out which parts of the display have changed since a redraw was last
+ * asked for, from the screen shown and the changes made to the game, and
+ * asks for a redraw if any have. Nothing is redrawn while nothing changes.
+ */
+void request_redraw() {
+  uint32_t projection = get_projection_rows();
+  int changes = game.changes;
+
+  if (current_screen != drawn_screen) {
+    dirty_region.add_all();
+    drawn_screen = current_screen;
+  } else if (current_screen == MULTI_BOARD) {
+    // Most boards change at every update, so they are all redrawn.
+    dirty_region.add_all();
+  } else if (current_screen == GAME && changes) {
+    mark_board_rows(game.changed_rows);
+    // The projection follows the piece and the surface under it.
+    if (changes & (CHANGE_PIECE | CHANGE_BOARD | CHANGE_LINES)) {
+      mark_board_rows(projection | projection_rows);
     }
-    if (game_board[new_piece_blocks[i][0]][new_piece_blocks[i][1]] &&
-        !is_block_in_piece(new_piece_blocks[i][0], new_piece_blocks[i][1])) {
-      can_rotate = false;
-      break;
+    if (changes & CHANGE_NEXT_PIECE) {
+      mark_sidebar_line(0, GAME_BLOCK_SIZE * 3.0f, 0.0f);
+    }
+    if (changes & CHANGE_SCORE) {
+      mark_sidebar_line(SCORE_LINE, GAME_BLOCK_SIZE * 0.5f, GAME_BLOCK_SIZE);
     }
+    if (changes & CHANGE_DIFFICULTY) {
+      mark_sidebar_line(DIFFICULTY_LINE, GAME_BLOCK_SIZE * 0.5f,
+                        GAME_BLOCK_SIZE);
+    }
+  }
+  game.changes = 0;
+  game.changed_rows = 0;
+  projection_rows = projection;
+
+  if (!dirty_region.is_empty()) {
+    // The overlay shows the timings of the latest frame, so it is redrawn too.
+    if (overlay_enabled) {
+      dirty_region.add(OVERLAY_AREA);
+    }
+    glutPostRedisplay();
   }
+}
 
-  if (!can_rotate) {
-    return;
+/**
+ * Displays the frame timings over the top left corner of the screen: the
+ * average time of each frame and each of its phases over the latest frames,
+ * and the average input latency.
+ */
+void display_profile_overlay() {
+  int count = profiler.get_latest_frames(overlay_frames, OVERLAY_FRAMES);
+  double phases[PHASE_COUNT] = {};
+  double frame = 0.0;
+  double frame_max = 0.0;
+  double latency = 0.0;
+  double latency_max = 0.0;
+  int inputs = 0;
+  char line[64];
+
+  for (int k = 0; k < count; k++) {
+    frame += overlay_frames[k].duration / 1e6;
+    frame_max = max(frame_max, overlay_frames[k].duration / 1e6);
+    for (int i = 0; i < PHASE_COUNT; i++) {
+      phases[i] += overlay_frames[k].phase_durations[i] / 1e6;
+    }
+    if (overlay_frames[k].input_latency) {
+      latency += overlay_frames[k].input_latency / 1e6;
+      latency_max = max(latency_max, overlay_frames[k].input_latency / 1e6);
+      inputs++;
+    }
   }
+  count = max(count, 1);
 
-  // Rotate the piece.
-  for (int i = 0; i < 4; i++) {
-    game_board[piece_blocks[i][0]][piece_blocks[i][1]] = 0;
-    piece_blocks[i][0] = new_piece_blocks[i][0];
-    piece_blocks[i][1] = new_piece_blocks[i][1];
+  display_subscreen(OVERLAY_AREA.left, OVERLAY_AREA.bottom,
+                    OVERLAY_AREA.right, OVERLAY_AREA.top);
+  glPushMatrix();
+    glTranslatef(OVERLAY_AREA.left + 10.0f, OVERLAY_AREA.top - 25.0f, 0.0f);
+    snprintf(line, sizeof(line), "frame %.3f ms (max %.3f)", frame / count,
+             frame_max);
+    draw_text(line, false, 0.12f, 0.12f);
+    for (int i = 0; i < PHASE_COUNT; i++) {
+      glTranslatef(0.0f, -20.0f, 0.0f);
+      snprintf(line, sizeof(line), "%s %.3f ms", get_phase_name(i),
+               phases[i] / count);
+      draw_text(line, false, 0.12f, 0.12f);
+    }
+    glTranslatef(0.0f, -20.0f, 0.0f);
+    snprintf(line, sizeof(line), "input %.3f ms (max %.3f)",
+             inputs ? latency / inputs : 0.0, latency_max);
+    draw_text(line, false, 0.12f, 0.12f);
+  glPopMatrix();
+}
+
+/**
+ * Writes the frame timings to the files given on the command line, once the
+ * game exits.
+ */
+void write_profiles() {
+  FILE *file;
+
+  if (profile_csv_path) {
+    file = fopen(profile_csv_path, "w");
+    if (!file || !profiler.write_csv(file)) {
+      cerr << "Cannot write " << profile_csv_path << "." << endl;
+    }
+    if (file) {
+      fclose(file);
+    }
   }
-  for (int i = 0; i < 4; i++) {
-    game_board[piece_blocks[i][0]][piece_blocks[i][1]] = type;
+  if (profile_trace_path) {
+    file = fopen(profile_trace_path, "w");
+    if (!file || !profiler.write_trace(file)) {
+      cerr << "Cannot write " << profile_trace_path << "." << endl;
+    }
+    if (file) {
+      fclose(file);
+    }
   }
 }
 
 /**
- * Moves the current piece in the given direction.
- * @param direction -1 = left, 0 = down, 1 = right
+ * Counts the heap allocations made by a frame, and reports them every
+ * ALLOCATION_REPORT_FRAMES frames. Once every screen has been drawn once, a
+ * frame should make none.
+ * @param allocations
  */
-void move_piece(int direction) {
-  // If a new piece should be spawned, clear lines and spawn it.
-  if (new_piece) {
-    clear_lines();
-    spawn_piece();
-    new_piece = false;
-    return;
+void count_frame_allocations(long allocations) {
+  frames_counted++;
+  frame_allocations += allocations;
+  if (frames_counted == ALLOCATION_REPORT_FRAMES) {
+    cerr << frame_allocations << " heap allocations in the last "
+         << frames_counted << " frames." << endl;
+    frames_counted = 0;
+    frame_allocations = 0;
   }
+}
 
-  bool move = true;
-  bool same = false;
-  int type = game_board[piece_blocks[0][0]][piece_blocks[0][1]];
-  int move_x = direction;
-  int move_y = direction == 0 ? -1 : 0;
+/**
+ * Draws the current screen. Only the rectangles which have changed are
+ * cleared and redrawn, one at a time, with the rest of the scene clipped.
+ */
+void draw_screen() {
+  int rectangles = dirty_region.begin_frame();
 
-  // Check if the piece can move in the given direction.
-  for (int i = 0; i < 4; i++) {
-    if (piece_blocks[i][0] + move_x < 0 || piece_blocks[i][0] + move_x > 9 ||
-        piece_blocks[i][1] + move_y < 0) {
-      move = false;
-      break;
+  glMatrixMode(GL_MODELVIEW);
+  for (int i = 0; i < rectangles; i++) {
+    // Clear the rectangle of the display buffer.
+    dirty_region.clip(i);
+
+    // Display the current screen.
+    switch (current_screen) {
+      case MENU:
+        display_menu();
+        break;
+      case PREGAME:
+        display_menu();
+        display_pregame();
+        break;
+      case GAME:
+        display_game();
+        break;
+      case GAME_OVER:
+        display_game();
+        display_game_over();
+        break;
+      case MULTI_BOARD:
+        display_boards();
+        break;
+      default:
+        display_menu();
+        display_high_scores();
     }
-    if (game_board[piece_blocks[i][0] + move_x][piece_blocks[i][1] + move_y] &&
-        !is_block_in_piece(piece_blocks[i][0] + move_x,
-        piece_blocks[i][1] + move_y)) {
-      move = false;
-      break;
+    if (overlay_enabled) {
+      display_profile_overlay();
     }
   }
+  dirty_region.end_frame();
+}
 
-  if (move) {
-    // Move the piece from its original location to the new one.
-    for (int i = 0; i < 4; i++) {
-      game_board[piece_blocks[i][0]][piece_blocks[i][1]] = 0;
-      piece_blocks[i][0] += move_x;
-      piece_blocks[i][1] += move_y;
-    }
-    for (int i = 0; i < 4; i++) {
-      game_board[piece_blocks[i][0]][piece_blocks[i][1]] = type;
-    }
-  } else if (direction == 0) {
-    /**
-     * If the piece couldn't move and it should've went down, then a new piece
-     * must be spawned, since it means it reached the bottom.s
-     */
-    new_piece = true;
+/**
+ * Display the current screen.
+ */
+void display() {
+  long allocations = heap_allocations;
+
+  profiler.begin_frame();
+  draw_screen();
+
+  // Swap the back buffer with the front buffer.
+  profiler.begin_phase(PHASE_SWAP);
+  glutSwapBuffers();
+  profiler.end_phase(PHASE_SWAP);
+  profiler.end_frame();
+
+  if (counting_allocations) {
+    count_frame_allocations(heap_allocations - allocations);
   }
 }
 
 /**
- * Moves a piece to downward until it reaches the bottom or another block.
+ * Advances the game by one tick, i.e. lowers the piece once its gravity
+ * interval has passed, steps the countdown, or makes the next move of a demo
+ * game or a replay.
  */
-void collapse_piece() {
-  while (!new_piece) {
-    move_piece(0);
+void step_tick() {
+  // In a demo game, the bot makes one input at a time instead of gravity.
+  if (demo_mode) {
+    if (demo.tick(game, *demo_bot)) {
+      check_game_over();
+    }
+    return;
+  }
+
+  if (current_screen == MULTI_BOARD) {
+    step_boards();
+    return;
+  }
+
+  // In a replay, the recorded events are applied instead of gravity.
+  if (replay_mode) {
+    game_ticks++;
+    step_replay();
+    return;
+  }
+
+  slept += TICK_LENGTH;
+  game_ticks++;
+  // If in a countdown, decrement it. Otherwise, lower the piece.
+  if (slept >= game.get_gravity_interval()) {
+    if (countdown) {
+      countdown--;
+      slept = countdown ? 0 : paused_slept;
+      // The countdown is shown over the game area.
+      mark_game_area();
+    } else {
+      game.move_piece(0);
+      record_event(REPLAY_GRAVITY);
+      check_game_over();
+      slept = 0;
+    }
   }
-  // Reset the timer.
-  slept = 20000 + 1000 * (MAX_DIFFICULTY - difficulty);
-  return;
 }
 
 /**
- * Read the pre-existing high scores from the high_scores.txt file, which
- * is located in the same directory. There should be no more than 10 high
- * scores in this file.
+ * Sends what has changed in the games to the spectators of the broadcast, if
+ * there is one: every board in the multi-board mode, otherwise the game. A
+ * broadcast which cannot be written, e.g. once its pipe is closed, stops.
  */
-void read_high_scores() {
-  // The input file.
-  ifstream input_file;
-  // The current score to be read.
-  int score;
-
-  input_file.open("high_scores.txt");
-  while (true) {
-    input_file >> score;
-    if (input_file.eof()) {
-      break;
-    }
-    high_scores.push_back(score);
+void broadcast_games() {
+  const GameState *games[MAX_BOARDS];
+
+  if (!broadcast.is_open()) {
+    return;
+  }
+  for (int i = 0; i < max(board_count, 1); i++) {
+    games[i] = board_count ? &boards[i].game : &game;
+  }
+  if (!broadcast.write_tick(broadcast_ticks, games)) {
+    cerr << "The broadcast could not be written, so it has stopped." << endl;
+    broadcast.close();
   }
-  input_file.close();
 }
 
 /**
- * Write the current high score list to the file, one on each line. There
- * should be no more than 10 high scores in the list.
+ * Brings the game up to the current time, by stepping it one tick at a time
+ * for every tick that has passed since the last update. Time only passes
+ * while a game is running or counting down, i.e. not while paused or outside
+ * the game and multi-board screens.
  */
-void write_high_scores() {
-  // The output file.
-  ofstream output_file;
+void advance_game() {
+  chrono::steady_clock::time_point now = chrono::steady_clock::now();
+  long ticks = chrono::duration_cast<chrono::microseconds>(
+      now - last_update).count() / TICK_LENGTH;
 
-  output_file.open("high_scores.txt");
-  for (vector<int>::iterator it = high_scores.begin(); it != high_scores.end();
-      it++) {
-    output_file << *it << "\n";
+  if (!is_clock_running()) {
+    last_update = now;
+    return;
+  }
+  // The time left over is kept for the next update.
+  last_update += chrono::microseconds(ticks * TICK_LENGTH);
+  if (ticks > MAX_CATCH_UP_TICKS) {
+    ticks = MAX_CATCH_UP_TICKS;
+    last_update = now;
+  }
+  for (; ticks > 0 && is_clock_running(); ticks--) {
+    step_tick();
+    broadcast_ticks++;
+    broadcast_games();
   }
-  output_file.close();
 }
 
 /**
- * Sets up all the necessary variables for a new game, e.g. clearing the board
- * and resetting the score.
+ * Returns how many ticks are left until the game next changes on its own,
+ * i.e. until the next gravity or countdown step, demo input or replay event.
+ * @return the number of ticks, or -1 if the game does not change on its own
  */
-void initialise_new_game() {
-  // Reset difficulty.
-  difficulty = 1;
-  // Reset score.
-  score = 0;
-  // Reset the game board.
-  memset(game_board, 0, sizeof(game_board));
-  // Reset game flags.
-  grid_enabled = false;
-  projection_enabled = false;
-  paused = false;
-  has_high_score = false;
-  // Reset the counter of spawned pieces.
-  pieces_spawned = 0;
-  // Reset the timer.
-  slept = 0;
-  // Reset the countdown.
-  countdown = 3;
-  // Request a new piece.
-  new_piece = true;
-  // Reset the pause timer.
-  paused_slept = 20000 + 1000 * (MAX_DIFFICULTY - difficulty);
-  // Get the new piece type.
-  next_piece_type = rand() % 7;
+long get_ticks_until_update() {
+  long time_left;
+
+  if (!is_clock_running()) {
+    return -1;
+  }
+  if (replay_mode) {
+    return max(1L, next_replay_event.tick - game_ticks);
+  }
+  if (current_screen == MULTI_BOARD) {
+    // The next board to change, or one which is over and is started again.
+    time_left = DEMO_INPUT_DELAY;
+    for (int i = 0; i < board_count; i++) {
+      const board_game &board = boards[i];
+      if (board.game.game_over) {
+        time_left = board.bot ? 0 : time_left;
+        continue;
+      }
+      time_left = min<long>(time_left, board.game.get_gravity_interval() -
+                                       board.slept);
+      if (board.bot) {
+        time_left = min<long>(time_left, board.player.get_time_left());
+      }
+    }
+  } else if (demo_mode) {
+    time_left = demo.get_time_left();
+  } else {
+    time_left = game.get_gravity_interval() - slept;
+  }
+  return max(1L, (time_left + TICK_LENGTH - 1) / TICK_LENGTH);
 }
 
+void update(int generation);
+
 /**
- * Display the current screen.
+ * Updates the game when it is next due to change. Since timers cannot be
+ * cancelled, each call supersedes the timers set before it.
  */
-void display() {
-  // Clear the display buffer.
-  glClear(GL_COLOR_BUFFER_BIT);
-  glMatrixMode(GL_MODELVIEW);
+void schedule_update() {
+  long ticks = get_ticks_until_update();
 
-  // Display the current screen.
-  switch (current_screen) {
-    case MENU:
-      display_menu();
-      break;
-    case PREGAME:
-      display_menu();
-      display_pregame();
-      break;
-    case GAME:
-      display_game();
-      break;
-    case GAME_OVER:
-      display_game();
-      display_game_over();
-      break;
-    default:
-      display_menu();
-      display_high_scores();
+  timer_generation++;
+  if (ticks >= 0) {
+    glutTimerFunc(ticks * TICK_LENGTH / 1000, update, timer_generation);
   }
+}
 
-  // Swap the back buffer with the front buffer.
-  glutSwapBuffers();
+/**
+ * The timer function: brings the game up to date, redraws what changed, and
+ * waits for the next update.
+ * @param generation the timer_generation the timer was set with
+ */
+void update(int generation) {
+  if (generation != timer_generation) {
+    return;
+  }
+  advance_game();
+  request_redraw();
+  schedule_update();
 }
 
 /**
@@ -972,6 +1644,16 @@ void display() {
  * @param
  */
 void keyboard(unsigned char key, int, int) {
+  profiler.record_input();
+  // The key is applied at the current game time.
+  advance_game();
+  // Any key ends a demo game or a replay.
+  if (stop_playing()) {
+    request_redraw();
+    schedule_update();
+    return;
+  }
+
   switch (key) {
     // ENTER.
     case 13:
@@ -988,35 +1670,56 @@ void keyboard(unsigned char key, int, int) {
             case HIGH_SCORES_BUTTON:
               // Open the high scores screen.
               current_screen = HIGH_SCORE;
+              high_score_difficulty = ANY_DIFFICULTY;
               display_high_scores();
               break;
             case EXIT_BUTTON:
-              // Update the high scores and close the game.
-              write_high_scores();
+              // Fold the logged high scores into the file and close the game.
+              high_scores.compact();
               exit(1);
           }
           break;
         case PREGAME:
           // Start the game after selecting the difficulty.
           current_screen = GAME;
+          starting_difficulty = game.difficulty;
+          if (record_file) {
+            replay_game settings = {current_game_seed, game.difficulty,
+                                    generator_mode};
+            recorder.begin_game(settings);
+            recording = true;
+          }
           break;
         case GAME_OVER:
           // Go back to the menu after ending the game.
           current_screen = MENU;
           break;
+        case MULTI_BOARD:
+          // Start the player's board again once their game is over.
+          if (!boards[0].bot && boards[0].game.game_over) {
+            start_board(boards[0]);
+          }
+          break;
       }
       break;
     // ESC.
     case 27:
       // This takes the user to the menu, except during the game over screen.
       if (current_screen != GAME_OVER) {
+        // An abandoned game is recorded up to this point.
+        end_recording();
         current_screen = MENU;
       }
       break;
     case ' ':
       // If in the game and not paused, collapse the current piece.
       if (is_game_running()) {
-        collapse_piece();
+        game.collapse_piece();
+        record_event(INPUT_DROP);
+        // Reset the timer.
+        slept = game.get_gravity_interval();
+      } else if (current_screen == MULTI_BOARD) {
+        apply_board_input(INPUT_DROP);
       }
       break;
     case 'G':
@@ -1024,6 +1727,7 @@ void keyboard(unsigned char key, int, int) {
       // If in the game and not paused, toggle the grid.
       if (is_game_running()) {
         grid_enabled = !grid_enabled;
+        mark_game_area();
       }
       break;
     case 'H':
@@ -1031,6 +1735,14 @@ void keyboard(unsigned char key, int, int) {
       // If in the game and not paused, toggle the piece projection.
       if (is_game_running()) {
         projection_enabled = !projection_enabled;
+        mark_game_area();
+      }
+      break;
+    case 'D':
+    case 'd':
+      // Let the bot play a demo game from the menu.
+      if (current_screen == MENU) {
+        start_demo();
       }
       break;
     case 'P':
@@ -1043,10 +1755,14 @@ void keyboard(unsigned char key, int, int) {
           countdown = 3;
         }
         slept = 0;
+        mark_game_area();
       }
       break;
   }
-  glutPostRedisplay();
+  // Inputs are broadcast straight away, rather than at the next tick.
+  broadcast_games();
+  request_redraw();
+  schedule_update();
 }
 
 /**
@@ -1056,72 +1772,110 @@ void keyboard(unsigned char key, int, int) {
  * @param
  */
 void specialKeyboard(int key, int, int) {
+  profiler.record_input();
+  // F1 toggles the frame timing overlay on any screen.
+  if (key == GLUT_KEY_F1) {
+    overlay_enabled = !overlay_enabled;
+    dirty_region.add_all();
+    request_redraw();
+    return;
+  }
+  // The key is applied at the current game time.
+  advance_game();
+  // Any key ends a demo game or a replay.
+  if (stop_playing()) {
+    request_redraw();
+    schedule_update();
+    return;
+  }
+
   switch (key) {
     case GLUT_KEY_DOWN:
       if (current_screen == MENU) {
         // Select another button.
         highlighted_button = min(2, highlighted_button + 1);
+        dirty_region.add_all();
       } else if (current_screen == GAME && !countdown && !paused) {
-        move_piece(0);
+        game.move_piece(0);
+        record_event(INPUT_DOWN);
+        check_game_over();
+      } else if (current_screen == MULTI_BOARD) {
+        apply_board_input(INPUT_DOWN);
       }
       break;
     case GLUT_KEY_UP:
       if (current_screen == MENU) {
         // Select another button.
         highlighted_button = max(0, highlighted_button - 1);
-      } else if (current_screen == GAME && !new_piece && !countdown &&
+        dirty_region.add_all();
+      } else if (current_screen == GAME && !game.new_piece && !countdown &&
                  !paused) {
-        rotate_piece();
+        game.rotate_piece();
+        record_event(INPUT_ROTATE);
+      } else if (current_screen == MULTI_BOARD) {
+        apply_board_input(INPUT_ROTATE);
       }
       break;
     case GLUT_KEY_LEFT:
       if (current_screen == PREGAME) {
         // Adjust difficulty.
-        difficulty = max(1, difficulty - 1);
-      } else if (current_screen == GAME && !new_piece && !countdown &&
+        game.difficulty = max(1, game.difficulty - 1);
+        dirty_region.add_all();
+      } else if (current_screen == HIGH_SCORE) {
+        // Show the games of an easier difficulty, then every game.
+        high_score_difficulty = high_score_difficulty > 1 ?
+            high_score_difficulty - 1 : ANY_DIFFICULTY;
+        dirty_region.add_all();
+      } else if (current_screen == GAME && !game.new_piece && !countdown &&
                  !paused) {
-        move_piece(-1);
+        game.move_piece(-1);
+        record_event(INPUT_LEFT);
+      } else if (current_screen == MULTI_BOARD) {
+        apply_board_input(INPUT_LEFT);
       }
       break;
     case GLUT_KEY_RIGHT:
       if (current_screen == PREGAME) {
         // Adjust difficulty.
-        difficulty = min(10, difficulty + 1);
-      } else if (current_screen == GAME && !new_piece && !countdown &&
+        game.difficulty = min(10, game.difficulty + 1);
+        dirty_region.add_all();
+      } else if (current_screen == HIGH_SCORE) {
+        // Show the games of a harder difficulty.
+        high_score_difficulty = high_score_difficulty == ANY_DIFFICULTY ? 1 :
+            min(MAX_STARTING_DIFFICULTY, high_score_difficulty + 1);
+        dirty_region.add_all();
+      } else if (current_screen == GAME && !game.new_piece && !countdown &&
                  !paused) {
-        move_piece(1);
+        game.move_piece(1);
+        record_event(INPUT_RIGHT);
+      } else if (current_screen == MULTI_BOARD) {
+        apply_board_input(INPUT_RIGHT);
       }
       break;
   }
 
-  glutPostRedisplay();
+  broadcast_games();
+  request_redraw();
+  schedule_update();
 }
 
 /**
- * Keeps track of time, in order to determine when a piece should be lowered
- * automatically.
+ * Handle the window being resized. The display is stretched over the whole
+ * window, and the static layers are drawn again at the new size, since the
+ * width of their frames depends on it.
+ * @param width
+ * @param height
  */
-void idle() {
-  // Only track time while in game.
-  if (current_screen == GAME) {
-    // Count elapsed time.
-    usleep(1000);
-    if (!paused) {
-      slept += 1000;
-    }
-    // If in a countdown, decrement it. Otherwise, lower the piece.
-    if (slept >= 20000 + 1000 * (MAX_DIFFICULTY - difficulty)) {
-      if (countdown) {
-        countdown--;
-        slept = countdown ? 0 : paused_slept;
-      } else {
-        move_piece(0);
-        slept = 0;
-      }
-    }
-
-    glutPostRedisplay();
-  }
+void reshape(int width, int height) {
+  glViewport(0, 0, width, height);
+  block_batch.set_pixel_scale(width / (float)DISPLAY_WIDTH,
+                              height / (float)DISPLAY_HEIGHT);
+  dirty_region.set_viewport(width, height);
+  dirty_region.add_all();
+  menu_layer.invalidate();
+  game_layer.invalidate();
+  grid_layer.invalidate();
+  boards_layer.invalidate();
 }
 
 /**
@@ -1133,13 +1887,216 @@ void initialise_projection() {
 	gluOrtho2D(0, DISPLAY_WIDTH - 1, 0, DISPLAY_HEIGHT - 1);
 	glClearColor(colours[BACKGROUND].r, colours[BACKGROUND].g,
       colours[BACKGROUND].b, 0.0f);
+  // Frames are drawn as quads, so only the text uses the line width.
+  glLineWidth(LINE_WIDTH);
+  block_batch.initialise();
+}
+
+/**
+ * Stacks a game's board about half way up by random placements, leaving a
+ * falling piece, as a representative scene for the rendering benchmark.
+ * @param state
+ * @param search
+ * @param random
+ */
+void stack_benchmark_game(GameState &state, PlacementSearch &search,
+                          PieceGenerator &random) {
+  int found;
+
+  state.move_piece(0);
+  while (*max_element(state.column_heights,
+                      state.column_heights + GAME_BOARD_WIDTH) < 10) {
+    found = search.find_placements(state);
+    if (!found) {
+      break;
+    }
+    const Placement &placement = search.placements[random.next_below(found)];
+    state.place_piece(placement.rotation, placement.x, placement.y);
+    state.move_piece(0);
+  }
+}
+
+/**
+ * Sets up the game, with the grid and the projection, and every board of the
+ * multi-board mode, for the rendering benchmark.
+ */
+void initialise_benchmark_games() {
+  PlacementSearch *search = new PlacementSearch();
+  PieceGenerator random;
+
+  random.seed(game_seed, UNIFORM_PIECES);
+  initialise_new_game();
+  stack_benchmark_game(game, *search, random);
+  grid_enabled = true;
+  projection_enabled = true;
+  countdown = 0;
+
+  start_multi_board(MAX_BOARDS, true);
+  for (int i = 0; i < board_count; i++) {
+    stack_benchmark_game(boards[i].game, *search, random);
+  }
+  delete search;
+}
+
+/**
+ * Renders frames of the menu, the game, the game over screen and the most
+ * boards of the multi-board mode into an
+ * offscreen framebuffer, with no window, and reports the frames per second
+ * and the draw calls per frame of each. Every frame is redrawn in full. The
+ * stroke font needs GLUT, which needs a display, so text is only drawn, and
+ * counted, when there is one.
+ * @param frames the number of frames to render of each screen
+ * @param argc
+ * @param argv
+ * @return the exit code
+ */
+int run_render_benchmark(int frames, int argc, char *argv[]) {
+#ifdef HAVE_EGL
+  int screens[] = {MENU, GAME, GAME_OVER, MULTI_BOARD};
+  const char *names[] = {"menu", "game", "game over", "boards"};
+  bool has_font = getenv("DISPLAY");
+
+  if (frames <= 0 || !create_headless_context(WINDOW_WIDTH, WINDOW_HEIGHT)) {
+    cerr << "Cannot create an offscreen GL context." << endl;
+    return 1;
+  }
+  if (has_font) {
+    glutInit(&argc, argv);
+  }
+  initialise_projection();
+  if (has_font) {
+    stroke_font.initialise();
+  }
+  colour_generator.seed(game_seed, UNIFORM_PIECES);
+  initialise_benchmark_games();
+
+  printf("renderer: %s\n", (const char *)glGetString(GL_RENDERER));
+  printf("text: %s\n", has_font ? "stroke font" : "not drawn, no display");
+  printf("%-10s %10s %9s %8s %10s %7s %5s %6s\n", "screen", "frames/sec",
+         "ms/frame", "batches", "vertices", "layers", "text", "shapes");
+  for (int k = 0; k < 4; k++) {
+    current_screen = screens[k];
+    has_high_score = current_screen == GAME_OVER;
+    // The first frame records the static layers, so it is not timed.
+    dirty_region.add_all();
+    draw_screen();
+    finish_headless_frame();
+
+    draw_calls = draw_call_counts();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++) {
+      dirty_region.add_all();
+      draw_screen();
+      finish_headless_frame();
+    }
+    chrono::duration<double, milli> elapsed =
+        chrono::steady_clock::now() - start;
+    printf("%-10s %10.1f %9.3f %8.1f %10.1f %7.1f %5.1f %6.1f\n", names[k],
+           frames / elapsed.count() * 1e3, elapsed.count() / frames,
+           draw_calls.batches / (double)frames,
+           draw_calls.batch_vertices / (double)frames,
+           draw_calls.layers / (double)frames,
+           draw_calls.text / (double)frames,
+           draw_calls.shapes / (double)frames);
+  }
+  return 0;
+#else
+  cerr << "Rendering benchmarks need EGL, which this build does not use."
+       << endl;
+  return 1;
+#endif
 }
 
 int main(int argc, char* argv[]) {
+  /**
+   * "--benchmark-render N" renders N frames of each screen without a window,
+   * so it is handled before GLUT looks for a display, and before the high
+   * scores and the leaderboard are opened, which it leaves alone.
+   */
+  for (int i = 1; i + 1 < argc; i++) {
+    if (!strcmp(argv[i], "--benchmark-render")) {
+      return run_render_benchmark(atoi(argv[i + 1]), argc, argv);
+    }
+  }
   // Read the current high scores from the high_scores.txt file.
-  read_high_scores();
+  high_scores.load();
+  leaderboard_open = leaderboard.open("leaderboard.dat");
+  player_name = getenv("USER") ? getenv("USER") : "Player";
   // Initialise the GLUT window handler function and GL.
   glutInit(&argc, argv);
+  /**
+   * Games are seeded from the clock, unless a seed is given; "--bag" deals
+   * the pieces in shuffled bags of seven instead of independently.
+   */
+  game_seed = time(NULL);
+  // "--boards N" plays N games side by side; "--watch" lets the bot play all.
+  int multi_boards = 0;
+  bool watch_boards = false;
+  // "--broadcast TARGET" streams the games to spectators.
+  const char *broadcast_target = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+      game_seed = strtoull(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "--bag")) {
+      generator_mode = BAG_PIECES;
+    } else if (!strcmp(argv[i], "--profile-csv") && i + 1 < argc) {
+      // Export the frame timings on exit.
+      profile_csv_path = argv[++i];
+    } else if (!strcmp(argv[i], "--profile-trace") && i + 1 < argc) {
+      profile_trace_path = argv[++i];
+    } else if (!strcmp(argv[i], "--count-allocations")) {
+      // Report how many heap allocations the frames make.
+      counting_allocations = true;
+    } else if (!strcmp(argv[i], "--boards") && i + 1 < argc) {
+      multi_boards = atoi(argv[++i]);
+      if (multi_boards < 2 || multi_boards > MAX_BOARDS) {
+        cerr << "The number of boards must be from 2 to " << MAX_BOARDS
+             << "." << endl;
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--watch")) {
+      watch_boards = true;
+    } else if (!strcmp(argv[i], "--broadcast") && i + 1 < argc) {
+      broadcast_target = argv[++i];
+    } else if (!strcmp(argv[i], "--name") && i + 1 < argc) {
+      // Add the games played to the leaderboard under this name.
+      player_name = argv[++i];
+    } else if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+      // Record every game played to a replay file.
+      record_file = fopen(argv[++i], "wb");
+      if (!record_file || !write_replay_header(record_file)) {
+        cerr << "Cannot write " << argv[i] << "." << endl;
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--replay") && i + 1 < argc) {
+      // Play back the games of a replay file.
+      replay_file = fopen(argv[++i], "rb");
+      replay_reader = new ReplayReader(replay_file);
+      replay_search = new PlacementSearch();
+      if (!replay_file || !replay_reader->read_header()) {
+        cerr << "Cannot read the replay file " << argv[i] << "." << endl;
+        return 1;
+      }
+    }
+  }
+  colour_generator.seed(game_seed, UNIFORM_PIECES);
+  if (profile_csv_path || profile_trace_path) {
+    atexit(write_profiles);
+  }
+  // The bot searches on every core when playing demo games.
+  demo_bot = new Bot(new ThreadPool());
+  if (replay_reader && !play_next_replay_game()) {
+    cerr << "The replay file has no games." << endl;
+    return 1;
+  }
+  if (multi_boards) {
+    start_multi_board(multi_boards, watch_boards);
+  }
+  if (broadcast_target &&
+      !broadcast.open(broadcast_target, max(board_count, 1))) {
+    cerr << "Cannot broadcast to " << broadcast_target << "." << endl;
+    return 1;
+  }
   // Use double buffering with RGBA.
   glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA);
   // Main game size should be 500x1000, with 360 extra width for side bar.
@@ -1152,10 +2109,14 @@ int main(int argc, char* argv[]) {
   glutKeyboardFunc(keyboard);
   // Set specialKeyboard() as the keyboard function for special characters.
   glutSpecialFunc(specialKeyboard);
-  // Set idle() as the idle function.
-  glutIdleFunc(idle);
-  // Initialise the world projection.
+  // Set reshape() as the function called when the window is resized.
+  glutReshapeFunc(reshape);
+  // Start the game clock, and update() whenever the game is due to change.
+  last_update = chrono::steady_clock::now();
+  schedule_update();
+  // Initialise the world projection, and the font, which needs GLUT.
   initialise_projection();
+  stroke_font.initialise();
   // Go into the main loop.
   glutMainLoop();
 
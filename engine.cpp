@@ -0,0 +1,310 @@
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+using namespace std;
+
+#include "engine.h"
+
+static_assert(is_trivially_copyable<GameState>::value,
+              "Games are snapshot and restored by copying them.");
+
+void GameState::initialise(int starting_difficulty, uint64_t seed,
+                           int generator_mode) {
+  // Reset difficulty.
+  difficulty = starting_difficulty;
+  // Reset score.
+  score = 0;
+  // Reset the game board.
+  memset(board_rows, 0, sizeof(board_rows));
+  memset(board_colours, 0, sizeof(board_colours));
+  memset(column_heights, 0, sizeof(column_heights));
+  // Reset the counters of spawned pieces and cleared lines.
+  pieces_spawned = 0;
+  total_lines = 0;
+  // Request a new piece.
+  new_piece = true;
+  game_over = false;
+  // Get the new piece type.
+  piece_generator.seed(seed, generator_mode);
+  next_piece_type = piece_generator.next_piece();
+  // Everything has changed.
+  changes = CHANGE_ALL;
+  changed_rows = ALL_ROWS;
+}
+
+bool GameState::piece_fits(int type, int rotation, int x, int y) const {
+  return piece_fits_board(board_rows, type, rotation, x, y);
+}
+
+void GameState::set_piece(int rotation, int x, int y) {
+  // A piece which is yet to be spawned was never on the board.
+  if (!new_piece) {
+    changed_rows |= get_piece_rows();
+  }
+  piece_rotation = rotation;
+  piece_x = x;
+  piece_y = y;
+  changes |= CHANGE_PIECE;
+  changed_rows |= get_piece_rows();
+}
+
+void GameState::get_piece_blocks(int blocks[4][2]) const {
+  const piece_orientation &orientation =
+      get_piece_orientation(current_piece_type, piece_rotation);
+
+  for (int i = 0; i < 4; i++) {
+    blocks[i][0] = piece_x + orientation.blocks[i][0];
+    blocks[i][1] = piece_y + orientation.blocks[i][1];
+  }
+}
+
+uint32_t GameState::get_piece_rows() const {
+  const piece_orientation &orientation =
+      get_piece_orientation(current_piece_type, piece_rotation);
+
+  return ((1u << orientation.rows) - 1) << (piece_y + orientation.min_y);
+}
+
+int GameState::drop_distance() const {
+  const piece_orientation &orientation =
+      get_piece_orientation(current_piece_type, piece_rotation);
+  int left = piece_x + orientation.min_x;
+  int distance = GAME_BOARD_HEIGHT;
+
+  for (int i = 0; i < orientation.columns; i++) {
+    int bottom = piece_y + orientation.column_bottoms[i];
+    int height = column_heights[left + i];
+    // The piece has been tucked under an overhang, so search the board.
+    if (bottom < height) {
+      distance = 0;
+      while (piece_fits(current_piece_type, piece_rotation, piece_x,
+                        piece_y - distance - 1)) {
+        distance++;
+      }
+      return distance;
+    }
+    if (bottom - height < distance) {
+      distance = bottom - height;
+    }
+  }
+  return distance;
+}
+
+void GameState::update_column_heights() {
+  // The columns which have an occupied cell above the current line.
+  uint16_t covered = 0;
+  uint16_t surface;
+
+  memset(column_heights, 0, sizeof(column_heights));
+  for (int j = GAME_BOARD_HEIGHT - 1; j >= 0 && covered != FULL_ROW; j--) {
+    // The highest occupied cells of the columns not yet covered.
+    surface = board_rows[j] & ~covered;
+    for (; surface; surface &= surface - 1) {
+      column_heights[__builtin_ctz(surface)] = j + 1;
+    }
+    covered |= board_rows[j];
+  }
+}
+
+void GameState::lock_piece() {
+  const piece_orientation &orientation =
+      get_piece_orientation(current_piece_type, piece_rotation);
+  int left = piece_x + orientation.min_x;
+  int bottom = piece_y + orientation.min_y;
+
+  for (int i = 0; i < orientation.rows; i++) {
+    board_rows[bottom + i] |= orientation.row_masks[i] << left;
+  }
+  for (int i = 0; i < 4; i++) {
+    int x = piece_x + orientation.blocks[i][0];
+    int y = piece_y + orientation.blocks[i][1];
+    board_colours[y][x] = current_piece_type + CYAN;
+    if (y + 1 > column_heights[x]) {
+      column_heights[x] = y + 1;
+    }
+  }
+  changes |= CHANGE_BOARD;
+  changed_rows |= get_piece_rows();
+}
+
+void GameState::spawn_piece() {
+  // If the position is occupied, then the game is over.
+  if (!piece_fits(next_piece_type, 0, 4, 19)) {
+    game_over = true;
+    return;
+  }
+
+  current_piece_type = next_piece_type;
+  set_piece(0, 4, 19);
+  pieces_spawned++;
+  // If 10 pieces have been spawned, increase difficulty.
+  if (pieces_spawned && pieces_spawned % 10 == 0 &&
+      difficulty < MAX_DIFFICULTY) {
+    difficulty++;
+    changes |= CHANGE_DIFFICULTY;
+  }
+
+  // Get the next piece type.
+  next_piece_type = piece_generator.next_piece();
+  changes |= CHANGE_NEXT_PIECE;
+}
+
+int GameState::clear_lines() {
+  int lines_cleared = 0;
+
+  /**
+   * Go from the top down, so that the rows shifted into a cleared line have
+   * already been checked.
+   */
+  for (int j = GAME_BOARD_HEIGHT - 1; j >= 0; j--) {
+    if (board_rows[j] != FULL_ROW) {
+      continue;
+    }
+    lines_cleared++;
+    // Shift the rows above the cleared line one line down.
+    memmove(&board_rows[j], &board_rows[j + 1],
+            (GAME_BOARD_HEIGHT - 1 - j) * sizeof(board_rows[0]));
+    memmove(board_colours[j], board_colours[j + 1],
+            (GAME_BOARD_HEIGHT - 1 - j) * sizeof(board_colours[0]));
+    board_rows[GAME_BOARD_HEIGHT - 1] = 0;
+    // Every line from the cleared one up has shifted.
+    changed_rows |= ALL_ROWS & ~((1u << j) - 1);
+  }
+  if (lines_cleared) {
+    update_column_heights();
+    changes |= CHANGE_LINES | CHANGE_SCORE;
+  }
+
+  // Increment the score.
+  score += lines_cleared * difficulty;
+  total_lines += lines_cleared;
+  return lines_cleared;
+}
+
+void GameState::add_garbage(int lines, int hole) {
+  uint16_t garbage_row = FULL_ROW & ~(1 << hole);
+
+  lines = min(lines, GAME_BOARD_HEIGHT);
+  if (lines <= 0) {
+    return;
+  }
+  // Blocks in the top lines are pushed off the board.
+  for (int j = GAME_BOARD_HEIGHT - lines; j < GAME_BOARD_HEIGHT; j++) {
+    if (board_rows[j]) {
+      game_over = true;
+    }
+  }
+  memmove(&board_rows[lines], &board_rows[0],
+          (GAME_BOARD_HEIGHT - lines) * sizeof(board_rows[0]));
+  memmove(board_colours[lines], board_colours[0],
+          (GAME_BOARD_HEIGHT - lines) * sizeof(board_colours[0]));
+  for (int j = 0; j < lines; j++) {
+    board_rows[j] = garbage_row;
+    for (int x = 0; x < GAME_BOARD_WIDTH; x++) {
+      board_colours[j][x] = x == hole ? BACKGROUND : GREY;
+    }
+  }
+  update_column_heights();
+  changes |= CHANGE_BOARD;
+  changed_rows |= ALL_ROWS;
+
+  if (!new_piece && !piece_fits(current_piece_type, piece_rotation, piece_x,
+                                piece_y)) {
+    if (piece_fits(current_piece_type, piece_rotation, piece_x,
+                   piece_y + lines)) {
+      set_piece(piece_rotation, piece_x, piece_y + lines);
+    } else {
+      game_over = true;
+    }
+  }
+}
+
+int GameState::get_gravity_interval() const {
+  return 20000 + 1000 * (MAX_DIFFICULTY - difficulty);
+}
+
+void GameState::rotate_piece() {
+  // If the piece is a square, do not rotate it.
+  if (current_piece_type == O_PIECE) {
+    return;
+  }
+
+  int rotation = (piece_rotation + 1) & 3;
+
+  // Rotate the piece if it fits in its new position.
+  if (piece_fits(current_piece_type, rotation, piece_x, piece_y)) {
+    set_piece(rotation, piece_x, piece_y);
+  }
+}
+
+void GameState::move_piece(int direction) {
+  // If a new piece should be spawned, clear lines and spawn it.
+  if (new_piece) {
+    clear_lines();
+    spawn_piece();
+    new_piece = false;
+    return;
+  }
+
+  int move_x = direction;
+  int move_y = direction == 0 ? -1 : 0;
+
+  if (piece_fits(current_piece_type, piece_rotation, piece_x + move_x,
+                 piece_y + move_y)) {
+    // Move the piece from its original location to the new one.
+    set_piece(piece_rotation, piece_x + move_x, piece_y + move_y);
+  } else if (direction == 0) {
+    /**
+     * If the piece couldn't move and it should've went down, then it reached
+     * the bottom, so it becomes part of the board and a new piece must be
+     * spawned.
+     */
+    lock_piece();
+    new_piece = true;
+  }
+}
+
+void GameState::collapse_piece() {
+  if (new_piece) {
+    return;
+  }
+  set_piece(piece_rotation, piece_x, piece_y - drop_distance());
+  lock_piece();
+  new_piece = true;
+}
+
+void GameState::apply_input(int input) {
+  switch (input) {
+    case INPUT_LEFT:
+      if (!new_piece) {
+        move_piece(-1);
+      }
+      break;
+    case INPUT_RIGHT:
+      if (!new_piece) {
+        move_piece(1);
+      }
+      break;
+    case INPUT_DOWN:
+      move_piece(0);
+      break;
+    case INPUT_ROTATE:
+      if (!new_piece) {
+        rotate_piece();
+      }
+      break;
+    case INPUT_DROP:
+      collapse_piece();
+      break;
+  }
+}
+
+void GameState::place_piece(int rotation, int x, int y) {
+  if (new_piece) {
+    return;
+  }
+  set_piece(rotation, x, y);
+  lock_piece();
+  new_piece = true;
+}
@@ -0,0 +1,197 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <cstdint>
+
+#include "structs.h"
+#include "constants.h"
+#include "piece_generator.h"
+#include "pieces.h"
+
+// Inputs that control the falling piece, as used by agents and replays.
+const int INPUT_LEFT = 0;
+const int INPUT_RIGHT = 1;
+const int INPUT_DOWN = 2;
+const int INPUT_ROTATE = 3;
+const int INPUT_DROP = 4;
+
+/**
+ * The kinds of change made to a game, which are collected in
+ * GameState::changes until the frontend takes them, e.g. to know what to
+ * redraw.
+ */
+const int CHANGE_PIECE = 1; // The falling piece moved, rotated or spawned.
+const int CHANGE_BOARD = 2; // The falling piece landed on the board.
+const int CHANGE_LINES = 4; // Lines were cleared.
+const int CHANGE_SCORE = 8;
+const int CHANGE_DIFFICULTY = 16;
+const int CHANGE_NEXT_PIECE = 32;
+const int CHANGE_ALL = 63;
+// Every line of the board, as a changed_rows mask.
+const uint32_t ALL_ROWS = (1u << GAME_BOARD_HEIGHT) - 1;
+
+/**
+ * The state of a single game, i.e. the board, the falling piece, the score and
+ * the difficulty. It has no GL or GLUT dependency, so any number of games can
+ * be created and stepped in the same process. It holds no pointers, so a game
+ * is snapshot and restored by copying it, e.g. to roll it back.
+ */
+struct GameState {
+  // The game board, stored as one bitmask per row (bit x is column x).
+  uint16_t board_rows[GAME_BOARD_HEIGHT];
+  // The colour of each occupied board cell, only used for rendering.
+  uint8_t board_colours[GAME_BOARD_HEIGHT][GAME_BOARD_WIDTH];
+  /**
+   * The height of each column's surface, i.e. one more than the line of its
+   * highest occupied cell, or 0 if it is empty. Updated whenever a piece
+   * lands or lines are cleared.
+   */
+  uint8_t column_heights[GAME_BOARD_WIDTH];
+  /**
+   * The falling piece, which is kept out of the board until it lands. Its
+   * position is that of its centre block.
+   */
+  int piece_x;
+  int piece_y;
+  int piece_rotation;
+  int current_piece_type;
+  int next_piece_type;
+  int difficulty;
+  int score;
+  int pieces_spawned; // How many pieces have been spawned.
+  int total_lines; // How many lines have been cleared.
+  bool new_piece; // True if a new piece is requested.
+  bool game_over; // True if the last piece could not be spawned.
+  // Picks the piece types, so that each game has its own sequence.
+  PieceGenerator piece_generator;
+  /**
+   * The CHANGE_ flags of the changes made since they were last cleared, and
+   * the lines whose cells or falling piece blocks changed (bit y is line y).
+   * They are only ever set by the game, so whoever uses them clears them.
+   */
+  int changes;
+  uint32_t changed_rows;
+
+  /**
+   * Sets up a new game, i.e. clears the board and resets the score.
+   * @param starting_difficulty
+   * @param seed the seed for the piece sequence
+   * @param generator_mode UNIFORM_PIECES or BAG_PIECES
+   */
+  void initialise(int starting_difficulty, uint64_t seed,
+                  int generator_mode = UNIFORM_PIECES);
+
+  /**
+   * Returns true if the given piece is inside the board and does not overlap
+   * any occupied board cell.
+   * @param type the piece type, ranging from 0 to 6
+   * @param rotation the number of clockwise rotations, ranging from 0 to 3
+   * @param x the column of the piece centre
+   * @param y the line of the piece centre
+   * @return true if the piece can be placed there, false otherwise
+   */
+  bool piece_fits(int type, int rotation, int x, int y) const;
+
+  /**
+   * Moves the falling piece to the given position and rotation.
+   * @param rotation
+   * @param x
+   * @param y
+   */
+  void set_piece(int rotation, int x, int y);
+
+  /**
+   * Gets the board coordinates of the falling piece's blocks.
+   * @param blocks filled in with the (column, line) of each block
+   */
+  void get_piece_blocks(int blocks[4][2]) const;
+
+  /**
+   * Returns the lines covered by the falling piece.
+   * @return a mask with bit y set if the piece has a block on line y
+   */
+  uint32_t get_piece_rows() const;
+
+  /**
+   * Returns how many lines the falling piece can be lowered before it lands.
+   * While the piece is above the surface of every column it covers, this is
+   * a minimum over the column heights; otherwise the board is searched.
+   * @return
+   */
+  int drop_distance() const;
+
+  /**
+   * Recomputes the column heights from the board.
+   */
+  void update_column_heights();
+
+  /**
+   * Writes the falling piece into the board once it has landed.
+   */
+  void lock_piece();
+
+  /**
+   * Spawns the piece shown in the lookahead. If it does not fit, the game is
+   * over.
+   */
+  void spawn_piece();
+
+  /**
+   * Checks if lines have been filled, and clears them and shifts remaining
+   * blocks.
+   * @return the number of lines cleared
+   */
+  int clear_lines();
+
+  /**
+   * Pushes garbage lines up from the bottom of the board, each full but for
+   * one hole, e.g. those sent by the opponent in a versus match. The falling
+   * piece is lifted if the garbage reaches it. If blocks are pushed off the
+   * top of the board, or the piece cannot be lifted, the game is over.
+   * @param lines
+   * @param hole the column left empty in every garbage line
+   */
+  void add_garbage(int lines, int hole);
+
+  /**
+   * Returns how long the falling piece waits before gravity lowers it, which
+   * shortens as the difficulty rises.
+   * @return the interval, in microseconds
+   */
+  int get_gravity_interval() const;
+
+  /**
+   * Performs a clockwise rotation on the current piece.
+   */
+  void rotate_piece();
+
+  /**
+   * Moves the current piece in the given direction. If a new piece has been
+   * requested, lines are cleared and the next piece is spawned instead.
+   * @param direction -1 = left, 0 = down, 1 = right
+   */
+  void move_piece(int direction);
+
+  /**
+   * Moves the current piece downward until it reaches the bottom or another
+   * block.
+   */
+  void collapse_piece();
+
+  /**
+   * Applies one input to the falling piece, like the matching key would.
+   * @param input one of the INPUT_ codes
+   */
+  void apply_input(int input);
+
+  /**
+   * Lands the falling piece directly at the given resting position, e.g. one
+   * found by a PlacementSearch.
+   * @param rotation
+   * @param x
+   * @param y
+   */
+  void place_piece(int rotation, int x, int y);
+};
+
+#endif
@@ -0,0 +1,296 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+#include "features.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAS_VECTOR_KERNELS
+#endif
+
+// Changes between adjacent cells of a row, with a wall on either side.
+static inline int count_row_transitions(uint16_t row) {
+  uint32_t cells = (uint32_t)row << 1 | 1 | 1 << (GAME_BOARD_WIDTH + 1);
+
+  return __builtin_popcount((cells ^ cells >> 1) &
+                            ((1 << (GAME_BOARD_WIDTH + 1)) - 1));
+}
+
+void get_board_features(const uint16_t board_rows[GAME_BOARD_HEIGHT],
+                        board_features &features) {
+  int heights[GAME_BOARD_WIDTH] = {0};
+  // The columns which have an occupied cell above the current line.
+  uint16_t covered = 0;
+  uint16_t surface;
+  int left;
+  int right;
+
+  features.holes = 0;
+  features.row_transitions = 0;
+  for (int j = GAME_BOARD_HEIGHT - 1; j >= 0; j--) {
+    // The highest occupied cells of the columns not yet covered.
+    surface = board_rows[j] & ~covered;
+    for (; surface; surface &= surface - 1) {
+      heights[__builtin_ctz(surface)] = j + 1;
+    }
+    features.holes += __builtin_popcount(covered & ~board_rows[j]);
+    features.row_transitions += count_row_transitions(board_rows[j]);
+    covered |= board_rows[j];
+  }
+
+  features.aggregate_height = 0;
+  features.bumpiness = 0;
+  features.wells = 0;
+  for (int i = 0; i < GAME_BOARD_WIDTH; i++) {
+    features.aggregate_height += heights[i];
+    if (i + 1 < GAME_BOARD_WIDTH) {
+      features.bumpiness += abs(heights[i] - heights[i + 1]);
+    }
+    // The walls count as neighbours as high as the board.
+    left = i > 0 ? heights[i - 1] : GAME_BOARD_HEIGHT;
+    right = i + 1 < GAME_BOARD_WIDTH ? heights[i + 1] : GAME_BOARD_HEIGHT;
+    if (heights[i] < left && heights[i] < right) {
+      features.wells += min(left, right) - heights[i];
+    }
+  }
+}
+
+#ifdef HAS_VECTOR_KERNELS
+
+// How many bits it takes to count up to the height of the board.
+const int HEIGHT_BITS = 5;
+static_assert(GAME_BOARD_HEIGHT < 1 << HEIGHT_BITS,
+              "HEIGHT_BITS is too small for the board");
+// Per-byte bit counts of 22 rows must not overflow a byte.
+static_assert(GAME_BOARD_HEIGHT * 8 < 256, "the board is too high");
+
+/**
+ * Adds the number of bits in each byte of every lane to the counts, so that
+ * the counts of many rows can be summed before folding the two bytes of a
+ * lane together. Vectors are passed by reference, since the ABI for passing
+ * them by value depends on the target.
+ */
+template <typename V>
+static inline __attribute__((always_inline)) void add_byte_bits(
+    V &counts, const V &bits) {
+  V x = bits - ((bits >> 1) & 0x5555);
+  x = (x & 0x3333) + ((x >> 2) & 0x3333);
+  counts += (x + (x >> 4)) & 0x0f0f;
+}
+
+/**
+ * The vector kernel, with one board per 16-bit lane. Instead of searching for
+ * the top of each column, it keeps the columns covered from above as it goes
+ * down the board: the height of a column is the number of lines at which it
+ * is covered, which is added up in bit-sliced counters (one bit of every
+ * column's height per plane). Holes are then the aggregate height minus the
+ * number of occupied cells.
+ * @param boards
+ * @param features
+ */
+template <typename V, int LANES>
+static inline __attribute__((always_inline)) void get_features_lanes(
+    const uint16_t *const boards[], board_features features[]) {
+  alignas(32) int16_t lanes[GAME_BOARD_HEIGHT][LANES];
+  alignas(32) int16_t results[5][LANES];
+  V covered = {};
+  V planes[HEIGHT_BITS] = {};
+  V cells = {};
+  V transitions = {};
+  V heights[GAME_BOARD_WIDTH];
+  V row;
+  V carry;
+  V next_carry;
+  V bordered;
+
+  // Transpose the boards, so that each row of every board is one vector.
+  for (int i = 0; i < LANES; i++) {
+    for (int j = 0; j < GAME_BOARD_HEIGHT; j++) {
+      lanes[j][i] = boards[i][j];
+    }
+  }
+
+  for (int j = GAME_BOARD_HEIGHT - 1; j >= 0; j--) {
+    memcpy(&row, lanes[j], sizeof(row));
+    covered |= row;
+    // Add one to the height of every covered column.
+    carry = covered;
+    for (int k = 0; k < HEIGHT_BITS; k++) {
+      next_carry = planes[k] & carry;
+      planes[k] ^= carry;
+      carry = next_carry;
+    }
+    add_byte_bits(cells, row);
+    bordered = row << 1 | (1 | 1 << (GAME_BOARD_WIDTH + 1));
+    bordered = (bordered ^ bordered >> 1) &
+               ((1 << (GAME_BOARD_WIDTH + 1)) - 1);
+    add_byte_bits(transitions, bordered);
+  }
+
+  // Read each column's height out of the bit planes.
+  for (int i = 0; i < GAME_BOARD_WIDTH; i++) {
+    heights[i] = (planes[0] >> i) & 1;
+    for (int k = 1; k < HEIGHT_BITS; k++) {
+      heights[i] |= ((planes[k] >> i) & 1) << k;
+    }
+  }
+
+  const V zero = {};
+  const V wall_height = zero + GAME_BOARD_HEIGHT;
+  V aggregate_height = {};
+  V bumpiness = {};
+  V wells = {};
+  V left;
+  V right;
+  V lowest;
+  for (int i = 0; i < GAME_BOARD_WIDTH; i++) {
+    aggregate_height += heights[i];
+    if (i + 1 < GAME_BOARD_WIDTH) {
+      bumpiness += heights[i] > heights[i + 1] ? heights[i] - heights[i + 1]
+                                               : heights[i + 1] - heights[i];
+    }
+    // The walls count as neighbours as high as the board.
+    left = i > 0 ? heights[i - 1] : wall_height;
+    right = i + 1 < GAME_BOARD_WIDTH ? heights[i + 1] : wall_height;
+    lowest = left < right ? left : right;
+    wells += lowest > heights[i] ? lowest - heights[i] : zero;
+  }
+  cells = (cells + (cells >> 8)) & 0xff;
+  transitions = (transitions + (transitions >> 8)) & 0xff;
+
+  memcpy(results[0], &aggregate_height, sizeof(V));
+  memcpy(results[1], &cells, sizeof(V));
+  memcpy(results[2], &bumpiness, sizeof(V));
+  memcpy(results[3], &wells, sizeof(V));
+  memcpy(results[4], &transitions, sizeof(V));
+  for (int i = 0; i < LANES; i++) {
+    features[i].aggregate_height = results[0][i];
+    features[i].holes = results[0][i] - results[1][i];
+    features[i].bumpiness = results[2][i];
+    features[i].wells = results[3][i];
+    features[i].row_transitions = results[4][i];
+  }
+}
+
+typedef int16_t v8i16 __attribute__((vector_size(16)));
+typedef int16_t v16i16 __attribute__((vector_size(32)));
+
+/**
+ * Runs a vector kernel over a batch of boards. The last, partial group of
+ * boards is padded with empty boards.
+ */
+template <typename V, int LANES>
+static inline __attribute__((always_inline)) void get_features_batch(
+    const uint16_t *const boards[], int count, board_features features[]) {
+  static const uint16_t empty_board[GAME_BOARD_HEIGHT] = {0};
+  const uint16_t *padded[LANES];
+  board_features padded_features[LANES];
+  int i = 0;
+
+  for (; i + LANES <= count; i += LANES) {
+    get_features_lanes<V, LANES>(boards + i, features + i);
+  }
+  if (i < count) {
+    for (int k = 0; k < LANES; k++) {
+      padded[k] = i + k < count ? boards[i + k] : empty_board;
+    }
+    get_features_lanes<V, LANES>(padded, padded_features);
+    memcpy(features + i, padded_features, (count - i) * sizeof(board_features));
+  }
+}
+
+__attribute__((target("sse2")))
+static void get_features_sse2(const uint16_t *const boards[], int count,
+                              board_features features[]) {
+  get_features_batch<v8i16, 8>(boards, count, features);
+}
+
+__attribute__((target("avx2")))
+static void get_features_avx2(const uint16_t *const boards[], int count,
+                              board_features features[]) {
+  get_features_batch<v16i16, 16>(boards, count, features);
+}
+
+#endif
+
+static void get_features_scalar(const uint16_t *const boards[], int count,
+                                board_features features[]) {
+  for (int i = 0; i < count; i++) {
+    get_board_features(boards[i], features[i]);
+  }
+}
+
+bool is_feature_kernel_supported(int kernel) {
+  switch (kernel) {
+    case SCALAR_KERNEL:
+      return true;
+#ifdef HAS_VECTOR_KERNELS
+    case SSE2_KERNEL:
+      return __builtin_cpu_supports("sse2");
+    case AVX2_KERNEL:
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+/**
+ * Returns the fastest kernel that can run on this processor.
+ * @return
+ */
+static int get_fastest_feature_kernel() {
+  int kernel = AVX2_KERNEL;
+
+#ifdef HAS_VECTOR_KERNELS
+  // This runs from a static initialiser, possibly before the CPU is probed.
+  __builtin_cpu_init();
+#endif
+  while (!is_feature_kernel_supported(kernel)) {
+    kernel--;
+  }
+  return kernel;
+}
+
+static int feature_kernel = get_fastest_feature_kernel();
+
+void get_board_features(const uint16_t *const boards[], int count,
+                        board_features features[]) {
+  switch (feature_kernel) {
+#ifdef HAS_VECTOR_KERNELS
+    case AVX2_KERNEL:
+      get_features_avx2(boards, count, features);
+      break;
+    case SSE2_KERNEL:
+      get_features_sse2(boards, count, features);
+      break;
+#endif
+    default:
+      get_features_scalar(boards, count, features);
+  }
+}
+
+bool select_feature_kernel(int kernel) {
+  if (!is_feature_kernel_supported(kernel)) {
+    return false;
+  }
+  feature_kernel = kernel;
+  return true;
+}
+
+int get_feature_kernel() {
+  return feature_kernel;
+}
+
+const char *get_feature_kernel_name(int kernel) {
+  switch (kernel) {
+    case SSE2_KERNEL:
+      return "sse2";
+    case AVX2_KERNEL:
+      return "avx2";
+    default:
+      return "scalar";
+  }
+}
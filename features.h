@@ -0,0 +1,73 @@
+#ifndef FEATURES_H
+#define FEATURES_H
+
+#include <cstdint>
+
+#include "structs.h"
+#include "constants.h"
+
+// The feature extraction kernels, from slowest to fastest.
+const int SCALAR_KERNEL = 0;
+const int SSE2_KERNEL = 1;
+const int AVX2_KERNEL = 2;
+
+// The features of a board that the bot scores placements by.
+struct board_features {
+  int aggregate_height; // The sum of the column heights.
+  int holes; // Empty cells with an occupied cell above them.
+  int bumpiness; // The sum of height differences between adjacent columns.
+  int wells; // The sum of the depths of columns lower than both neighbours.
+  // Changes between empty and occupied cells along each row, counting the
+  // walls as occupied, so an empty row has two.
+  int row_transitions;
+};
+
+/**
+ * Computes the features of a board, one board at a time.
+ * @param board_rows the board, stored as one bitmask per row
+ * @param features filled in with the features
+ */
+void get_board_features(const uint16_t board_rows[GAME_BOARD_HEIGHT],
+                        board_features &features);
+
+/**
+ * Computes the features of a batch of boards with the selected kernel. The
+ * vector kernels work on 8 (SSE2) or 16 (AVX2) boards at once, with one board
+ * per lane.
+ * @param boards the boards, each stored as one bitmask per row
+ * @param count the number of boards
+ * @param features filled in with the features of each board
+ */
+void get_board_features(const uint16_t *const boards[], int count,
+                        board_features features[]);
+
+/**
+ * Returns true if the given kernel can run on this processor.
+ * @param kernel one of the _KERNEL constants
+ * @return
+ */
+bool is_feature_kernel_supported(int kernel);
+
+/**
+ * Selects the kernel used for batches of boards. The fastest supported kernel
+ * is selected at startup.
+ * @param kernel one of the _KERNEL constants
+ * @return false, leaving the selection unchanged, if the kernel is not
+ *         supported
+ */
+bool select_feature_kernel(int kernel);
+
+/**
+ * Returns the kernel used for batches of boards.
+ * @return
+ */
+int get_feature_kernel();
+
+/**
+ * Returns the name of a kernel, e.g. "avx2".
+ * @param kernel
+ * @return
+ */
+const char *get_feature_kernel_name(int kernel);
+
+#endif
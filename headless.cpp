@@ -0,0 +1,74 @@
+// Declares the framebuffer object functions, which are core since GL 3.0.
+#define GL_GLEXT_PROTOTYPES
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <cstring>
+
+#include "headless.h"
+
+/**
+ * Returns the EGL display to create the context on: Mesa's surfaceless
+ * platform if the client supports it, otherwise the default display.
+ * @return
+ */
+static EGLDisplay get_headless_display() {
+  const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+
+  if (extensions && strstr(extensions, "EGL_MESA_platform_surfaceless")) {
+    get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+        eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (get_platform_display) {
+      return get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                  EGL_DEFAULT_DISPLAY, NULL);
+    }
+  }
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool create_headless_context(int width, int height) {
+  EGLDisplay display = get_headless_display();
+  // No surface is needed, rather than the default of a window.
+  EGLint config_attributes[] = {
+    EGL_SURFACE_TYPE, EGL_DONT_CARE, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_NONE
+  };
+  EGLConfig config;
+  EGLint configs;
+  EGLContext context;
+  GLuint framebuffer;
+  GLuint colour_buffer;
+
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL) ||
+      !eglBindAPI(EGL_OPENGL_API) ||
+      !eglChooseConfig(display, config_attributes, &config, 1, &configs) ||
+      !configs) {
+    return false;
+  }
+  /**
+   * The context is made current without a surface, and draws into a
+   * framebuffer object instead.
+   */
+  context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+  if (context == EGL_NO_CONTEXT ||
+      !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    return false;
+  }
+
+  glGenFramebuffers(1, &framebuffer);
+  glGenRenderbuffers(1, &colour_buffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, colour_buffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, colour_buffer);
+  glViewport(0, 0, width, height);
+  return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+void finish_headless_frame() {
+  glFinish();
+}
@@ -0,0 +1,21 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+/**
+ * Creates a GL context which needs no window or display, through EGL, and
+ * makes it current. It draws into an offscreen framebuffer of the given
+ * size. Mesa provides this on Linux through its surfaceless platform, which
+ * is tried first, so no X server is needed.
+ * @param width
+ * @param height
+ * @return false if no such context could be created
+ */
+bool create_headless_context(int width, int height);
+
+/**
+ * Waits for everything drawn so far to be rendered, the way a buffer swap
+ * would before showing a frame.
+ */
+void finish_headless_frame();
+
+#endif
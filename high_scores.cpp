@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <unistd.h>
+
+using namespace std;
+
+#include "high_scores.h"
+
+// The longest line of either file, including its newline.
+const int MAX_LINE_LENGTH = 64;
+
+/**
+ * Flushes a file and syncs it to the disk.
+ * @param file
+ * @return false if it could not be
+ */
+static bool sync_file(FILE *file) {
+  return !fflush(file) && !fsync(fileno(file));
+}
+
+/**
+ * Syncs the directory holding a file, so that a rename into it is on the
+ * disk.
+ * @param path the path of the file
+ * @return false if it could not be
+ */
+static bool sync_directory(const string &path) {
+  size_t slash = path.rfind('/');
+  string directory = slash == string::npos ? "." : path.substr(0, slash + 1);
+  int descriptor = open(directory.c_str(), O_RDONLY);
+  bool synced;
+
+  if (descriptor < 0) {
+    return false;
+  }
+  synced = !fsync(descriptor);
+  close(descriptor);
+  return synced;
+}
+
+/**
+ * Reads the next whole line of a file. A last line with no newline was cut
+ * short by a crash, so it is not returned.
+ * @param file
+ * @param line filled in with the line, without its newline
+ * @return false at the end of the file
+ */
+static bool read_line(FILE *file, char line[MAX_LINE_LENGTH]) {
+  size_t length;
+  int c;
+
+  while (fgets(line, MAX_LINE_LENGTH, file)) {
+    length = strlen(line);
+    if (length && line[length - 1] == '\n') {
+      line[length - 1] = '\0';
+      return true;
+    }
+    // Skip the rest of a line which is too long.
+    while ((c = fgetc(file)) != EOF && c != '\n') {
+    }
+  }
+  return false;
+}
+
+/**
+ * Parses a whole line of whitespace separated numbers.
+ * @param line
+ * @param numbers filled in with the numbers
+ * @param count how many numbers the line should hold
+ * @return false if it does not hold exactly that many
+ */
+static bool parse_numbers(const char *line, long long numbers[], int count) {
+  char *end;
+
+  for (int i = 0; i < count; i++) {
+    numbers[i] = strtoll(line, &end, 10);
+    if (end == line) {
+      return false;
+    }
+    line = end;
+  }
+  while (*line == ' ' || *line == '\r') {
+    line++;
+  }
+  return !*line;
+}
+
+HighScoreStore::HighScoreStore(const char *path)
+    : path(path), log_path(string(path) + ".log"), count(0), sequence(0),
+      log_records(0), log_file(NULL) {
+}
+
+HighScoreStore::~HighScoreStore() {
+  if (log_file) {
+    fclose(log_file);
+  }
+}
+
+void HighScoreStore::load() {
+  FILE *file;
+  char line[MAX_LINE_LENGTH];
+  long long numbers[2];
+  bool log_written = false;
+
+  count = 0;
+  sequence = 0;
+  log_records = 0;
+  if ((file = fopen(path.c_str(), "r"))) {
+    while (read_line(file, line)) {
+      if (!strncmp(line, "sequence ", 9) &&
+          parse_numbers(line + 9, numbers, 1) && numbers[0] >= 0) {
+        sequence = numbers[0];
+      } else if (parse_numbers(line, numbers, 1) && numbers[0] >= 0 &&
+                 numbers[0] <= INT_MAX) {
+        insert(numbers[0]);
+      }
+    }
+    fclose(file);
+  }
+
+  if ((file = fopen(log_path.c_str(), "r"))) {
+    uint64_t folded = sequence;
+    while (read_line(file, line)) {
+      if (parse_numbers(line, numbers, 2) && numbers[0] > (long long)folded &&
+          numbers[1] >= 0 && numbers[1] <= INT_MAX) {
+        insert(numbers[1]);
+        sequence = max<uint64_t>(sequence, numbers[0]);
+      }
+    }
+    fseek(file, 0, SEEK_END);
+    log_written = ftell(file) > 0;
+    fclose(file);
+  }
+  /**
+   * Anything in the log is folded into the snapshot straight away, which
+   * also drops a torn last record before more are appended after it.
+   */
+  if (log_written) {
+    compact();
+  }
+}
+
+int HighScoreStore::add(int score) {
+  int position = insert(score);
+
+  if (position < 0) {
+    return position;
+  }
+  sequence++;
+  if (!append(score) || log_records >= MAX_LOG_RECORDS) {
+    compact();
+  }
+  return position;
+}
+
+bool HighScoreStore::compact() {
+  string temporary_path = path + ".tmp";
+  FILE *file = fopen(temporary_path.c_str(), "w");
+  bool written;
+
+  if (!file) {
+    return false;
+  }
+  fprintf(file, "sequence %llu\n", (unsigned long long)sequence);
+  for (int i = 0; i < count; i++) {
+    fprintf(file, "%d\n", scores[i]);
+  }
+  written = !ferror(file) && sync_file(file);
+  written = !fclose(file) && written;
+  if (!written || rename(temporary_path.c_str(), path.c_str())) {
+    remove(temporary_path.c_str());
+    return false;
+  }
+  sync_directory(path);
+
+  // The records are now in the snapshot, so the log can be emptied.
+  if (log_file) {
+    fclose(log_file);
+  }
+  log_file = fopen(log_path.c_str(), "w");
+  log_records = 0;
+  return true;
+}
+
+/**
+ * Inserts a score into the table, in its place, if it is a high score.
+ * Scores equal to the new one stay above it.
+ * @param score
+ * @return its position, or -1 if it is not a high score
+ */
+int HighScoreStore::insert(int score) {
+  int position;
+
+  if (count == MAX_HIGH_SCORES && score <= scores[count - 1]) {
+    return -1;
+  }
+  position = upper_bound(scores, scores + count, score, greater<int>()) -
+      scores;
+  count = min(count + 1, MAX_HIGH_SCORES);
+  copy_backward(scores + position, scores + count - 1, scores + count);
+  scores[position] = score;
+  return position;
+}
+
+/**
+ * Appends the last score added to the log, and syncs it.
+ * @param score
+ * @return false if it could not be
+ */
+bool HighScoreStore::append(int score) {
+  if (!log_file && !(log_file = fopen(log_path.c_str(), "a"))) {
+    return false;
+  }
+  fprintf(log_file, "%llu %d\n", (unsigned long long)sequence, score);
+  if (!sync_file(log_file)) {
+    return false;
+  }
+  log_records++;
+  return true;
+}
@@ -0,0 +1,81 @@
+#ifndef HIGH_SCORES_H
+#define HIGH_SCORES_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// How many high scores are kept.
+const int MAX_HIGH_SCORES = 10;
+// How many scores the log holds before it is folded into the snapshot.
+const int MAX_LOG_RECORDS = 32;
+
+/**
+ * Keeps the top high scores, sorted in descending order, and stores them so
+ * that a crash at any point loses no score which has already been added.
+ *
+ * They are stored in two files. The snapshot, e.g. high_scores.txt, holds a
+ * line "sequence N" followed by one score per line; the log, the same path
+ * with ".log" appended, holds lines "N score". Each new high score is
+ * appended to the log with the next sequence number and synced before
+ * add() returns. Compaction writes the scores to a temporary file, syncs it
+ * and renames it over the snapshot, which is atomic, then empties the log.
+ * Log records with a sequence number the snapshot already holds are ignored
+ * when the scores are read, so a crash between the rename and emptying the
+ * log adds no score twice, and a record torn by a crash is skipped.
+ */
+class HighScoreStore {
+ public:
+  /**
+   * @param path the path of the snapshot
+   */
+  explicit HighScoreStore(const char *path);
+  ~HighScoreStore();
+
+  /**
+   * Reads the snapshot and the log, skipping any line which is not a whole,
+   * well formed record, and compacts the log if it has any records. A
+   * snapshot with no "sequence" line, in the old format, is read as
+   * sequence 0.
+   */
+  void load();
+
+  /**
+   * Adds a score if it is a high score, and appends it to the log, compacting
+   * the log once it is full.
+   * @param score
+   * @return the position of the score in the table, from 0, or -1 if it is
+   *         not a high score
+   */
+  int add(int score);
+
+  /**
+   * Writes the scores to the snapshot and empties the log.
+   * @return false if they could not be written, in which case the log still
+   *         holds them
+   */
+  bool compact();
+
+  int get_count() const {
+    return count;
+  }
+
+  const int *get_scores() const {
+    return scores;
+  }
+
+ private:
+  int insert(int score);
+  bool append(int score);
+
+  std::string path;
+  std::string log_path;
+  int scores[MAX_HIGH_SCORES];
+  int count;
+  // The sequence number of the last score added.
+  uint64_t sequence;
+  int log_records;
+  FILE *log_file;
+};
+
+#endif
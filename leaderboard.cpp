@@ -0,0 +1,423 @@
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "leaderboard.h"
+
+// The bytes which start every leaderboard file.
+const char LEADERBOARD_MAGIC[4] = {'T', 'L', 'B', 1};
+// How many records a new file has room for.
+const uint64_t INITIAL_CAPACITY = 1024;
+
+struct Leaderboard::file_header {
+  char magic[4];
+  uint32_t record_size;
+  uint64_t count; // How many records have been written.
+  uint64_t reserved;
+};
+
+static_assert(sizeof(leaderboard_record) == 40,
+              "Leaderboard records have a fixed size.");
+
+/**
+ * Returns whether a game can start at a difficulty.
+ * @param difficulty
+ * @return
+ */
+static bool is_starting_difficulty(int difficulty) {
+  return difficulty >= 1 && difficulty <= MAX_STARTING_DIFFICULTY;
+}
+
+/**
+ * Syncs the pages of a mapping which hold a range of bytes to the file.
+ * @param start
+ * @param size
+ * @return false if they could not be
+ */
+static bool sync_range(const void *start, size_t size) {
+  uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t first = (uintptr_t)start & ~(page_size - 1);
+
+  return !msync((void *)first, (uintptr_t)start + size - first, MS_SYNC);
+}
+
+Leaderboard::Leaderboard()
+    : descriptor(-1), header(NULL), records(NULL), mapped_size(0) {
+}
+
+Leaderboard::~Leaderboard() {
+  close();
+}
+
+bool Leaderboard::open(const char *path) {
+  struct stat status;
+  file_header existing;
+  uint64_t capacity;
+
+  close();
+  descriptor = ::open(path, O_RDWR | O_CREAT, 0644);
+  if (descriptor < 0 || fstat(descriptor, &status)) {
+    close();
+    return false;
+  }
+
+  // A new file is given its header and room for the first records.
+  if (!status.st_size) {
+    if (!map(INITIAL_CAPACITY)) {
+      close();
+      return false;
+    }
+    memcpy(header->magic, LEADERBOARD_MAGIC, sizeof(LEADERBOARD_MAGIC));
+    header->record_size = sizeof(leaderboard_record);
+    header->count = 0;
+    return sync_range(header, sizeof(file_header));
+  }
+
+  /**
+   * The header is checked before the file is mapped, so that a file which
+   * is not a leaderboard, or has records of another size, is left as it is.
+   */
+  if ((size_t)status.st_size < sizeof(file_header)) {
+    close();
+    return false;
+  }
+  capacity = (status.st_size - sizeof(file_header)) /
+      sizeof(leaderboard_record);
+  if (pread(descriptor, &existing, sizeof(existing), 0) !=
+          (ssize_t)sizeof(existing) ||
+      memcmp(existing.magic, LEADERBOARD_MAGIC, sizeof(LEADERBOARD_MAGIC)) ||
+      existing.record_size != sizeof(leaderboard_record) ||
+      existing.count > capacity || !map(capacity)) {
+    close();
+    return false;
+  }
+
+  // Build the indexes from every record, sorting each once.
+  vector<ScoreIndex::entry> entries[MAX_STARTING_DIFFICULTY + 1];
+  for (uint32_t i = 0; i < header->count; i++) {
+    ScoreIndex::entry entry = {records[i].score, i};
+    entries[0].push_back(entry);
+    if (is_starting_difficulty(records[i].difficulty)) {
+      entries[records[i].difficulty].push_back(entry);
+    }
+  }
+  for (int d = 0; d <= MAX_STARTING_DIFFICULTY; d++) {
+    indexes[d].build(entries[d]);
+  }
+  return true;
+}
+
+void Leaderboard::close() {
+  if (header) {
+    munmap(header, mapped_size);
+  }
+  if (descriptor >= 0) {
+    ::close(descriptor);
+  }
+  descriptor = -1;
+  header = NULL;
+  records = NULL;
+  mapped_size = 0;
+  for (int d = 0; d <= MAX_STARTING_DIFFICULTY; d++) {
+    indexes[d].clear();
+  }
+}
+
+bool Leaderboard::add(const leaderboard_record &record) {
+  leaderboard_record *added;
+
+  if (!header) {
+    return false;
+  }
+  if (header->count == (mapped_size - sizeof(file_header)) /
+                           sizeof(leaderboard_record) &&
+      !map(max<uint64_t>(header->count * 2, INITIAL_CAPACITY))) {
+    return false;
+  }
+
+  /**
+   * The record is synced before the count which includes it, so that a
+   * record torn by a crash is never counted.
+   */
+  added = records + header->count;
+  *added = record;
+  added->name[LEADERBOARD_NAME_SIZE - 1] = '\0';
+  if (!sync_range(added, sizeof(leaderboard_record))) {
+    return false;
+  }
+  header->count++;
+  sync_range(header, sizeof(file_header));
+  add_to_indexes(header->count - 1);
+  return true;
+}
+
+long Leaderboard::get_count(int difficulty) const {
+  const ScoreIndex *index = get_index(difficulty);
+
+  return index ? index->size() : 0;
+}
+
+int Leaderboard::get_top(leaderboard_record top[], int count,
+                         int difficulty) const {
+  const ScoreIndex *index = get_index(difficulty);
+
+  if (!index) {
+    return 0;
+  }
+  count = min<long>(count, index->size());
+  for (int i = 0; i < count; i++) {
+    top[i] = records[index->get_record(i)];
+  }
+  return count;
+}
+
+long Leaderboard::get_rank(int score, int difficulty) const {
+  const ScoreIndex *index = get_index(difficulty);
+
+  return index ? index->count_higher(score) : 0;
+}
+
+double Leaderboard::get_percentile(int score, int difficulty) const {
+  const ScoreIndex *index = get_index(difficulty);
+  long higher;
+  long equal;
+
+  if (!index || !index->size()) {
+    return 100.0;
+  }
+  higher = index->count_higher(score);
+  equal = index->count_higher(score, true) - higher;
+  return 100.0 * (index->size() - higher - equal + equal * 0.5) /
+      index->size();
+}
+
+/**
+ * Maps the file with room for a number of records, growing it first if it
+ * is smaller than that. It is never shrunk.
+ * @param capacity
+ * @return false if it could not be
+ */
+bool Leaderboard::map(uint64_t capacity) {
+  size_t size = sizeof(file_header) + capacity * sizeof(leaderboard_record);
+  struct stat status;
+  void *mapping;
+
+  if (fstat(descriptor, &status) ||
+      (size > (size_t)status.st_size && ftruncate(descriptor, size))) {
+    return false;
+  }
+  mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor,
+                 0);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  if (header) {
+    munmap(header, mapped_size);
+  }
+  header = (file_header *)mapping;
+  records = (leaderboard_record *)(header + 1);
+  mapped_size = size;
+  return true;
+}
+
+/**
+ * Returns the index of a starting difficulty.
+ * @param difficulty a starting difficulty, or ANY_DIFFICULTY
+ * @return NULL if there is no such difficulty
+ */
+const ScoreIndex *Leaderboard::get_index(int difficulty) const {
+  if (difficulty == ANY_DIFFICULTY) {
+    return &indexes[0];
+  }
+  return is_starting_difficulty(difficulty) ? &indexes[difficulty] : NULL;
+}
+
+/**
+ * Adds a record to the index of every game and to that of its difficulty.
+ * It goes after the games with the same score, which were added before it.
+ * @param record
+ */
+void Leaderboard::add_to_indexes(uint32_t record) {
+  ScoreIndex::entry entry = {records[record].score, record};
+  int difficulty = records[record].difficulty;
+
+  indexes[0].insert(entry);
+  if (is_starting_difficulty(difficulty)) {
+    indexes[difficulty].insert(entry);
+  }
+}
+
+ScoreIndex::ScoreIndex() : root(-1) {
+}
+
+void ScoreIndex::build(vector<entry> &entries) {
+  // The right spine of the tree built so far, from the root down.
+  vector<int> spine;
+  int last;
+
+  sort(entries.begin(), entries.end(), [](const entry &a, const entry &b) {
+    return a.score > b.score || (a.score == b.score && a.record < b.record);
+  });
+  nodes.resize(entries.size());
+
+  /**
+   * Each node in order goes at the bottom of the right spine, under the
+   * last node with a higher priority, taking the nodes it passes as its
+   * left subtree. A node left off the spine is complete, so its size is
+   * known.
+   */
+  for (size_t i = 0; i < entries.size(); i++) {
+    node &added = nodes[i];
+
+    added.score = entries[i].score;
+    added.record = entries[i].record;
+    added.right = -1;
+    last = -1;
+    while (!spine.empty() && get_priority(spine.back()) < get_priority(i)) {
+      last = spine.back();
+      spine.pop_back();
+      update_size(last);
+    }
+    added.left = last;
+    if (!spine.empty()) {
+      nodes[spine.back()].right = i;
+    }
+    spine.push_back(i);
+  }
+  for (size_t i = spine.size(); i > 0; i--) {
+    update_size(spine[i - 1]);
+  }
+  root = spine.empty() ? -1 : spine[0];
+}
+
+void ScoreIndex::insert(const entry &added) {
+  node leaf = {added.score, added.record, -1, -1, 1};
+
+  nodes.push_back(leaf);
+  root = insert(root, nodes.size() - 1);
+}
+
+void ScoreIndex::clear() {
+  nodes.clear();
+  root = -1;
+}
+
+long ScoreIndex::count_higher(int score, bool inclusive) const {
+  long count = 0;
+
+  for (int position = root; position >= 0;) {
+    const node &current = nodes[position];
+
+    if (current.score > score || (inclusive && current.score == score)) {
+      count += get_size(current.left) + 1;
+      position = current.right;
+    } else {
+      position = current.left;
+    }
+  }
+  return count;
+}
+
+uint32_t ScoreIndex::get_record(long rank) const {
+  int position = root;
+
+  for (;;) {
+    const node &current = nodes[position];
+    long left = get_size(current.left);
+
+    if (rank == left) {
+      return current.record;
+    }
+    if (rank < left) {
+      position = current.left;
+    } else {
+      rank -= left + 1;
+      position = current.right;
+    }
+  }
+}
+
+/**
+ * Returns the priority of a node, which is its record number mixed, so that
+ * the priorities look random but are the same every time the file is opened.
+ * @param position
+ * @return
+ */
+uint32_t ScoreIndex::get_priority(int position) const {
+  uint32_t priority = nodes[position].record;
+
+  priority ^= priority >> 16;
+  priority *= 0x85ebca6b;
+  priority ^= priority >> 13;
+  priority *= 0xc2b2ae35;
+  priority ^= priority >> 16;
+  return priority;
+}
+
+/**
+ * Counts the nodes of a subtree again, from those of its children.
+ * @param position
+ */
+void ScoreIndex::update_size(int position) {
+  node &current = nodes[position];
+
+  current.size = get_size(current.left) + get_size(current.right) + 1;
+}
+
+/**
+ * Adds a node to a subtree: it goes down the tree by order until it reaches
+ * a node with a lower priority, which it replaces, splitting that subtree
+ * into the nodes before and after it as its children.
+ * @param root the position of the subtree's root, or -1
+ * @param added the position of the node, which has no children
+ * @return the position of the subtree's new root
+ */
+int ScoreIndex::insert(int root, int added) {
+  if (root < 0) {
+    return added;
+  }
+  if (get_priority(added) > get_priority(root)) {
+    node &key = nodes[added];
+
+    split(root, key, key.left, key.right);
+    update_size(added);
+    return added;
+  }
+  if (is_before(nodes[added], nodes[root])) {
+    int left = insert(nodes[root].left, added);
+    nodes[root].left = left;
+  } else {
+    int right = insert(nodes[root].right, added);
+    nodes[root].right = right;
+  }
+  nodes[root].size++;
+  return root;
+}
+
+/**
+ * Splits a subtree into the nodes before a key and those after it.
+ * @param root the position of the subtree's root, or -1
+ * @param key
+ * @param left set to the root of the nodes before the key
+ * @param right set to the root of the nodes after the key
+ */
+void ScoreIndex::split(int root, const node &key, int &left, int &right) {
+  if (root < 0) {
+    left = -1;
+    right = -1;
+    return;
+  }
+  if (is_before(nodes[root], key)) {
+    left = root;
+    split(nodes[root].right, key, nodes[root].right, right);
+  } else {
+    right = root;
+    split(nodes[root].left, key, left, nodes[root].left);
+  }
+  update_size(root);
+}
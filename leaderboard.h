@@ -0,0 +1,191 @@
+#ifndef LEADERBOARD_H
+#define LEADERBOARD_H
+
+#include <cstdint>
+#include <vector>
+
+// The longest player name kept, including its terminating null.
+const int LEADERBOARD_NAME_SIZE = 16;
+// Queries which take a difficulty cover every difficulty with this.
+const int ANY_DIFFICULTY = -1;
+// The highest starting difficulty a game can have.
+const int MAX_STARTING_DIFFICULTY = 10;
+
+// One finished game. Records are 40 bytes, in the byte order of the host.
+struct leaderboard_record {
+  int32_t score;
+  int32_t difficulty; // The starting difficulty, from 1.
+  int64_t time; // When the game ended, in seconds since the epoch.
+  int32_t pieces_spawned;
+  uint32_t duration; // How long the game lasted, in milliseconds.
+  char name[LEADERBOARD_NAME_SIZE];
+};
+
+/**
+ * The games of a leaderboard by score, highest first, and by when they were
+ * added among those with the same score. It is a treap: a binary search tree
+ * in that order which is also a heap of priorities hashed from the record
+ * numbers, so that it stays balanced in expectation whatever order the
+ * scores come in. Each node counts the nodes under it, so adding a game,
+ * finding how many games scored more than a score and finding the game at a
+ * rank all take O(log n). The nodes are kept in one array, and linked by
+ * their positions in it.
+ */
+class ScoreIndex {
+ public:
+  struct entry {
+    int32_t score;
+    uint32_t record;
+  };
+
+  ScoreIndex();
+
+  /**
+   * Replaces the games held with others, in O(n) once they are sorted.
+   * @param entries the games, in any order, which are sorted
+   */
+  void build(std::vector<entry> &entries);
+
+  /**
+   * Adds a game, after any with the same score.
+   * @param added a game with a higher record number than every game held
+   */
+  void insert(const entry &added);
+
+  void clear();
+
+  long size() const {
+    return nodes.size();
+  }
+
+  /**
+   * Returns how many games scored more than a score, or as much if
+   * inclusive.
+   * @param score
+   * @param inclusive
+   * @return
+   */
+  long count_higher(int score, bool inclusive = false) const;
+
+  /**
+   * Returns the record number of the game at a rank.
+   * @param rank from 0, below size()
+   * @return
+   */
+  uint32_t get_record(long rank) const;
+
+ private:
+  struct node {
+    int32_t score;
+    uint32_t record;
+    int32_t left; // The position of the left child, or -1.
+    int32_t right;
+    uint32_t size; // How many nodes the subtree holds, this one included.
+  };
+
+  static bool is_before(const node &a, const node &b) {
+    return a.score > b.score || (a.score == b.score && a.record < b.record);
+  }
+
+  uint32_t get_priority(int position) const;
+  uint32_t get_size(int position) const {
+    return position < 0 ? 0 : nodes[position].size;
+  }
+  void update_size(int position);
+  int insert(int root, int added);
+  void split(int root, const node &key, int &left, int &right);
+
+  std::vector<node> nodes;
+  int root; // The position of the root, or -1 if there are no games.
+};
+
+/**
+ * Keeps every finished game in a file of fixed size records, which is
+ * memory mapped, and answers queries on the scores through sorted indexes:
+ * one of every game and one per starting difficulty.
+ *
+ * The file starts with a header holding the number of records, which is
+ * only increased once a new record has been synced, so a crash while one is
+ * added loses only that one. The file grows by doubling. The indexes hold
+ * the score with the record number, so that they are searched without
+ * touching the records, and are built when the file is opened, in
+ * O(n log n) for sorting them.
+ *
+ * Ranks and percentiles are found in O(log n), top K in O(K log n), and a
+ * game is added to the indexes in O(log n).
+ */
+class Leaderboard {
+ public:
+  Leaderboard();
+  ~Leaderboard();
+
+  /**
+   * Opens a leaderboard file, creating it if it does not exist.
+   * @param path
+   * @return false if it could not be opened, or is not a leaderboard
+   */
+  bool open(const char *path);
+
+  /**
+   * Closes the file, if one is open.
+   */
+  void close();
+
+  /**
+   * Adds a finished game and syncs it to the file.
+   * @param record
+   * @return false if it could not be written
+   */
+  bool add(const leaderboard_record &record);
+
+  /**
+   * Returns the number of games kept.
+   * @param difficulty a starting difficulty, or ANY_DIFFICULTY
+   * @return
+   */
+  long get_count(int difficulty = ANY_DIFFICULTY) const;
+
+  /**
+   * Copies the games with the highest scores, highest first. Games with the
+   * same score are ordered by when they were added.
+   * @param records filled in with the games
+   * @param count the most games to copy
+   * @param difficulty a starting difficulty, or ANY_DIFFICULTY
+   * @return the number of games copied
+   */
+  int get_top(leaderboard_record records[], int count,
+              int difficulty = ANY_DIFFICULTY) const;
+
+  /**
+   * Returns the rank a score has, i.e. how many games scored more.
+   * @param score
+   * @param difficulty a starting difficulty, or ANY_DIFFICULTY
+   * @return the rank, from 0
+   */
+  long get_rank(int score, int difficulty = ANY_DIFFICULTY) const;
+
+  /**
+   * Returns the percentile rank of a score: the percentage of games which
+   * scored less, counting half of those with the same score.
+   * @param score
+   * @param difficulty a starting difficulty, or ANY_DIFFICULTY
+   * @return a percentage, or 100 if there are no games
+   */
+  double get_percentile(int score, int difficulty = ANY_DIFFICULTY) const;
+
+ private:
+  struct file_header;
+
+  bool map(uint64_t capacity);
+  const ScoreIndex *get_index(int difficulty) const;
+  void add_to_indexes(uint32_t record);
+
+  int descriptor;
+  file_header *header;
+  leaderboard_record *records;
+  size_t mapped_size;
+  // Index 0 holds every game, and index d those started at difficulty d.
+  ScoreIndex indexes[MAX_STARTING_DIFFICULTY + 1];
+};
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef PIECE_GENERATOR_H
+#define PIECE_GENERATOR_H
+
+#include <cstdint>
+
+// Piece generator modes.
+const int UNIFORM_PIECES = 0; // Each piece type is picked independently.
+const int BAG_PIECES = 1; // Every 7 pieces are a shuffle of all piece types.
+
+/**
+ * Mixes the given value into a well distributed 64-bit number (SplitMix64).
+ * Used to expand seeds, and to derive independent seeds from one seed.
+ * @param value
+ * @return
+ */
+inline uint64_t mix_seed(uint64_t value) {
+  value += 0x9E3779B97F4A7C15ULL;
+  value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+  return value ^ (value >> 31);
+}
+
+/**
+ * Generates the sequence of pieces for one game from an explicit seed, using
+ * the xoshiro128** generator. It only uses integer arithmetic, so the same
+ * seed gives a bit-identical sequence on every run and platform. It holds no
+ * pointers, so it can be copied along with the rest of a game.
+ */
+class PieceGenerator {
+ public:
+  /**
+   * Restarts the generator from the given seed.
+   * @param seed
+   * @param mode UNIFORM_PIECES or BAG_PIECES
+   */
+  void seed(uint64_t seed, int mode) {
+    uint64_t low = mix_seed(seed);
+    uint64_t high = mix_seed(low);
+
+    state[0] = (uint32_t)low;
+    state[1] = (uint32_t)(low >> 32);
+    state[2] = (uint32_t)high;
+    state[3] = (uint32_t)(high >> 32);
+    // The generator must never be seeded with an all-zero state.
+    if (!(state[0] | state[1] | state[2] | state[3])) {
+      state[0] = 1;
+    }
+    this->mode = mode;
+    bag_left = 0;
+  }
+
+  /**
+   * Returns the next raw 32-bit number.
+   * @return
+   */
+  uint32_t next() {
+    uint32_t result = rotate_left(state[1] * 5, 7) * 9;
+    uint32_t shifted = state[1] << 9;
+
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= shifted;
+    state[3] = rotate_left(state[3], 11);
+    return result;
+  }
+
+  /**
+   * Returns a number in the range [0, bound), by scaling rather than taking a
+   * remainder.
+   * @param bound
+   * @return
+   */
+  uint32_t next_below(uint32_t bound) {
+    return (uint32_t)(((uint64_t)next() * bound) >> 32);
+  }
+
+  /**
+   * Returns the next piece type, ranging from 0 to 6.
+   * @return
+   */
+  int next_piece() {
+    if (mode != BAG_PIECES) {
+      return next_below(7);
+    }
+    // Refill the bag with a shuffle of all seven piece types.
+    if (!bag_left) {
+      for (int i = 0; i < 7; i++) {
+        bag[i] = i;
+      }
+      for (int i = 6; i > 0; i--) {
+        int j = next_below(i + 1);
+        uint8_t swap = bag[i];
+        bag[i] = bag[j];
+        bag[j] = swap;
+      }
+      bag_left = 7;
+    }
+    return bag[--bag_left];
+  }
+
+ private:
+  static uint32_t rotate_left(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+  }
+
+  uint32_t state[4];
+  uint8_t bag[7];
+  uint8_t bag_left; // How many pieces are left in the bag.
+  uint8_t mode;
+};
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef PIECES_H
+#define PIECES_H
+
+#include <cstdint>
+
+#include "structs.h"
+#include "constants.h"
+
+// The number of piece types, which range from 0 to 6.
+const int PIECE_TYPES = 7;
+
+/**
+ * One rotation of a game piece: the block offsets relative to the piece
+ * centre, the columns the piece occupies in each of its rows, as bitmasks in
+ * which bit 0 is the piece's leftmost column (min_x), and the lowest block
+ * offset in each of its columns.
+ */
+struct piece_orientation {
+  int blocks[4][2];
+  uint16_t row_masks[4]; // Starting from the piece's bottom row (min_y).
+  int column_bottoms[4]; // Starting from the piece's leftmost column.
+  int rows; // How many rows the piece spans.
+  int columns; // How many columns the piece spans.
+  // The first rotation of the same piece which covers the same cells.
+  int shape_rotation;
+  int min_x;
+  int max_x;
+  int min_y;
+  int max_y;
+};
+
+// Every rotation of every game piece, indexed by [type][rotation].
+struct piece_table {
+  piece_orientation orientations[PIECE_TYPES][4];
+};
+
+/**
+ * Computes the given rotation of a game piece from its spawn orientation in
+ * GAME_PIECES. Each clockwise rotation turns the offset (x, y) of a block
+ * into (-y, x) around the centre block. The O piece is never rotated.
+ * @param type the piece type, ranging from 0 to 6, order as in GAME_PIECES
+ * @param rotation the number of clockwise rotations, ranging from 0 to 3
+ * @return
+ */
+constexpr piece_orientation make_piece_orientation(int type, int rotation) {
+  piece_orientation orientation = {};
+
+  for (int i = 0; i < 4; i++) {
+    int x = GAME_PIECES[type * 4 + i][0];
+    int y = GAME_PIECES[type * 4 + i][1];
+    for (int turn = 0; turn < rotation && type != O_PIECE; turn++) {
+      int rotated_x = -y;
+      y = x;
+      x = rotated_x;
+    }
+    orientation.blocks[i][0] = x;
+    orientation.blocks[i][1] = y;
+  }
+
+  // Find the bounding box of the blocks.
+  orientation.min_x = orientation.max_x = orientation.blocks[0][0];
+  orientation.min_y = orientation.max_y = orientation.blocks[0][1];
+  for (int i = 1; i < 4; i++) {
+    int x = orientation.blocks[i][0];
+    int y = orientation.blocks[i][1];
+    orientation.min_x = x < orientation.min_x ? x : orientation.min_x;
+    orientation.max_x = x > orientation.max_x ? x : orientation.max_x;
+    orientation.min_y = y < orientation.min_y ? y : orientation.min_y;
+    orientation.max_y = y > orientation.max_y ? y : orientation.max_y;
+  }
+  orientation.rows = orientation.max_y - orientation.min_y + 1;
+  orientation.columns = orientation.max_x - orientation.min_x + 1;
+
+  // Build the row bitmasks and find the bottom of each column.
+  for (int i = 0; i < orientation.columns; i++) {
+    orientation.column_bottoms[i] = orientation.max_y;
+  }
+  for (int i = 0; i < 4; i++) {
+    int column = orientation.blocks[i][0] - orientation.min_x;
+    int row = orientation.blocks[i][1] - orientation.min_y;
+    orientation.row_masks[row] |= 1 << column;
+    if (orientation.blocks[i][1] < orientation.column_bottoms[column]) {
+      orientation.column_bottoms[column] = orientation.blocks[i][1];
+    }
+  }
+
+  return orientation;
+}
+
+/**
+ * Computes every rotation of every game piece.
+ * @return
+ */
+constexpr piece_table make_piece_table() {
+  piece_table table = {};
+
+  for (int type = 0; type < PIECE_TYPES; type++) {
+    for (int rotation = 0; rotation < 4; rotation++) {
+      table.orientations[type][rotation] =
+          make_piece_orientation(type, rotation);
+    }
+  }
+
+  // Find the rotations which only move the piece centre, e.g. for the I piece.
+  for (int type = 0; type < PIECE_TYPES; type++) {
+    for (int rotation = 0; rotation < 4; rotation++) {
+      piece_orientation &orientation = table.orientations[type][rotation];
+      orientation.shape_rotation = rotation;
+      for (int other = 0; other < rotation; other++) {
+        const piece_orientation &shape = table.orientations[type][other];
+        bool same = shape.rows == orientation.rows;
+        for (int i = 0; same && i < orientation.rows; i++) {
+          same = shape.row_masks[i] == orientation.row_masks[i];
+        }
+        if (same) {
+          orientation.shape_rotation = other;
+          break;
+        }
+      }
+    }
+  }
+  return table;
+}
+
+// Generated at compile time, so it cannot drift from GAME_PIECES.
+constexpr piece_table PIECE_TABLE = make_piece_table();
+
+/**
+ * Returns true if every rotation of every piece has four distinct blocks that
+ * fit in its row bitmasks.
+ * @return
+ */
+constexpr bool is_piece_table_valid() {
+  for (int type = 0; type < PIECE_TYPES; type++) {
+    for (int rotation = 0; rotation < 4; rotation++) {
+      const piece_orientation &orientation =
+          PIECE_TABLE.orientations[type][rotation];
+      int blocks = 0;
+      for (int i = 0; i < orientation.rows; i++) {
+        for (uint16_t mask = orientation.row_masks[i]; mask; mask >>= 1) {
+          blocks += mask & 1;
+        }
+      }
+      if (blocks != 4 || orientation.rows > 4 || orientation.columns > 4) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static_assert(is_piece_table_valid(), "GAME_PIECES has overlapping blocks");
+
+/**
+ * Returns the given rotation of a game piece.
+ * @param type the piece type, ranging from 0 to 6
+ * @param rotation the number of clockwise rotations, ranging from 0 to 3
+ * @return
+ */
+constexpr const piece_orientation &get_piece_orientation(int type,
+                                                         int rotation) {
+  return PIECE_TABLE.orientations[type][rotation];
+}
+
+/**
+ * Returns true if the given piece is inside a board and does not overlap any
+ * of its occupied cells.
+ * @param board_rows the board, stored as one bitmask per row
+ * @param type the piece type, ranging from 0 to 6
+ * @param rotation the number of clockwise rotations, ranging from 0 to 3
+ * @param x the column of the piece centre
+ * @param y the line of the piece centre
+ * @return true if the piece can be placed there, false otherwise
+ */
+inline bool piece_fits_board(const uint16_t board_rows[], int type,
+                             int rotation, int x, int y) {
+  const piece_orientation &orientation = get_piece_orientation(type, rotation);
+  int left = x + orientation.min_x;
+  int bottom = y + orientation.min_y;
+
+  if (left < 0 || x + orientation.max_x >= GAME_BOARD_WIDTH ||
+      bottom < 0 || y + orientation.max_y >= GAME_BOARD_HEIGHT) {
+    return false;
+  }
+  for (int i = 0; i < orientation.rows; i++) {
+    if (board_rows[bottom + i] & (orientation.row_masks[i] << left)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,157 @@
+#include <cstring>
+
+using namespace std;
+
+#include "placements.h"
+
+int PlacementSearch::find_placements(
+    const uint16_t board_rows[GAME_BOARD_HEIGHT], int type, int rotation,
+    int x, int y) {
+  int state;
+  int queue_start = 0;
+
+  count = 0;
+  piece_type = type;
+  if (!piece_fits_board(board_rows, type, rotation, x, y)) {
+    return 0;
+  }
+
+  visited.reset();
+  landed.reset();
+  queue_end = 0;
+  start_state = state_index(rotation, x, y);
+  visit(start_state, start_state, INPUT_DOWN);
+
+  while (queue_start < queue_end) {
+    state = queue[queue_start++];
+    rotation = state / (GAME_BOARD_WIDTH * GAME_BOARD_HEIGHT);
+    y = state / GAME_BOARD_WIDTH % GAME_BOARD_HEIGHT;
+    x = state % GAME_BOARD_WIDTH;
+
+    // Try every move from this state.
+    if (piece_fits_board(board_rows, type, rotation, x - 1, y)) {
+      visit(state_index(rotation, x - 1, y), state, INPUT_LEFT);
+    }
+    if (piece_fits_board(board_rows, type, rotation, x + 1, y)) {
+      visit(state_index(rotation, x + 1, y), state, INPUT_RIGHT);
+    }
+    if (type != O_PIECE &&
+        piece_fits_board(board_rows, type, (rotation + 1) & 3, x, y)) {
+      visit(state_index((rotation + 1) & 3, x, y), state, INPUT_ROTATE);
+    }
+    if (piece_fits_board(board_rows, type, rotation, x, y - 1)) {
+      visit(state_index(rotation, x, y - 1), state, INPUT_DOWN);
+      continue;
+    }
+
+    // The piece cannot move down, so this is a resting position.
+    const piece_orientation &orientation =
+        get_piece_orientation(type, rotation);
+    int left = x + orientation.min_x;
+    int bottom = y + orientation.min_y;
+    int cells = state_index(orientation.shape_rotation, left, bottom);
+    if (landed[cells]) {
+      continue;
+    }
+    landed[cells] = true;
+
+    // Land the piece and clear the filled lines.
+    Placement &placement = placements[count];
+    uint16_t *rows = placement.board_rows;
+    int kept = 0;
+    memcpy(rows, board_rows, sizeof(placement.board_rows));
+    for (int i = 0; i < orientation.rows; i++) {
+      rows[bottom + i] |= orientation.row_masks[i] << left;
+    }
+    for (int j = 0; j < GAME_BOARD_HEIGHT; j++) {
+      if (rows[j] != FULL_ROW) {
+        rows[kept++] = rows[j];
+      }
+    }
+    placement.lines_cleared = GAME_BOARD_HEIGHT - kept;
+    for (; kept < GAME_BOARD_HEIGHT; kept++) {
+      rows[kept] = 0;
+    }
+    placement.rotation = rotation;
+    placement.x = x;
+    placement.y = y;
+    placement_states[count] = state;
+    count++;
+  }
+
+  return count;
+}
+
+int PlacementSearch::find_placements(const GameState &game) {
+  uint16_t rows[GAME_BOARD_HEIGHT];
+  int kept = 0;
+
+  if (game.new_piece) {
+    // The filled lines are only cleared when the next piece is spawned.
+    for (int j = 0; j < GAME_BOARD_HEIGHT; j++) {
+      if (game.board_rows[j] != FULL_ROW) {
+        rows[kept++] = game.board_rows[j];
+      }
+    }
+    for (; kept < GAME_BOARD_HEIGHT; kept++) {
+      rows[kept] = 0;
+    }
+    return find_placements(rows, game.next_piece_type, 0, 4, 19);
+  }
+  return find_placements(game.board_rows, game.current_piece_type,
+                         game.piece_rotation, game.piece_x, game.piece_y);
+}
+
+int PlacementSearch::get_inputs(int index, int inputs[],
+                                int max_inputs) const {
+  int length = 0;
+
+  // Count the inputs first, since they are found from the end.
+  for (int state = placement_states[index]; state != start_state;
+       state = parents[state]) {
+    length++;
+  }
+  if (length > max_inputs) {
+    return -1;
+  }
+
+  int i = length;
+  for (int state = placement_states[index]; state != start_state;
+       state = parents[state]) {
+    inputs[--i] = parent_inputs[state];
+  }
+  return length;
+}
+
+int PlacementSearch::find_placement(int rotation, int x, int y) const {
+  const piece_orientation &orientation =
+      get_piece_orientation(piece_type, rotation & 3);
+  int left = x + orientation.min_x;
+  int bottom = y + orientation.min_y;
+
+  if (!count || left < 0 || left >= GAME_BOARD_WIDTH || bottom < 0 ||
+      bottom >= GAME_BOARD_HEIGHT) {
+    return -1;
+  }
+  // Placements are told apart by the cells they cover, as when searching.
+  int cells = state_index(orientation.shape_rotation, left, bottom);
+  for (int i = 0; i < count; i++) {
+    const piece_orientation &found =
+        get_piece_orientation(piece_type, placements[i].rotation);
+    if (state_index(found.shape_rotation, placements[i].x + found.min_x,
+                    placements[i].y + found.min_y) == cells) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void PlacementSearch::visit(int state, int parent, int input) {
+  if (visited[state]) {
+    return;
+  }
+  visited[state] = true;
+  parents[state] = parent;
+  parent_inputs[state] = input;
+  queue[queue_end++] = state;
+}
@@ -0,0 +1,104 @@
+#ifndef PLACEMENTS_H
+#define PLACEMENTS_H
+
+#include <bitset>
+#include <cstdint>
+
+#include "structs.h"
+#include "constants.h"
+#include "engine.h"
+
+// How many (rotation, column, line) positions a piece centre can have.
+const int PIECE_POSITIONS = 4 * GAME_BOARD_WIDTH * GAME_BOARD_HEIGHT;
+
+/**
+ * A final resting position of a piece, and the board once the piece has
+ * landed and any filled lines have been cleared.
+ */
+struct Placement {
+  int rotation;
+  int x;
+  int y;
+  int lines_cleared;
+  uint16_t board_rows[GAME_BOARD_HEIGHT];
+};
+
+/**
+ * Finds every final resting position that a piece can reach from a starting
+ * position using the game's moves (left, right, down and clockwise
+ * rotation), including positions only reachable by sliding or rotating a
+ * piece under an overhang. It is a breadth-first search over (rotation, x, y)
+ * states with a visited bitset. All buffers are members, so a search can be
+ * reused for any number of calls without allocating.
+ */
+class PlacementSearch {
+ public:
+  /**
+   * Finds the placements of a piece on the given board. Positions that cover
+   * the same cells are only reported once.
+   * @param board_rows the board, stored as one bitmask per row
+   * @param type the piece type, ranging from 0 to 6
+   * @param rotation the starting rotation
+   * @param x the starting column of the piece centre
+   * @param y the starting line of the piece centre
+   * @return the number of placements found
+   */
+  int find_placements(const uint16_t board_rows[GAME_BOARD_HEIGHT], int type,
+                      int rotation, int x, int y);
+
+  /**
+   * Finds the placements of the falling piece of a game from its current
+   * position, or of the next piece from its spawn position if a new piece has
+   * been requested.
+   * @param game
+   * @return the number of placements found
+   */
+  int find_placements(const GameState &game);
+
+  /**
+   * Gets the shortest sequence of inputs that takes the piece from its
+   * starting position to the given placement. The piece still has to be moved
+   * down once more to land.
+   * @param index the index of the placement
+   * @param inputs filled in with INPUT_ codes
+   * @param max_inputs the size of the inputs array
+   * @return the number of inputs, or -1 if they do not fit in the array
+   */
+  int get_inputs(int index, int inputs[], int max_inputs) const;
+
+  /**
+   * Finds the placement of the last search which covers the same cells as the
+   * piece would at the given position.
+   * @param rotation
+   * @param x the column of the piece centre
+   * @param y the line of the piece centre
+   * @return the index of the placement, or -1 if the piece cannot come to
+   *         rest there
+   */
+  int find_placement(int rotation, int x, int y) const;
+
+  int count; // The number of placements found by the last search.
+  Placement placements[PIECE_POSITIONS];
+
+ private:
+  static int state_index(int rotation, int x, int y) {
+    return (rotation * GAME_BOARD_HEIGHT + y) * GAME_BOARD_WIDTH + x;
+  }
+
+  void visit(int state, int parent, int input);
+
+  std::bitset<PIECE_POSITIONS> visited;
+  // The cells covered by placements already reported.
+  std::bitset<PIECE_POSITIONS> landed;
+  uint16_t queue[PIECE_POSITIONS];
+  int queue_end;
+  // How each visited state was reached, to rebuild input sequences.
+  uint16_t parents[PIECE_POSITIONS];
+  uint8_t parent_inputs[PIECE_POSITIONS];
+  // The state of each placement.
+  uint16_t placement_states[PIECE_POSITIONS];
+  int start_state;
+  int piece_type; // The type of the piece of the last search.
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+#include "profiler.h"
+
+typedef chrono::steady_clock profile_clock;
+
+const char *PHASE_NAMES[PHASE_COUNT] = {
+  "grid", "board", "sidebar", "projection", "blocks", "swap"
+};
+
+const char *get_phase_name(int phase) {
+  return PHASE_NAMES[phase];
+}
+
+/**
+ * Returns the nanoseconds between two points in time.
+ * @param from
+ * @param to
+ * @return
+ */
+static uint64_t get_nanoseconds(profile_clock::time_point from,
+                                profile_clock::time_point to) {
+  return chrono::duration_cast<chrono::nanoseconds>(to - from).count();
+}
+
+FrameProfiler::FrameProfiler()
+    : created(profile_clock::now()), input_waiting(false), frames_written(0) {
+  memset(&current, 0, sizeof(current));
+}
+
+void FrameProfiler::begin_frame() {
+  frame_start = profile_clock::now();
+  memset(&current, 0, sizeof(current));
+  current.start = get_nanoseconds(created, frame_start);
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    current.phase_starts[i] = UINT32_MAX;
+  }
+}
+
+void FrameProfiler::begin_phase(int phase) {
+  phase_start[phase] = profile_clock::now();
+  current.phase_starts[phase] =
+      min(current.phase_starts[phase], get_time_in_frame());
+}
+
+void FrameProfiler::end_phase(int phase) {
+  current.phase_durations[phase] +=
+      get_nanoseconds(phase_start[phase], profile_clock::now());
+}
+
+void FrameProfiler::record_input() {
+  if (!input_waiting) {
+    input_time = profile_clock::now();
+    input_waiting = true;
+  }
+}
+
+void FrameProfiler::end_frame() {
+  profile_clock::time_point now = profile_clock::now();
+  uint64_t written = frames_written.load(memory_order_relaxed);
+
+  current.duration = get_nanoseconds(frame_start, now);
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    if (current.phase_starts[i] == UINT32_MAX) {
+      current.phase_starts[i] = 0;
+    }
+  }
+  if (input_waiting) {
+    current.input_latency = get_nanoseconds(input_time, now);
+    input_waiting = false;
+  }
+  frames[written % PROFILE_FRAMES] = current;
+  frames_written.store(written + 1, memory_order_release);
+}
+
+int FrameProfiler::get_latest_frames(frame_profile latest[],
+                                     int count) const {
+  uint64_t written = frames_written.load(memory_order_acquire);
+  uint64_t first;
+  uint64_t overwritten;
+
+  count = (int)min<uint64_t>(min(count, PROFILE_FRAMES), written);
+  first = written - count;
+  for (int i = 0; i < count; i++) {
+    latest[i] = frames[(first + i) % PROFILE_FRAMES];
+  }
+
+  /**
+   * Frames which the writer has started to overwrite while they were copied
+   * may be torn, so they are dropped.
+   */
+  atomic_thread_fence(memory_order_acquire);
+  written = frames_written.load(memory_order_relaxed) + 1;
+  overwritten = written > PROFILE_FRAMES ? written - PROFILE_FRAMES : 0;
+  if (overwritten > first) {
+    int dropped = (int)min<uint64_t>(overwritten - first, count);
+    memmove(latest, latest + dropped, (count - dropped) * sizeof(latest[0]));
+    count -= dropped;
+  }
+  return count;
+}
+
+bool FrameProfiler::write_csv(FILE *file) const {
+  vector<frame_profile> latest(PROFILE_FRAMES);
+  int count = get_latest_frames(latest.data(), PROFILE_FRAMES);
+
+  fprintf(file, "start,frame");
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    fprintf(file, ",%s", get_phase_name(i));
+  }
+  fprintf(file, ",input_latency\n");
+  for (int k = 0; k < count; k++) {
+    const frame_profile &frame = latest[k];
+    fprintf(file, "%.3f,%.3f", frame.start / 1e3, frame.duration / 1e3);
+    for (int i = 0; i < PHASE_COUNT; i++) {
+      fprintf(file, ",%.3f", frame.phase_durations[i] / 1e3);
+    }
+    fprintf(file, ",%.3f\n", frame.input_latency / 1e3);
+  }
+  return !ferror(file);
+}
+
+bool FrameProfiler::write_trace(FILE *file) const {
+  vector<frame_profile> latest(PROFILE_FRAMES);
+  int count = get_latest_frames(latest.data(), PROFILE_FRAMES);
+  const char *separator = "";
+
+  // Complete events ("X"), with their times in microseconds.
+  fprintf(file, "{\"traceEvents\":[");
+  for (int k = 0; k < count; k++) {
+    const frame_profile &frame = latest[k];
+    fprintf(file, "%s\n{\"name\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+            "\"ts\":%.3f,\"dur\":%.3f}", separator, frame.start / 1e3,
+            frame.duration / 1e3);
+    separator = ",";
+    for (int i = 0; i < PHASE_COUNT; i++) {
+      if (!frame.phase_durations[i]) {
+        continue;
+      }
+      fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+              "\"ts\":%.3f,\"dur\":%.3f}", get_phase_name(i),
+              (frame.start + frame.phase_starts[i]) / 1e3,
+              frame.phase_durations[i] / 1e3);
+    }
+    // The latency is shown on a track of its own, ending with the frame.
+    if (frame.input_latency) {
+      fprintf(file, ",\n{\"name\":\"input latency\",\"ph\":\"X\",\"pid\":1,"
+              "\"tid\":2,\"ts\":%.3f,\"dur\":%.3f}",
+              ((double)frame.start + frame.duration - frame.input_latency) /
+              1e3, frame.input_latency / 1e3);
+    }
+  }
+  fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  return !ferror(file);
+}
+
+uint32_t FrameProfiler::get_time_in_frame() const {
+  return get_nanoseconds(frame_start, profile_clock::now());
+}
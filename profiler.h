@@ -0,0 +1,118 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+// The phases of a frame which are timed.
+const int PHASE_GRID = 0; // display_game_grid()
+const int PHASE_BOARD = 1; // display_game_board()
+const int PHASE_SIDEBAR = 2; // display_game_sidebar()
+const int PHASE_PROJECTION = 3; // display_game_projection()
+const int PHASE_BLOCKS = 4; // Drawing the block batch.
+const int PHASE_SWAP = 5; // glutSwapBuffers()
+const int PHASE_COUNT = 6;
+
+// How many of the latest frames the profiler keeps. A power of two.
+const int PROFILE_FRAMES = 4096;
+
+// The timings of one frame, in nanoseconds.
+struct frame_profile {
+  uint64_t start; // Since the profiler was created.
+  uint32_t duration;
+  // When each phase first started, since the frame started, and how long it
+  // took in total, since a phase can run once per redrawn rectangle.
+  uint32_t phase_starts[PHASE_COUNT];
+  uint32_t phase_durations[PHASE_COUNT];
+  // From the first input handled since the last frame to the end of the
+  // buffer swap, or 0 if there was none.
+  uint32_t input_latency;
+};
+
+/**
+ * Returns the name of a phase, as shown on the overlay and in exports.
+ * @param phase
+ * @return
+ */
+const char *get_phase_name(int phase);
+
+/**
+ * Times the phases of each frame and the latency from input to the buffer
+ * swap which shows it. The frames are kept in a ring buffer which one thread,
+ * the one drawing, writes to, and any thread can read from without locking:
+ * a reader copies the frames it wants, then drops those that the writer may
+ * have overwritten in the meantime.
+ */
+class FrameProfiler {
+ public:
+  FrameProfiler();
+
+  /**
+   * Starts timing a frame.
+   */
+  void begin_frame();
+
+  /**
+   * Starts timing a phase of the current frame.
+   * @param phase one of the PHASE_ values
+   */
+  void begin_phase(int phase);
+
+  /**
+   * Stops timing a phase of the current frame.
+   * @param phase
+   */
+  void end_phase(int phase);
+
+  /**
+   * Records that an input has been handled, unless one is already waiting to
+   * be shown.
+   */
+  void record_input();
+
+  /**
+   * Stops timing the current frame, which should end with the buffer swap,
+   * and adds it to the ring buffer.
+   */
+  void end_frame();
+
+  /**
+   * Copies the latest frames, oldest first.
+   * @param frames filled in with the frames
+   * @param count the most frames to copy
+   * @return the number of frames copied
+   */
+  int get_latest_frames(frame_profile frames[], int count) const;
+
+  /**
+   * Writes the frames kept as CSV, one line per frame, in microseconds.
+   * @param file
+   * @return false if they could not be written
+   */
+  bool write_csv(FILE *file) const;
+
+  /**
+   * Writes the frames kept in the Chrome trace event format, which can be
+   * loaded in chrome://tracing or Perfetto.
+   * @param file
+   * @return false if they could not be written
+   */
+  bool write_trace(FILE *file) const;
+
+ private:
+  uint32_t get_time_in_frame() const;
+
+  std::chrono::steady_clock::time_point created;
+  std::chrono::steady_clock::time_point frame_start;
+  std::chrono::steady_clock::time_point phase_start[PHASE_COUNT];
+  std::chrono::steady_clock::time_point input_time;
+  bool input_waiting;
+  frame_profile current;
+  frame_profile frames[PROFILE_FRAMES];
+  // How many frames have been written to the ring buffer.
+  std::atomic<uint64_t> frames_written;
+};
+
+#endif
@@ -0,0 +1,430 @@
+// Declares the vertex buffer functions, which are core since GL 1.5.
+#define GL_GLEXT_PROTOTYPES
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+#include "renderer.h"
+
+// The corners of the inner square of a block, counter-clockwise.
+const float INNER_CORNERS[4][2] = {
+  {-INNER_BLOCK_SIZE_HALF, INNER_BLOCK_SIZE_HALF},
+  {INNER_BLOCK_SIZE_HALF, INNER_BLOCK_SIZE_HALF},
+  {INNER_BLOCK_SIZE_HALF, -INNER_BLOCK_SIZE_HALF},
+  {-INNER_BLOCK_SIZE_HALF, -INNER_BLOCK_SIZE_HALF}
+};
+
+/**
+ * The four trapeziums that make up the shaded sides of a block, in the order
+ * of their shades: bottom, left, right and top. The parallel sides of each
+ * trapezium are a side of the outer block and the matching inner block side.
+ */
+const float SIDE_CORNERS[4][4][2] = {
+  {{-OUTER_BLOCK_SIZE_HALF, -OUTER_BLOCK_SIZE_HALF},
+   {-INNER_BLOCK_SIZE_HALF, -INNER_BLOCK_SIZE_HALF},
+   {INNER_BLOCK_SIZE_HALF, -INNER_BLOCK_SIZE_HALF},
+   {OUTER_BLOCK_SIZE_HALF, -OUTER_BLOCK_SIZE_HALF}},
+  {{-OUTER_BLOCK_SIZE_HALF, OUTER_BLOCK_SIZE_HALF},
+   {-INNER_BLOCK_SIZE_HALF, INNER_BLOCK_SIZE_HALF},
+   {-INNER_BLOCK_SIZE_HALF, -INNER_BLOCK_SIZE_HALF},
+   {-OUTER_BLOCK_SIZE_HALF, -OUTER_BLOCK_SIZE_HALF}},
+  {{OUTER_BLOCK_SIZE_HALF, -OUTER_BLOCK_SIZE_HALF},
+   {INNER_BLOCK_SIZE_HALF, -INNER_BLOCK_SIZE_HALF},
+   {INNER_BLOCK_SIZE_HALF, INNER_BLOCK_SIZE_HALF},
+   {OUTER_BLOCK_SIZE_HALF, OUTER_BLOCK_SIZE_HALF}},
+  {{OUTER_BLOCK_SIZE_HALF, OUTER_BLOCK_SIZE_HALF},
+   {INNER_BLOCK_SIZE_HALF, INNER_BLOCK_SIZE_HALF},
+   {-INNER_BLOCK_SIZE_HALF, INNER_BLOCK_SIZE_HALF},
+   {-OUTER_BLOCK_SIZE_HALF, OUTER_BLOCK_SIZE_HALF}}
+};
+
+draw_call_counts draw_calls;
+
+/**
+ * Returns a darker shade of the given colour.
+ * @param base_colour
+ * @return a 20% darker shade of the given colour
+ */
+static colour get_darker_shade(colour base_colour) {
+  colour darker_shade = {base_colour.r * 0.8f,
+                         base_colour.g * 0.8f,
+                         base_colour.b * 0.8f};
+  return darker_shade;
+}
+
+/**
+ * Returns a lighter shade of the given colour.
+ * @param base_colour
+ * @return a 20% lighter shade of the given colour
+ */
+static colour get_lighter_shade(colour base_colour) {
+  colour lighter_shade = {min(1.0f, base_colour.r * 1.2f),
+                          min(1.0f, base_colour.g * 1.2f),
+                          min(1.0f, base_colour.b * 1.2f)};
+  return lighter_shade;
+}
+
+/**
+ * Converts a colour to the bytes of a vertex colour.
+ * @param shade
+ * @param bytes filled in with the red, green, blue and alpha bytes
+ */
+static void get_colour_bytes(colour shade, GLubyte bytes[4]) {
+  bytes[0] = (GLubyte)lround(shade.r * 255.0f);
+  bytes[1] = (GLubyte)lround(shade.g * 255.0f);
+  bytes[2] = (GLubyte)lround(shade.b * 255.0f);
+  bytes[3] = 255;
+}
+
+BlockTransform::BlockTransform() {
+  x_axis[0] = 1.0f;
+  x_axis[1] = 0.0f;
+  y_axis[0] = 0.0f;
+  y_axis[1] = 1.0f;
+  origin[0] = 0.0f;
+  origin[1] = 0.0f;
+}
+
+void BlockTransform::translate(float x, float y) {
+  origin[0] += x_axis[0] * x + y_axis[0] * y;
+  origin[1] += x_axis[1] * x + y_axis[1] * y;
+}
+
+void BlockTransform::scale(float x, float y) {
+  x_axis[0] *= x;
+  x_axis[1] *= x;
+  y_axis[0] *= y;
+  y_axis[1] *= y;
+}
+
+void BlockTransform::rotate(float angle) {
+  float radians = angle * (float)M_PI / 180.0f;
+  float c = cosf(radians);
+  float s = sinf(radians);
+  float rotated_x[2] = {x_axis[0] * c + y_axis[0] * s,
+                        x_axis[1] * c + y_axis[1] * s};
+
+  y_axis[0] = y_axis[0] * c - x_axis[0] * s;
+  y_axis[1] = y_axis[1] * c - x_axis[1] * s;
+  x_axis[0] = rotated_x[0];
+  x_axis[1] = rotated_x[1];
+}
+
+BlockBatch::BlockBatch() : use_buffer(false), buffer(0) {
+  colour base_colour;
+
+  pixel_scale[0] = 1.0f;
+  pixel_scale[1] = 1.0f;
+  /**
+   * A block is 5 quads and its frame 4 more. Making room up front means that
+   * drawing a frame does not allocate.
+   */
+  vertices.reserve(RESERVED_BLOCKS * 9 * 4);
+
+  // The shades never change, so they are only computed once.
+  for (int i = 0; i < COLOUR_COUNT; i++) {
+    base_colour = colours[i];
+    get_colour_bytes(base_colour, shades[i][0]);
+    get_colour_bytes(get_darker_shade(base_colour), shades[i][1]);
+    get_colour_bytes(get_darker_shade(get_darker_shade(base_colour)),
+                     shades[i][2]);
+    get_colour_bytes(get_lighter_shade(get_lighter_shade(base_colour)),
+                     shades[i][3]);
+    get_colour_bytes(get_lighter_shade(base_colour), shades[i][4]);
+  }
+}
+
+void BlockBatch::initialise() {
+  int major = 0;
+  int minor = 0;
+  const char *version = (const char *)glGetString(GL_VERSION);
+
+  if (version) {
+    sscanf(version, "%d.%d", &major, &minor);
+  }
+  use_buffer = major > 1 || (major == 1 && minor >= 5);
+  if (use_buffer) {
+    glGenBuffers(1, &buffer);
+  }
+}
+
+void BlockBatch::set_pixel_scale(float x, float y) {
+  pixel_scale[0] = x;
+  pixel_scale[1] = y;
+}
+
+void BlockBatch::add_block(int colour, const BlockTransform &transform) {
+  add_quad(shades[colour][0], transform, INNER_CORNERS);
+  for (int i = 0; i < 4; i++) {
+    add_quad(shades[colour][i + 1], transform, SIDE_CORNERS[i]);
+  }
+  add_frame(shades[BLACK][0], transform);
+}
+
+void BlockBatch::add_block(int colour, float x, float y, float scale) {
+  BlockTransform transform;
+
+  transform.translate(x, y);
+  transform.scale(scale, scale);
+  add_block(colour, transform);
+}
+
+void BlockBatch::add_frame(int colour, float x, float y, float scale) {
+  BlockTransform transform;
+
+  transform.translate(x, y);
+  transform.scale(scale, scale);
+  add_frame(shades[colour][0], transform);
+}
+
+void BlockBatch::add_frame(int colour, const BlockTransform &transform) {
+  add_frame(shades[colour][0], transform);
+}
+
+void BlockBatch::add_piece(int type, float x, float y, float scale) {
+  for (int i = 0; i < 4; i++) {
+    add_block(type + CYAN,
+              x + GAME_PIECES[type * 4 + i][0] * OUTER_BLOCK_SIZE * scale,
+              y + GAME_PIECES[type * 4 + i][1] * OUTER_BLOCK_SIZE * scale,
+              scale);
+  }
+}
+
+void BlockBatch::draw() {
+  if (vertices.empty()) {
+    return;
+  }
+
+  if (use_buffer) {
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    // Replacing the whole buffer lets the driver keep drawing the old one.
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vertex),
+                 vertices.data(), GL_STREAM_DRAW);
+    glInterleavedArrays(GL_C4UB_V2F, 0, NULL);
+  } else {
+    glInterleavedArrays(GL_C4UB_V2F, 0, vertices.data());
+  }
+  glDrawArrays(GL_QUADS, 0, vertices.size());
+  draw_calls.batches++;
+  draw_calls.batch_vertices += vertices.size();
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  if (use_buffer) {
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+  glColor3f(colours[BLACK].r, colours[BLACK].g, colours[BLACK].b);
+
+  vertices.clear();
+}
+
+void BlockBatch::add_quad(const GLubyte colour[4],
+                          const BlockTransform &transform,
+                          const float corners[4][2]) {
+  vertex corner;
+
+  copy(colour, colour + 4, corner.colour);
+  for (int i = 0; i < 4; i++) {
+    corner.position[0] = transform.origin[0] +
+                         transform.x_axis[0] * corners[i][0] +
+                         transform.y_axis[0] * corners[i][1];
+    corner.position[1] = transform.origin[1] +
+                         transform.x_axis[1] * corners[i][0] +
+                         transform.y_axis[1] * corners[i][1];
+    vertices.push_back(corner);
+  }
+}
+
+void BlockBatch::add_frame(const GLubyte colour[4],
+                           const BlockTransform &transform) {
+  /**
+   * The frame is as wide as a line loop would be whatever the scale of the
+   * block, i.e. LINE_WIDTH rounded to whole pixels, so its width is converted
+   * from pixels into block units along each axis.
+   */
+  float half_width = floorf(LINE_WIDTH + 0.5f) * 0.5f;
+  float half_x = half_width / hypotf(transform.x_axis[0] * pixel_scale[0],
+                                     transform.x_axis[1] * pixel_scale[1]);
+  float half_y = half_width / hypotf(transform.y_axis[0] * pixel_scale[0],
+                                     transform.y_axis[1] * pixel_scale[1]);
+  float outer_x = OUTER_BLOCK_SIZE_HALF + half_x;
+  float inner_x = OUTER_BLOCK_SIZE_HALF - half_x;
+  float outer_y = OUTER_BLOCK_SIZE_HALF + half_y;
+  float inner_y = OUTER_BLOCK_SIZE_HALF - half_y;
+  // The top and bottom bars cover the corners; the sides fit between them.
+  const float bars[4][4][2] = {
+    {{-outer_x, outer_y}, {outer_x, outer_y}, {outer_x, inner_y},
+     {-outer_x, inner_y}},
+    {{-outer_x, -inner_y}, {outer_x, -inner_y}, {outer_x, -outer_y},
+     {-outer_x, -outer_y}},
+    {{-outer_x, inner_y}, {-inner_x, inner_y}, {-inner_x, -inner_y},
+     {-outer_x, -inner_y}},
+    {{inner_x, inner_y}, {outer_x, inner_y}, {outer_x, -inner_y},
+     {inner_x, -inner_y}}
+  };
+
+  for (int i = 0; i < 4; i++) {
+    add_quad(colour, transform, bars[i]);
+  }
+}
+
+StaticLayer::StaticLayer() : list(0), cached(false) {
+}
+
+bool StaticLayer::begin() {
+  draw_calls.layers++;
+  if (cached) {
+    glCallList(list);
+    return false;
+  }
+  if (!list) {
+    list = glGenLists(1);
+  }
+  glNewList(list, GL_COMPILE_AND_EXECUTE);
+  return true;
+}
+
+void StaticLayer::end() {
+  glEndList();
+  cached = true;
+}
+
+void StaticLayer::invalidate() {
+  cached = false;
+}
+
+DirtyRegion::DirtyRegion()
+    : added_count(0), previous_count(0), frame_count(0), added_all(true),
+      previous_all(true) {
+  pixel_scale[0] = 1.0f;
+  pixel_scale[1] = 1.0f;
+}
+
+void DirtyRegion::set_viewport(int width, int height) {
+  pixel_scale[0] = width / (float)(DISPLAY_WIDTH - 1);
+  pixel_scale[1] = height / (float)(DISPLAY_HEIGHT - 1);
+}
+
+void DirtyRegion::add(const rectangle &area) {
+  add_to(added, added_count, area);
+}
+
+void DirtyRegion::add_all() {
+  added_all = true;
+}
+
+bool DirtyRegion::is_empty() const {
+  return !added_all && !added_count;
+}
+
+int DirtyRegion::begin_frame() {
+  if (is_empty() || added_all || previous_all) {
+    frame_count = 0;
+    added_all = true;
+    return 1;
+  }
+  frame_count = 0;
+  for (int i = 0; i < previous_count; i++) {
+    add_to(frame, frame_count, previous[i]);
+  }
+  for (int i = 0; i < added_count; i++) {
+    add_to(frame, frame_count, added[i]);
+  }
+  return frame_count;
+}
+
+void DirtyRegion::clip(int index) {
+  if (!frame_count) {
+    glDisable(GL_SCISSOR_TEST);
+    glClear(GL_COLOR_BUFFER_BIT);
+    return;
+  }
+
+  /**
+   * Frames and text lines reach a little past the shapes they outline, so
+   * the rectangle is widened by a line width on each side.
+   */
+  const rectangle &area = frame[index];
+  int margin = (int)ceilf(LINE_WIDTH);
+  int left = (int)floorf(area.left * pixel_scale[0]) - margin;
+  int bottom = (int)floorf(area.bottom * pixel_scale[1]) - margin;
+  int right = (int)ceilf(area.right * pixel_scale[0]) + margin;
+  int top = (int)ceilf(area.top * pixel_scale[1]) + margin;
+
+  glEnable(GL_SCISSOR_TEST);
+  glScissor(left, bottom, right - left, top - bottom);
+  glClear(GL_COLOR_BUFFER_BIT);
+}
+
+void DirtyRegion::end_frame() {
+  glDisable(GL_SCISSOR_TEST);
+  copy(added, added + added_count, previous);
+  previous_count = added_count;
+  previous_all = added_all;
+  added_count = 0;
+  added_all = false;
+}
+
+void DirtyRegion::add_to(rectangle list[], int &count,
+                         const rectangle &area) {
+  if (count < MAX_DIRTY_RECTANGLES) {
+    list[count++] = area;
+    return;
+  }
+  // Merge everything into the first rectangle.
+  for (int i = 1; i < count; i++) {
+    list[0].left = min(list[0].left, list[i].left);
+    list[0].bottom = min(list[0].bottom, list[i].bottom);
+    list[0].right = max(list[0].right, list[i].right);
+    list[0].top = max(list[0].top, list[i].top);
+  }
+  list[0].left = min(list[0].left, area.left);
+  list[0].bottom = min(list[0].bottom, area.bottom);
+  list[0].right = max(list[0].right, area.right);
+  list[0].top = max(list[0].top, area.top);
+  count = 1;
+}
+
+StrokeFont::StrokeFont() : glyph_lists(0) {
+  fill(widths, widths + GLYPH_LISTS, 0.0f);
+}
+
+void StrokeFont::initialise() {
+  glyph_lists = glGenLists(GLYPH_LISTS);
+  for (int i = 0; i < GLYPH_LISTS; i++) {
+    // The bytes without a glyph, e.g. those of UTF-8 names, have empty lists.
+    if (i < GLYPH_COUNT) {
+      widths[i] = glutStrokeWidth(GLUT_STROKE_ROMAN, i);
+    }
+    glNewList(glyph_lists + i, GL_COMPILE);
+      if (i < GLYPH_COUNT) {
+        glutStrokeCharacter(GLUT_STROKE_ROMAN, i);
+      }
+    glEndList();
+  }
+}
+
+float StrokeFont::get_width(const char *text) const {
+  float width = 0.0f;
+
+  for (; *text; text++) {
+    width += widths[(unsigned char)*text];
+  }
+  return width;
+}
+
+void StrokeFont::draw(const char *text) const {
+  if (!glyph_lists) {
+    return;
+  }
+  draw_calls.text++;
+  // Every byte has a list, so none can call a list the font does not own.
+  glPushMatrix();
+    glListBase(glyph_lists);
+    glCallLists(strlen(text), GL_UNSIGNED_BYTE, text);
+  glPopMatrix();
+}
@@ -0,0 +1,304 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+
+#include <cstdint>
+#include <vector>
+
+#include "structs.h"
+#include "constants.h"
+
+// The number of colours in the colours array.
+const int COLOUR_COUNT = sizeof(colours) / sizeof(colours[0]);
+// How many blocks a batch has room for before it has to grow.
+const int RESERVED_BLOCKS = 512;
+// The characters which have glyphs in the stroke font.
+const int GLYPH_COUNT = 128;
+// Every byte a string can hold, each of which has a display list, so that
+// the bytes without a glyph draw nothing.
+const int GLYPH_LISTS = 256;
+// How many rectangles a frame can redraw before they are merged into one.
+const int MAX_DIRTY_RECTANGLES = 8;
+
+/**
+ * How many draw calls each part of the renderer has made, e.g. for the
+ * rendering benchmark. Reset it by assigning an empty struct.
+ */
+struct draw_call_counts {
+  long batches; // Block batches drawn, one glDrawArrays() call each.
+  long batch_vertices; // The vertices of those batches.
+  long layers; // Static layers recorded or replayed, one display list each.
+  long text; // Strings drawn with the stroke font, one glCallLists() each.
+  long shapes; // Shapes drawn in immediate mode, e.g. subscreens.
+};
+
+extern draw_call_counts draw_calls;
+
+/**
+ * A 2D affine transform, which places a block the way glTranslatef(),
+ * glScalef() and glRotatef() would, but on the CPU. Copying a transform takes
+ * the place of glPushMatrix() and glPopMatrix().
+ */
+struct BlockTransform {
+  // Where the local x and y axes and the origin end up on the display.
+  float x_axis[2];
+  float y_axis[2];
+  float origin[2];
+
+  // Starts as the identity transform.
+  BlockTransform();
+
+  void translate(float x, float y);
+  void scale(float x, float y);
+  /**
+   * @param angle the counter-clockwise rotation, in degrees
+   */
+  void rotate(float angle);
+};
+
+/**
+ * Collects the blocks, frames and pieces of a frame into one interleaved
+ * vertex array, and draws them all with a single draw call. The vertices are
+ * uploaded to a vertex buffer object when the GL version has them (1.5 and
+ * later), and drawn from client memory otherwise. Frames are drawn as thin
+ * quads, so that they join the same draw call. Blocks are drawn in the order
+ * they are added, so later blocks cover earlier ones.
+ */
+class BlockBatch {
+ public:
+  BlockBatch();
+
+  /**
+   * Checks whether vertex buffer objects can be used. Must be called once the
+   * GL context has been created.
+   */
+  void initialise();
+
+  /**
+   * Sets how many pixels one display unit covers along each axis, so that
+   * frames stay as wide as a line would be when the window is resized.
+   * @param x
+   * @param y
+   */
+  void set_pixel_scale(float x, float y);
+
+  /**
+   * Adds a block, i.e. a pseudo-3D square with shaded sides and a black
+   * frame, OUTER_BLOCK_SIZE wide before it is transformed.
+   * @param colour the index of the block colour
+   * @param transform
+   */
+  void add_block(int colour, const BlockTransform &transform);
+
+  /**
+   * Adds a block centred at the given point, scaled uniformly.
+   * @param colour the index of the block colour
+   * @param x
+   * @param y
+   * @param scale
+   */
+  void add_block(int colour, float x, float y, float scale);
+
+  /**
+   * Adds the frame of a block on its own, e.g. for the grid or the piece
+   * projection.
+   * @param colour the index of the frame colour
+   * @param x
+   * @param y
+   * @param scale
+   */
+  void add_frame(int colour, float x, float y, float scale);
+
+  /**
+   * Adds the frame of a block on its own, OUTER_BLOCK_SIZE wide before it is
+   * transformed.
+   * @param colour the index of the frame colour
+   * @param transform
+   */
+  void add_frame(int colour, const BlockTransform &transform);
+
+  /**
+   * Adds the blocks of a game piece in its spawn orientation, centred on its
+   * centre block.
+   * @param type the piece type, ranging from 0 to 6
+   * @param x
+   * @param y
+   * @param scale
+   */
+  void add_piece(int type, float x, float y, float scale);
+
+  /**
+   * Draws the blocks added since the last call, and clears them. Leaves the
+   * current colour black, like drawing a block frame last would.
+   */
+  void draw();
+
+ private:
+  // The vertex layout of GL_C4UB_V2F.
+  struct vertex {
+    GLubyte colour[4];
+    GLfloat position[2];
+  };
+
+  void add_quad(const GLubyte colour[4], const BlockTransform &transform,
+                const float corners[4][2]);
+  void add_frame(const GLubyte colour[4], const BlockTransform &transform);
+
+  std::vector<vertex> vertices;
+  bool use_buffer;
+  GLuint buffer;
+  float pixel_scale[2];
+  /**
+   * The shades of each colour: the colour itself, the darker shades of the
+   * bottom and left sides, and the lighter shades of the right and top sides.
+   */
+  GLubyte shades[COLOUR_COUNT][5][4];
+};
+
+/**
+ * A display list which caches the parts of a screen that never change, e.g.
+ * borders, titles and labels, so that they are only drawn from scratch again
+ * when the window is resized. Vertex arrays drawn while recording are copied
+ * into the list, so a BlockBatch can be drawn into it.
+ */
+class StaticLayer {
+ public:
+  StaticLayer();
+
+  /**
+   * Draws the cached layer. If there is none, starts recording a new one
+   * instead: everything drawn until end() is called is both drawn and cached.
+   * @return true if the layer must be drawn, followed by a call to end()
+   */
+  bool begin();
+
+  /**
+   * Stops recording the layer.
+   */
+  void end();
+
+  /**
+   * Discards the cached layer, so that it is recorded again the next time it
+   * is drawn.
+   */
+  void invalidate();
+
+ private:
+  GLuint list;
+  bool cached;
+};
+
+/**
+ * Tracks the rectangles of the display which have changed, so that a frame
+ * only clears and redraws those. The back buffer of a double buffered window
+ * holds the frame before last, so each frame redraws the rectangles changed
+ * since then, i.e. those added for it and for the frame before.
+ */
+class DirtyRegion {
+ public:
+  DirtyRegion();
+
+  /**
+   * Sets the size of the window, which the display is stretched over.
+   * @param width
+   * @param height
+   */
+  void set_viewport(int width, int height);
+
+  /**
+   * Marks a rectangle to be redrawn in the next frame.
+   * @param area in display coordinates
+   */
+  void add(const rectangle &area);
+
+  /**
+   * Marks the whole display to be redrawn in the next frame, e.g. when the
+   * screen changes or the window is resized.
+   */
+  void add_all();
+
+  /**
+   * Returns true if nothing has been marked since the last frame.
+   * @return
+   */
+  bool is_empty() const;
+
+  /**
+   * Starts a frame. If nothing has been marked, the redraw was asked for by
+   * the window system, e.g. when the window was uncovered, so the whole
+   * display is redrawn.
+   * @return the number of rectangles to redraw
+   */
+  int begin_frame();
+
+  /**
+   * Limits drawing to one of the rectangles of the frame, and clears it.
+   * @param index
+   */
+  void clip(int index);
+
+  /**
+   * Ends the frame, and stops limiting drawing to a rectangle.
+   */
+  void end_frame();
+
+ private:
+  /**
+   * Adds a rectangle to a list, merging the list into its bounding box once
+   * it is full.
+   */
+  static void add_to(rectangle list[], int &count, const rectangle &area);
+
+  rectangle added[MAX_DIRTY_RECTANGLES];
+  rectangle previous[MAX_DIRTY_RECTANGLES];
+  rectangle frame[MAX_DIRTY_RECTANGLES];
+  int added_count;
+  int previous_count;
+  int frame_count;
+  // True if the whole display is marked.
+  bool added_all;
+  bool previous_all;
+  float pixel_scale[2];
+};
+
+/**
+ * Caches the GLUT stroke font: each glyph is tessellated once into a display
+ * list of its own, which also advances to the next glyph, and the width of
+ * each glyph is looked up once. A string is then drawn with one glCallLists()
+ * call, and measured by adding up the cached widths.
+ */
+class StrokeFont {
+ public:
+  StrokeFont();
+
+  /**
+   * Builds the glyph display lists. Must be called once the GL context has
+   * been created.
+   */
+  void initialise();
+
+  /**
+   * Returns the width of a string, in stroke font units.
+   * @param text
+   * @return
+   */
+  float get_width(const char *text) const;
+
+  /**
+   * Draws a string from the current position, which is left unchanged. Does
+   * nothing if the font has not been initialised.
+   * @param text
+   */
+  void draw(const char *text) const;
+
+ private:
+  GLuint glyph_lists;
+  float widths[GLYPH_LISTS];
+};
+
+#endif
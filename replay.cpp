@@ -0,0 +1,195 @@
+using namespace std;
+
+#include "replay.h"
+
+// The bytes which start every replay file.
+const uint8_t REPLAY_MAGIC[3] = {'T', 'R', 'P'};
+// The tick count which means a varint with the remaining ticks follows.
+const int LONG_TICKS = 31;
+
+bool write_replay_header(FILE *file) {
+  uint8_t header[4] = {REPLAY_MAGIC[0], REPLAY_MAGIC[1], REPLAY_MAGIC[2],
+                       REPLAY_VERSION};
+
+  return fwrite(header, 1, sizeof(header), file) == sizeof(header);
+}
+
+ReplayRecorder::ReplayRecorder() : last_tick(0) {
+}
+
+void ReplayRecorder::begin_game(const replay_game &game) {
+  write_varint(game.seed);
+  bytes.push_back(game.difficulty);
+  bytes.push_back(game.generator_mode);
+  last_tick = 0;
+}
+
+void ReplayRecorder::record(long tick, int code) {
+  write_event(tick, code);
+}
+
+void ReplayRecorder::record_placement(long tick, int rotation, int x, int y) {
+  int position = rotation | x << 2 | y << 6;
+
+  write_event(tick, REPLAY_PLACE);
+  bytes.push_back(position & 0xff);
+  bytes.push_back(position >> 8);
+}
+
+void ReplayRecorder::end_game(long tick, const GameState &game) {
+  write_event(tick, REPLAY_END);
+  write_varint(game.score);
+  write_varint(game.pieces_spawned);
+}
+
+bool ReplayRecorder::write_replay(FILE *file) {
+  bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+
+  bytes.clear();
+  return written;
+}
+
+void ReplayRecorder::write_event(long tick, int code) {
+  long ticks = tick - last_tick;
+
+  last_tick = tick;
+  if (ticks < LONG_TICKS) {
+    bytes.push_back(code | ticks << 3);
+  } else {
+    bytes.push_back(code | LONG_TICKS << 3);
+    write_varint(ticks - LONG_TICKS);
+  }
+}
+
+void ReplayRecorder::write_varint(uint64_t value) {
+  for (; value >= 0x80; value >>= 7) {
+    bytes.push_back(value | 0x80);
+  }
+  bytes.push_back(value);
+}
+
+ReplayReader::ReplayReader(FILE *file) : file(file), tick(0) {
+}
+
+bool ReplayReader::read_header() {
+  uint8_t header[4];
+
+  return fread(header, 1, sizeof(header), file) == sizeof(header) &&
+         header[0] == REPLAY_MAGIC[0] && header[1] == REPLAY_MAGIC[1] &&
+         header[2] == REPLAY_MAGIC[2] && header[3] == REPLAY_VERSION;
+}
+
+bool ReplayReader::read_game(replay_game &game) {
+  int difficulty;
+  int generator_mode;
+
+  if (!read_varint(game.seed)) {
+    return false;
+  }
+  difficulty = getc(file);
+  generator_mode = getc(file);
+  if (difficulty < 1 || difficulty > MAX_DIFFICULTY ||
+      (generator_mode != UNIFORM_PIECES && generator_mode != BAG_PIECES)) {
+    return false;
+  }
+  game.difficulty = difficulty;
+  game.generator_mode = generator_mode;
+  tick = 0;
+  return true;
+}
+
+bool ReplayReader::read_event(replay_event &event) {
+  int byte = getc(file);
+  uint64_t ticks;
+  uint64_t value;
+  int low;
+  int high;
+
+  if (byte == EOF) {
+    return false;
+  }
+  event.code = byte & 7;
+  ticks = byte >> 3;
+  if (ticks == LONG_TICKS) {
+    if (!read_varint(value)) {
+      return false;
+    }
+    ticks += value;
+  }
+  tick += ticks;
+  event.tick = tick;
+
+  if (event.code == REPLAY_PLACE) {
+    low = getc(file);
+    high = getc(file);
+    if (low == EOF || high == EOF) {
+      return false;
+    }
+    event.rotation = low & 3;
+    event.x = low >> 2 & 15;
+    event.y = (low >> 6 | high << 2);
+    return event.x < GAME_BOARD_WIDTH && event.y < GAME_BOARD_HEIGHT;
+  }
+  if (event.code == REPLAY_END) {
+    if (!read_varint(value)) {
+      return false;
+    }
+    event.score = value;
+    if (!read_varint(value)) {
+      return false;
+    }
+    event.pieces_spawned = value;
+  }
+  return true;
+}
+
+bool ReplayReader::read_varint(uint64_t &value) {
+  int byte;
+
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    byte = getc(file);
+    if (byte == EOF) {
+      return false;
+    }
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void start_replay_game(GameState &state, const replay_game &game) {
+  state.initialise(game.difficulty, game.seed, game.generator_mode);
+}
+
+bool apply_replay_event(GameState &state, const replay_event &event,
+                        PlacementSearch &search) {
+  switch (event.code) {
+    case REPLAY_GRAVITY:
+      state.move_piece(0);
+      break;
+    case REPLAY_PLACE:
+      if (state.new_piece) {
+        break;
+      }
+      // The piece has to be able to reach the position from where it is.
+      search.find_placements(state);
+      if (search.find_placement(event.rotation, event.x, event.y) < 0) {
+        return false;
+      }
+      state.place_piece(event.rotation, event.x, event.y);
+      break;
+    case REPLAY_END:
+      break;
+    default:
+      state.apply_input(event.code);
+  }
+  return true;
+}
+
+bool is_replay_verified(const GameState &state, const replay_event &event) {
+  return state.score == event.score &&
+         state.pieces_spawned == event.pieces_spawned;
+}
@@ -0,0 +1,183 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "structs.h"
+#include "constants.h"
+#include "engine.h"
+#include "placements.h"
+
+/**
+ * Replay events. Codes 0 to 4 are the INPUT_ codes; the rest are only found
+ * in replays.
+ */
+const int REPLAY_GRAVITY = 5; // The falling piece is lowered by gravity.
+const int REPLAY_PLACE = 6; // The falling piece lands at a given position.
+const int REPLAY_END = 7; // The game ends, with its final score.
+
+/**
+ * The replay format, which can be written and read as a stream:
+ *
+ *   file:  'T' 'R' 'P' REPLAY_VERSION, then any number of games
+ *   game:  varint seed, difficulty byte, generator mode byte, then events
+ *          up to and including REPLAY_END
+ *   event: one byte with the code in the low 3 bits and the number of ticks
+ *          since the previous event in the high 5 bits. A tick count of 31
+ *          means that a varint with the remaining ticks follows.
+ *          REPLAY_PLACE is followed by two bytes holding the rotation, x and
+ *          y; REPLAY_END by varints holding the score and the number of
+ *          pieces spawned, so that replays can be verified.
+ *
+ * Varints are stored 7 bits per byte, lowest first, with the top bit set on
+ * every byte but the last. A bot game takes four bytes per piece: a
+ * placement and the move down which spawns the next piece.
+ */
+const int REPLAY_VERSION = 1;
+
+// The settings a replayed game starts from.
+struct replay_game {
+  uint64_t seed;
+  int difficulty;
+  int generator_mode;
+};
+
+// One event read from a replay.
+struct replay_event {
+  long tick; // The time of the event since the game started, in ticks.
+  int code;
+  // The position of a REPLAY_PLACE event.
+  int rotation;
+  int x;
+  int y;
+  // The final score and number of pieces spawned of a REPLAY_END event.
+  int score;
+  int pieces_spawned;
+};
+
+/**
+ * Writes the header which starts every replay file.
+ * @param file
+ * @return false if it could not be written
+ */
+bool write_replay_header(FILE *file);
+
+/**
+ * Encodes the games played into a buffer of replay bytes, which can then be
+ * written out with write_replay(), e.g. once each game is over.
+ */
+class ReplayRecorder {
+ public:
+  ReplayRecorder();
+
+  /**
+   * Starts recording a game, from tick 0.
+   * @param game the settings the game starts from
+   */
+  void begin_game(const replay_game &game);
+
+  /**
+   * Records an input or a gravity step.
+   * @param tick
+   * @param code one of the INPUT_ codes or REPLAY_GRAVITY
+   */
+  void record(long tick, int code);
+
+  /**
+   * Records a piece landing at the given position, i.e. a place_piece() call.
+   * @param tick
+   * @param rotation
+   * @param x
+   * @param y
+   */
+  void record_placement(long tick, int rotation, int x, int y);
+
+  /**
+   * Records the end of a game.
+   * @param tick
+   * @param game the game, for its score and number of pieces spawned
+   */
+  void end_game(long tick, const GameState &game);
+
+  /**
+   * Writes the recorded bytes to a file and clears them.
+   * @param file
+   * @return false if they could not be written
+   */
+  bool write_replay(FILE *file);
+
+  // The recorded bytes which have not been written yet.
+  std::vector<uint8_t> bytes;
+
+ private:
+  void write_event(long tick, int code);
+  void write_varint(uint64_t value);
+
+  long last_tick;
+};
+
+/**
+ * Decodes a replay file one game and one event at a time.
+ */
+class ReplayReader {
+ public:
+  explicit ReplayReader(FILE *file);
+
+  /**
+   * Reads and checks the header which starts every replay file.
+   * @return false if the file is not a replay of a supported version
+   */
+  bool read_header();
+
+  /**
+   * Reads the settings of the next game.
+   * @param game filled in with the settings
+   * @return false at the end of the file, or if the file is truncated
+   */
+  bool read_game(replay_game &game);
+
+  /**
+   * Reads the next event of the current game.
+   * @param event filled in with the event
+   * @return false if the file is truncated or corrupt
+   */
+  bool read_event(replay_event &event);
+
+ private:
+  bool read_varint(uint64_t &value);
+
+  FILE *file;
+  long tick;
+};
+
+/**
+ * Starts a game from the settings of a replay.
+ * @param state
+ * @param game
+ */
+void start_replay_game(GameState &state, const replay_game &game);
+
+/**
+ * Applies an event to a game, the same way as it was applied when recorded.
+ * REPLAY_END does not change the game.
+ * @param state
+ * @param event
+ * @param search used to find where the falling piece can land
+ * @return false if the event is a placement which the falling piece cannot
+ *         reach from where it is, or would not rest at, which only a corrupt
+ *         or forged replay holds
+ */
+bool apply_replay_event(GameState &state, const replay_event &event,
+                        PlacementSearch &search);
+
+/**
+ * Returns true if a game matches the end of its replay.
+ * @param state
+ * @param event a REPLAY_END event
+ * @return
+ */
+bool is_replay_verified(const GameState &state, const replay_event &event);
+
+#endif
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <type_traits>
+
+using namespace std;
+
+#include "rollback.h"
+
+static_assert(is_trivially_copyable<VersusMatch>::value,
+              "Matches are snapshot and restored by copying them.");
+
+void RollbackSession::start(uint64_t seed, int difficulty, int local_player,
+                            int input_delay) {
+  this->local_player = local_player;
+  this->input_delay = max(0, min(input_delay, MAX_INPUT_DELAY));
+  match.start(seed, difficulty);
+  frame = 0;
+  next_local_frame = 0;
+  remote_frame = 0;
+  acked_frame = 0;
+  rollback_frame = -1;
+  rollbacks = 0;
+  resimulated_frames = 0;
+  max_rollback = 0;
+  stalls = 0;
+}
+
+int RollbackSession::add_local_input(int input) {
+  int first = frame + input_delay;
+
+  if (input < INPUT_LEFT || input > INPUT_DROP) {
+    return -1;
+  }
+  /**
+   * The frames skipped since the last input had none. Only those which can
+   * still be simulated again or sent are marked.
+   */
+  if (next_local_frame < first) {
+    for (int f = max(next_local_frame,
+                     min(acked_frame, frame - MAX_ROLLBACK_FRAMES));
+         f < first; f++) {
+      inputs[local_player][f % INPUT_FRAMES] = NO_INPUT;
+    }
+    next_local_frame = first;
+  }
+  if (next_local_frame >= first + MAX_QUEUED_INPUTS) {
+    return -1;
+  }
+  inputs[local_player][next_local_frame % INPUT_FRAMES] = input;
+  return next_local_frame++;
+}
+
+void RollbackSession::receive(const rollback_packet &packet) {
+  int remote_player = 1 - local_player;
+  // Further frames could overwrite inputs which are still needed.
+  int end = min(packet.end_frame, frame + INPUT_FRAMES - MAX_ROLLBACK_FRAMES);
+
+  acked_frame = max(acked_frame, min(packet.ack_frame, frame + input_delay));
+  if (packet.first_frame > remote_frame || end <= remote_frame) {
+    return;
+  }
+  for (int f = remote_frame; f < end; f++) {
+    inputs[remote_player][f % INPUT_FRAMES] = NO_INPUT;
+  }
+  for (int i = 0; i < packet.event_count && i < MAX_PACKET_FRAMES; i++) {
+    int f = packet.first_frame + packet.events[i].offset;
+    int input = packet.events[i].input;
+
+    if (f < remote_frame || f >= end || input > INPUT_DROP) {
+      continue;
+    }
+    inputs[remote_player][f % INPUT_FRAMES] = input;
+    // The frame was simulated with no input predicted for it.
+    if (f < frame && (rollback_frame < 0 || f < rollback_frame)) {
+      rollback_frame = f;
+    }
+  }
+  remote_frame = end;
+}
+
+void RollbackSession::make_packet(rollback_packet &packet) const {
+  int end = min(frame + input_delay, acked_frame + MAX_PACKET_FRAMES);
+
+  packet.ack_frame = remote_frame;
+  packet.first_frame = acked_frame;
+  packet.end_frame = end;
+  packet.event_count = 0;
+  for (int f = acked_frame; f < min(end, next_local_frame); f++) {
+    int input = inputs[local_player][f % INPUT_FRAMES];
+
+    if (input != NO_INPUT) {
+      rollback_event &event = packet.events[packet.event_count++];
+      event.offset = f - acked_frame;
+      event.input = input;
+    }
+  }
+}
+
+void RollbackSession::synchronise() {
+  int frames;
+
+  if (rollback_frame < 0) {
+    return;
+  }
+  frames = frame - rollback_frame;
+  match = snapshots[rollback_frame % MAX_ROLLBACK_FRAMES];
+  for (int f = rollback_frame; f < frame; f++) {
+    simulate(f);
+  }
+  rollbacks++;
+  resimulated_frames += frames;
+  max_rollback = max(max_rollback, frames);
+  rollback_frame = -1;
+}
+
+bool RollbackSession::advance() {
+  synchronise();
+  if (frame - remote_frame >= MAX_ROLLBACK_FRAMES) {
+    stalls++;
+    return false;
+  }
+  simulate(frame);
+  frame++;
+  return true;
+}
+
+/**
+ * Keeps a snapshot of the match, then simulates a frame with the inputs
+ * known for it, or none where they are not.
+ * @param simulated_frame
+ */
+void RollbackSession::simulate(int simulated_frame) {
+  int slot = simulated_frame % INPUT_FRAMES;
+  int played[2];
+
+  snapshots[simulated_frame % MAX_ROLLBACK_FRAMES] = match;
+  played[local_player] = simulated_frame < next_local_frame ?
+      inputs[local_player][slot] : NO_INPUT;
+  played[1 - local_player] = simulated_frame < remote_frame ?
+      inputs[1 - local_player][slot] : NO_INPUT;
+  for (int p = 0; p < 2; p++) {
+    if (played[p] != NO_INPUT) {
+      match.apply_input(p, played[p]);
+    }
+  }
+  match.step(TICK_LENGTH);
+}
@@ -0,0 +1,146 @@
+#ifndef ROLLBACK_H
+#define ROLLBACK_H
+
+#include <cstdint>
+
+#include "versus.h"
+
+// A frame in which a player made no input.
+const int NO_INPUT = -1;
+// How many frames a session may run ahead of the inputs it has received.
+const int MAX_ROLLBACK_FRAMES = 128;
+// The longest input delay a session can have, in frames.
+const int MAX_INPUT_DELAY = 16;
+// How many local inputs can wait for a frame of their own.
+const int MAX_QUEUED_INPUTS = 32;
+// How many frames of inputs the sessions keep, which covers every frame
+// either of them can still need.
+const int INPUT_FRAMES = 512;
+// The most frames of inputs a packet holds.
+const int MAX_PACKET_FRAMES = 255;
+
+// An input made in a frame, within a packet.
+struct rollback_event {
+  uint8_t offset; // The frame of the input, from the first of the packet.
+  uint8_t input;
+};
+
+/**
+ * What one peer sends the other, every frame or so: its inputs for every
+ * frame from the first the other has not acknowledged to the last it has
+ * decided, so that a lost packet is made up for by the next one. Frames with
+ * no input are left out.
+ */
+struct rollback_packet {
+  int32_t ack_frame; // How many frames of the receiver's inputs the sender has.
+  int32_t first_frame;
+  int32_t end_frame; // The frame after the last one the packet covers.
+  int event_count;
+  rollback_event events[MAX_PACKET_FRAMES];
+};
+
+/**
+ * Plays one side of a versus match against a remote peer, without waiting
+ * for the peer's inputs. Both peers simulate the whole match, a frame of one
+ * tick at a time, from the same seed.
+ *
+ * Local inputs are scheduled a few frames ahead, the input delay, so that
+ * they usually reach the peer before it simulates their frame. Remote inputs
+ * which have not arrived are predicted to be none, since inputs are single
+ * key presses rather than held buttons. The match is copied before every
+ * frame is simulated, so when a remote input arrives for a frame which has
+ * been simulated without it, the copy from that frame is restored and the
+ * frames since are simulated again, before the next one is. A session which
+ * gets MAX_ROLLBACK_FRAMES ahead of the remote inputs it has stalls, i.e.
+ * falls back to lock-step, until more arrive. The copies take about 175 KB,
+ * so sessions are best allocated with new.
+ */
+class RollbackSession {
+ public:
+  /**
+   * Starts a match.
+   * @param seed the seed of the match, the same on both peers
+   * @param difficulty
+   * @param local_player which player this peer plays, 0 or 1
+   * @param input_delay how many frames local inputs are scheduled ahead, up
+   *        to MAX_INPUT_DELAY
+   */
+  void start(uint64_t seed, int difficulty, int local_player,
+             int input_delay);
+
+  /**
+   * Schedules a local input for the first frame at least the input delay
+   * ahead which has none yet.
+   * @param input one of the INPUT_ codes
+   * @return the frame it is scheduled for, or -1 if too many are queued
+   */
+  int add_local_input(int input);
+
+  /**
+   * Takes a packet from the peer, which may arrive late, twice or out of
+   * order. Any frames it shows were mispredicted are simulated again by the
+   * next call to synchronise() or advance().
+   * @param packet
+   */
+  void receive(const rollback_packet &packet);
+
+  /**
+   * Fills in the packet to send to the peer.
+   * @param packet
+   */
+  void make_packet(rollback_packet &packet) const;
+
+  /**
+   * Simulates again the frames which were mispredicted, if any.
+   */
+  void synchronise();
+
+  /**
+   * Synchronises, then simulates the next frame.
+   * @return false if the session has stalled, waiting for remote inputs
+   */
+  bool advance();
+
+  /**
+   * Returns the match as of the current frame, predicted where remote inputs
+   * are missing, to be drawn.
+   * @return
+   */
+  const VersusMatch &get_match() const {
+    return match;
+  }
+
+  // The number of frames simulated.
+  int get_frame() const {
+    return frame;
+  }
+
+  // The number of frames whose inputs are all known.
+  int get_confirmed_frame() const {
+    return frame < remote_frame ? frame : remote_frame;
+  }
+
+  // How many times the match has been rolled back, and by how many frames.
+  long rollbacks;
+  long resimulated_frames;
+  int max_rollback;
+  long stalls; // How many calls to advance() stalled.
+
+ private:
+  void simulate(int simulated_frame);
+
+  int local_player;
+  int input_delay;
+  VersusMatch match;
+  int frame;
+  // The match before each of the latest frames, by frame modulo the count.
+  VersusMatch snapshots[MAX_ROLLBACK_FRAMES];
+  // Each player's input in each frame, by frame modulo the count.
+  int8_t inputs[2][INPUT_FRAMES];
+  int next_local_frame; // The frame the next local input goes in.
+  int remote_frame; // How many frames of remote inputs have arrived.
+  int acked_frame; // How many frames of local inputs the peer has.
+  int rollback_frame; // The first mispredicted frame, or -1 if none.
+};
+
+#endif
@@ -0,0 +1,365 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+#include "bot.h"
+#include "engine.h"
+#include "replay.h"
+#include "thread_pool.h"
+
+// How many games each chunk of work contains.
+const long GAMES_PER_CHUNK = 16;
+/**
+ * How many games a batch plays unless told otherwise. A bot game searches
+ * every piece up to the piece cap, so far fewer are played to finish in
+ * seconds too.
+ */
+const long DEFAULT_GAMES = 100000;
+const long DEFAULT_BOT_GAMES = 20;
+
+// Options for a batch of games, set from the command line.
+struct batch_options {
+  long games;
+  int threads;
+  uint64_t seed;
+  int difficulty;
+  int max_pieces;
+  int generator_mode;
+  bool bot; // True to place pieces with the bot instead of at random.
+  int beam_width;
+  const char *record_path; // The file to record replays to, or NULL.
+  const char *replay_path; // The file to verify replays from, or NULL.
+};
+
+// Per-worker counters. Padded to a cache line to avoid false sharing.
+struct alignas(64) worker_stats {
+  long placements;
+};
+
+/**
+ * Applies an input to a game, and records it if the game is being recorded.
+ * @param game
+ * @param input one of the INPUT_ codes
+ * @param recorder the game's recorder, or NULL
+ */
+void play_input(GameState &game, int input, ReplayRecorder *recorder) {
+  game.apply_input(input);
+  if (recorder) {
+    recorder->record(0, input);
+  }
+}
+
+/**
+ * Places the current piece at a random rotation and column, and drops it.
+ * @param game
+ * @param random the policy's random number generator
+ * @param recorder the game's recorder, or NULL
+ */
+void play_random_piece(GameState &game, PieceGenerator &random,
+    ReplayRecorder *recorder) {
+  int rotations = random.next_below(4);
+  int shift = (int)random.next_below(GAME_BOARD_WIDTH) - GAME_BOARD_WIDTH / 2;
+  int direction = shift < 0 ? -1 : 1;
+
+  for (int i = 0; i < rotations; i++) {
+    play_input(game, INPUT_ROTATE, recorder);
+  }
+  for (int i = 0; i != shift; i += direction) {
+    play_input(game, direction < 0 ? INPUT_LEFT : INPUT_RIGHT, recorder);
+  }
+  play_input(game, INPUT_DROP, recorder);
+}
+
+/**
+ * Places the current piece where the bot chooses.
+ * @param game
+ * @param bot
+ * @param recorder the game's recorder, or NULL
+ */
+void play_bot_piece(GameState &game, Bot &bot, ReplayRecorder *recorder) {
+  int choice = bot.choose_placement(game);
+
+  if (choice >= 0) {
+    const Placement &placement = bot.placements().placements[choice];
+    game.place_piece(placement.rotation, placement.x, placement.y);
+    if (recorder) {
+      recorder->record_placement(0, placement.rotation, placement.x,
+                                 placement.y);
+    }
+  }
+}
+
+/**
+ * Plays a whole game, and returns its score.
+ * @param index the index of the game in the batch, used to derive its seeds
+ * @param options
+ * @param bot the bot placing the pieces, or NULL to place them at random
+ * @param recorder records the game if not NULL
+ * @param placements incremented for every piece placed
+ * @return
+ */
+int play_game(long index, const batch_options &options, Bot *bot,
+    ReplayRecorder *recorder, long &placements) {
+  uint64_t seed = mix_seed(options.seed + index);
+  PieceGenerator policy_random;
+  GameState game;
+
+  policy_random.seed(mix_seed(seed), UNIFORM_PIECES);
+  game.initialise(options.difficulty, seed, options.generator_mode);
+  if (recorder) {
+    replay_game settings = {seed, options.difficulty, options.generator_mode};
+    recorder->begin_game(settings);
+  }
+  // Spawn the first piece.
+  play_input(game, INPUT_DOWN, recorder);
+  while (!game.game_over && game.pieces_spawned <= options.max_pieces) {
+    if (bot) {
+      play_bot_piece(game, *bot, recorder);
+    } else {
+      play_random_piece(game, policy_random, recorder);
+    }
+    placements++;
+    // Clear lines and spawn the next piece.
+    play_input(game, INPUT_DOWN, recorder);
+  }
+  if (recorder) {
+    recorder->end_game(0, game);
+  }
+  return game.score;
+}
+
+/**
+ * Re-simulates every game in a replay file as fast as possible, and checks
+ * that each one ends with its recorded score.
+ * @param path
+ * @return the process exit code
+ */
+int verify_replays(const char *path) {
+  FILE *file = fopen(path, "rb");
+  GameState game;
+  replay_game settings;
+  replay_event event;
+  long games = 0;
+  long failed = 0;
+  long events = 0;
+  bool ended;
+
+  if (!file) {
+    fprintf(stderr, "Cannot open %s\n", path);
+    return 1;
+  }
+  ReplayReader reader(file);
+  if (!reader.read_header()) {
+    fprintf(stderr, "%s is not a replay file\n", path);
+    fclose(file);
+    return 1;
+  }
+
+  PlacementSearch *search = new PlacementSearch();
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  while (reader.read_game(settings)) {
+    start_replay_game(game, settings);
+    ended = false;
+    while (!ended && reader.read_event(event) &&
+           apply_replay_event(game, event, *search)) {
+      ended = event.code == REPLAY_END;
+      events++;
+    }
+    if (!ended) {
+      fprintf(stderr, "%s is truncated or corrupt in game %ld\n", path,
+              games);
+      failed++;
+      break;
+    }
+    if (!is_replay_verified(game, event)) {
+      fprintf(stderr, "game %ld: recorded score %d, replayed score %d\n",
+              games, event.score, game.score);
+      failed++;
+    }
+    games++;
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  delete search;
+  fclose(file);
+
+  printf("games: %ld\n", games);
+  printf("failed: %ld\n", failed);
+  printf("seconds: %.3f\n", elapsed.count());
+  printf("games/sec: %.0f\n", games / elapsed.count());
+  printf("events/sec: %.0f\n", events / elapsed.count());
+  return failed ? 1 : 0;
+}
+
+/**
+ * Prints how to use the program.
+ * @param program
+ */
+void print_usage(const char *program) {
+  fprintf(stderr, "Usage: %s [--games N] [--threads N] [--seed N] "
+          "[--difficulty N] [--max-pieces N] [--bag] [--bot] [--beam N] "
+          "[--record FILE]\n       %s --replay FILE\n", program, program);
+}
+
+/**
+ * Reads the options from the command line.
+ * @param argc
+ * @param argv
+ * @param options filled in with the options read
+ * @return false if the command line is invalid
+ */
+bool read_options(int argc, char *argv[], batch_options &options) {
+  options.games = 0;
+  options.threads = 0;
+  options.seed = 1;
+  options.difficulty = 1;
+  options.max_pieces = 1000;
+  options.generator_mode = UNIFORM_PIECES;
+  options.bot = false;
+  options.beam_width = 8;
+  options.record_path = NULL;
+  options.replay_path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--bag")) {
+      options.generator_mode = BAG_PIECES;
+      continue;
+    }
+    if (!strcmp(argv[i], "--bot")) {
+      options.bot = true;
+      continue;
+    }
+    if (i + 1 == argc) {
+      return false;
+    }
+    if (!strcmp(argv[i], "--games")) {
+      options.games = atol(argv[++i]);
+    } else if (!strcmp(argv[i], "--threads")) {
+      options.threads = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--seed")) {
+      options.seed = strtoull(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "--difficulty")) {
+      options.difficulty = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--max-pieces")) {
+      options.max_pieces = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--beam")) {
+      options.beam_width = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--record")) {
+      options.record_path = argv[++i];
+    } else if (!strcmp(argv[i], "--replay")) {
+      options.replay_path = argv[++i];
+    } else {
+      return false;
+    }
+  }
+  if (!options.games) {
+    options.games = options.bot ? DEFAULT_BOT_GAMES : DEFAULT_GAMES;
+  }
+  return options.games > 0 && options.threads >= 0 &&
+         options.difficulty >= 1 && options.difficulty <= MAX_DIFFICULTY &&
+         options.max_pieces > 0 && options.beam_width > 0;
+}
+
+/**
+ * Prints the throughput and the score distribution of a finished batch.
+ * @param options
+ * @param scores the score of each game, sorted in ascending order
+ * @param placements the total number of pieces placed
+ * @param threads the number of workers used
+ * @param seconds the time taken by the batch
+ */
+void print_report(const batch_options &options, const vector<int> &scores,
+    long placements, int threads, double seconds) {
+  double mean = 0.0;
+  // The percentiles of the score distribution that are reported.
+  int percentiles[] = {10, 25, 50, 75, 90, 99};
+
+  for (size_t i = 0; i < scores.size(); i++) {
+    mean += scores[i];
+  }
+  mean /= scores.size();
+
+  printf("games: %ld\n", options.games);
+  printf("threads: %d\n", threads);
+  printf("seconds: %.3f\n", seconds);
+  printf("games/sec: %.0f\n", options.games / seconds);
+  printf("placements/sec: %.0f\n", placements / seconds);
+  printf("placements/game: %.2f\n", (double)placements / options.games);
+  printf("score min: %d\n", scores.front());
+  printf("score mean: %.2f\n", mean);
+  for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+    printf("score p%d: %d\n", percentiles[i],
+           scores[(scores.size() - 1) * percentiles[i] / 100]);
+  }
+  printf("score max: %d\n", scores.back());
+}
+
+int main(int argc, char *argv[]) {
+  batch_options options;
+
+  if (!read_options(argc, argv, options)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  if (options.replay_path) {
+    return verify_replays(options.replay_path);
+  }
+
+  FILE *record_file = NULL;
+  if (options.record_path) {
+    record_file = fopen(options.record_path, "wb");
+    if (!record_file || !write_replay_header(record_file)) {
+      fprintf(stderr, "Cannot write %s\n", options.record_path);
+      return 1;
+    }
+  }
+
+  ThreadPool pool(options.threads);
+  vector<int> scores(options.games);
+  vector<worker_stats> stats(pool.size());
+  // Each worker has its own bot, which searches on the worker's thread.
+  vector<Bot *> bots(pool.size(), (Bot *)NULL);
+  // Each worker records its games, which are written out as they finish.
+  vector<ReplayRecorder> recorders(record_file ? pool.size() : 0);
+  mutex record_lock;
+  long placements = 0;
+
+  for (size_t i = 0; options.bot && i < bots.size(); i++) {
+    bots[i] = new Bot(NULL, options.beam_width);
+  }
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  pool.parallel_for(options.games, GAMES_PER_CHUNK,
+      [&](long begin, long end, int worker) {
+    ReplayRecorder *recorder = record_file ? &recorders[worker] : NULL;
+    for (long i = begin; i < end; i++) {
+      scores[i] = play_game(i, options, bots[worker], recorder,
+                            stats[worker].placements);
+    }
+    if (recorder) {
+      lock_guard<mutex> guard(record_lock);
+      recorder->write_replay(record_file);
+    }
+  });
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  if (record_file && fclose(record_file)) {
+    fprintf(stderr, "Cannot write %s\n", options.record_path);
+    return 1;
+  }
+
+  for (size_t i = 0; i < stats.size(); i++) {
+    placements += stats[i].placements;
+    delete bots[i];
+  }
+  sort(scores.begin(), scores.end());
+  print_report(options, scores, placements, pool.size(), elapsed.count());
+
+  return 0;
+}
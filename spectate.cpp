@@ -0,0 +1,329 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#include "bot.h"
+#include "engine.h"
+#include "spectator.h"
+
+// How many games are printed side by side.
+const int GAMES_PER_ROW = 8;
+// How often a live stream is printed, in ticks.
+const int PRINT_INTERVAL = 50;
+
+// Options for playing or watching a broadcast, set from the command line.
+struct spectate_options {
+  int bots; // How many bot games to broadcast, or 0 to watch a stream.
+  const char *broadcast_target;
+  long ticks;
+  uint64_t seed;
+  int keyframe_interval;
+  bool realtime;
+  const char *source; // The stream to watch.
+  long seek_tick; // The tick to print the games at, or -1 to follow.
+  bool quiet;
+};
+
+// A bot game of the lobby, stepped like a board of the multi-board mode.
+struct lobby_game {
+  GameState game;
+  int slept; // The time since the piece was last lowered, in microseconds.
+  BotPlayer player;
+};
+
+/**
+ * Starts a new game in a lobby.
+ * @param lobby
+ * @param seed
+ */
+void start_game(lobby_game &lobby, uint64_t seed) {
+  lobby.game.initialise(1, seed);
+  lobby.slept = 0;
+  lobby.player.reset();
+}
+
+/**
+ * Plays bot games and broadcasts them, starting each game again once it is
+ * over, as on a lobby screen.
+ * @param options
+ * @return the exit status
+ */
+int broadcast_bots(const spectate_options &options) {
+  vector<lobby_game> lobby(options.bots);
+  const GameState *games[MAX_SPECTATED_GAMES];
+  SpectatorWriter writer;
+  Bot bot;
+  uint64_t seed = options.seed;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  double seconds;
+
+  if (!writer.open(options.broadcast_target, options.bots,
+                   options.keyframe_interval)) {
+    perror("Cannot open the broadcast");
+    return 1;
+  }
+  for (int i = 0; i < options.bots; i++) {
+    start_game(lobby[i], seed++);
+    games[i] = &lobby[i].game;
+  }
+
+  for (long tick = 0; !options.ticks || tick < options.ticks; tick++) {
+    for (int i = 0; i < options.bots; i++) {
+      lobby_game &current = lobby[i];
+
+      if (current.game.game_over) {
+        start_game(current, seed++);
+        continue;
+      }
+      current.player.tick(current.game, bot);
+      current.slept += TICK_LENGTH;
+      if (current.slept >= current.game.get_gravity_interval()) {
+        current.game.move_piece(0);
+        current.slept = 0;
+      }
+    }
+    if (!writer.write_tick(tick, games)) {
+      perror("Cannot write the broadcast");
+      return 1;
+    }
+    if (options.realtime) {
+      this_thread::sleep_until(start +
+                               chrono::microseconds((tick + 1) * TICK_LENGTH));
+    }
+  }
+  seconds = chrono::duration<double>(chrono::steady_clock::now() -
+                                     start).count();
+  if (!writer.close()) {
+    perror("Cannot write the broadcast index");
+    return 1;
+  }
+
+  // The report goes to the standard error, in case the stream is on stdout.
+  fprintf(stderr, "games: %d\n", options.bots);
+  fprintf(stderr, "ticks: %ld\n", options.ticks);
+  fprintf(stderr, "seconds: %.3f\n", seconds);
+  fprintf(stderr, "records: %ld\n", writer.records_written);
+  fprintf(stderr, "bytes: %ld\n", writer.bytes_written);
+  fprintf(stderr, "bytes/tick: %.2f\n",
+          (double)writer.bytes_written / options.ticks);
+  return 0;
+}
+
+/**
+ * Prints the games of a stream as text, side by side: occupied cells as #,
+ * the falling piece as @, with each game's score above it.
+ * @param reader
+ */
+void print_games(const SpectatorReader &reader) {
+  printf("tick %ld\n", reader.get_tick());
+  for (int first = 0; first < reader.get_game_count();
+       first += GAMES_PER_ROW) {
+    int last = min(first + GAMES_PER_ROW, reader.get_game_count());
+    char line[GAME_BOARD_WIDTH + 1];
+
+    for (int i = first; i < last; i++) {
+      const remote_game &game = reader.get_game(i);
+      printf("%-8d%-4s%s", game.score, game.game_over ? "over" : "",
+             i + 1 < last ? "  " : "\n");
+    }
+    for (int y = GAME_BOARD_HEIGHT - 1; y >= 0; y--) {
+      for (int i = first; i < last; i++) {
+        const remote_game &game = reader.get_game(i);
+
+        for (int x = 0; x < GAME_BOARD_WIDTH; x++) {
+          line[x] = game.board_rows[y] >> x & 1 ? '#' : '.';
+        }
+        line[GAME_BOARD_WIDTH] = '\0';
+        if (game.has_piece) {
+          const piece_orientation &orientation =
+              get_piece_orientation(game.piece_type, game.piece_rotation);
+
+          for (int b = 0; b < 4; b++) {
+            int block_x = game.piece_x + orientation.blocks[b][0];
+            int block_y = game.piece_y + orientation.blocks[b][1];
+
+            if (block_y == y && block_x >= 0 && block_x < GAME_BOARD_WIDTH) {
+              line[block_x] = '@';
+            }
+          }
+        }
+        printf("|%s|%s", line, i + 1 < last ? "  " : "\n");
+      }
+    }
+  }
+}
+
+/**
+ * Watches a stream: prints the games at a tick of a file, or follows the
+ * stream to its end, printing the games as they change, then reports how
+ * many bytes it took.
+ * @param options
+ * @return the exit status
+ */
+int watch_stream(const spectate_options &options) {
+  SpectatorReader reader;
+  long records = 0;
+  long keyframes = 0;
+  long keyframe_bytes = 0;
+  long first_tick = -1;
+  long printed_tick = -1;
+  int type;
+
+  if (!reader.open(options.source)) {
+    fprintf(stderr, "Cannot read the stream %s\n", options.source);
+    return 1;
+  }
+  if (options.seek_tick >= 0) {
+    if (!reader.seek(options.seek_tick)) {
+      fprintf(stderr, "Cannot seek to tick %ld\n", options.seek_tick);
+      return 1;
+    }
+    print_games(reader);
+    return 0;
+  }
+
+  for (;;) {
+    long bytes = reader.bytes_read;
+
+    type = reader.read_record();
+    if (type <= 0) {
+      break;
+    }
+    records++;
+    if (type == RECORD_KEYFRAME) {
+      keyframes++;
+      keyframe_bytes += reader.bytes_read - bytes;
+    }
+    if (!reader.is_synced()) {
+      continue;
+    }
+    if (first_tick < 0) {
+      first_tick = reader.get_tick();
+    }
+    if (!options.quiet && reader.get_tick() - printed_tick >= PRINT_INTERVAL) {
+      // The games are printed over the last ones.
+      printf("\033[H\033[2J");
+      print_games(reader);
+      fflush(stdout);
+      printed_tick = reader.get_tick();
+    }
+  }
+  if (type < 0) {
+    fprintf(stderr, "The stream is truncated or corrupt\n");
+    return 1;
+  }
+  if (!reader.is_synced()) {
+    fprintf(stderr, "The stream has no keyframe\n");
+    return 1;
+  }
+  if (!options.quiet) {
+    printf("\033[H\033[2J");
+  }
+  print_games(reader);
+
+  long ticks = reader.get_tick() - first_tick + 1;
+  printf("records: %ld\n", records);
+  printf("bytes: %ld\n", reader.bytes_read);
+  printf("bytes/tick: %.2f\n", (double)reader.bytes_read / ticks);
+  // A keyframe holds every game whole, as a full dump of each tick would.
+  if (keyframes) {
+    printf("keyframe bytes: %.0f\n", (double)keyframe_bytes / keyframes);
+    printf("saving over full frames: %.1fx\n",
+           (double)keyframe_bytes / keyframes * ticks / reader.bytes_read);
+  }
+  return 0;
+}
+
+/**
+ * Prints how to use the program.
+ * @param program
+ */
+void print_usage(const char *program) {
+  fprintf(stderr, "Usage: %s --bots N --broadcast TARGET [--ticks N] "
+          "[--seed N] [--keyframe-interval N] [--realtime]\n"
+          "       %s [--seek TICK] [--quiet] STREAM\n"
+          "TARGET and STREAM are - for stdout or stdin, unix:PATH for a "
+          "Unix socket,\nor a file.\n", program, program);
+}
+
+/**
+ * Reads the options from the command line.
+ * @param argc
+ * @param argv
+ * @param options filled in with the options read
+ * @return false if the command line is invalid
+ */
+bool read_options(int argc, char *argv[], spectate_options &options) {
+  options.bots = 0;
+  options.broadcast_target = NULL;
+  options.ticks = 60000;
+  options.seed = 1;
+  options.keyframe_interval = DEFAULT_KEYFRAME_INTERVAL;
+  options.realtime = false;
+  options.source = NULL;
+  options.seek_tick = -1;
+  options.quiet = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--realtime")) {
+      options.realtime = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "--quiet")) {
+      options.quiet = true;
+      continue;
+    }
+    if (argv[i][0] != '-' || !strcmp(argv[i], "-")) {
+      options.source = argv[i];
+      continue;
+    }
+    if (i + 1 == argc) {
+      return false;
+    }
+    if (!strcmp(argv[i], "--bots")) {
+      options.bots = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--broadcast")) {
+      options.broadcast_target = argv[++i];
+    } else if (!strcmp(argv[i], "--ticks")) {
+      options.ticks = atol(argv[++i]);
+    } else if (!strcmp(argv[i], "--seed")) {
+      options.seed = strtoull(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "--keyframe-interval")) {
+      options.keyframe_interval = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--seek")) {
+      options.seek_tick = atol(argv[++i]);
+    } else {
+      return false;
+    }
+  }
+  if (options.bots) {
+    return options.bots > 0 && options.bots <= MAX_SPECTATED_GAMES &&
+           options.broadcast_target && !options.source &&
+           options.ticks >= 0 && options.keyframe_interval > 0;
+  }
+  return options.source && !options.broadcast_target;
+}
+
+/**
+ * Broadcasts bot games to spectators, e.g. for lobby screens, or watches a
+ * broadcast, live or from a file.
+ */
+int main(int argc, char *argv[]) {
+  spectate_options options;
+
+  if (!read_options(argc, argv, options)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  if (options.bots) {
+    return broadcast_bots(options);
+  }
+  return watch_stream(options);
+}
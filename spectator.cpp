@@ -0,0 +1,624 @@
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "spectator.h"
+
+// The bytes which start every spectator stream.
+const uint8_t SPECTATOR_MAGIC[3] = {'T', 'S', 'S'};
+// The largest record body a reader accepts.
+const uint32_t MAX_RECORD_SIZE = 1 << 24;
+
+/**
+ * Appends a number to a buffer, little endian.
+ * @param buffer
+ * @param value
+ * @param size the number of bytes it takes
+ */
+static void put_number(vector<uint8_t> &buffer, uint64_t value, int size) {
+  for (int i = 0; i < size; i++) {
+    buffer.push_back(value >> i * 8);
+  }
+}
+
+/**
+ * Reads a little endian number.
+ * @param data
+ * @param size the number of bytes it takes
+ * @return
+ */
+static uint64_t get_number(const uint8_t *data, int size) {
+  uint64_t value = 0;
+
+  for (int i = size - 1; i >= 0; i--) {
+    value = value << 8 | data[i];
+  }
+  return value;
+}
+
+/**
+ * Writes a whole buffer to a descriptor, waiting for it if need be.
+ * @param descriptor
+ * @param data
+ * @param size
+ * @return false if it could not all be written
+ */
+static bool write_fully(int descriptor, const uint8_t *data, size_t size) {
+  while (size) {
+    ssize_t written = write(descriptor, data, size);
+
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+/**
+ * Fills in the address of a Unix socket.
+ * @param path
+ * @param address
+ * @return false if the path is too long
+ */
+static bool get_unix_address(const char *path, struct sockaddr_un &address) {
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  strcpy(address.sun_path, path);
+  return true;
+}
+
+SpectatorWriter::SpectatorWriter()
+    : bytes_written(0), records_written(0), descriptor(-1), seekable(false),
+      listener(-1), game_count(0), keyframe_interval(0), last_keyframe(-1) {
+}
+
+SpectatorWriter::~SpectatorWriter() {
+  close();
+}
+
+bool SpectatorWriter::open(const char *target, int game_count,
+                           int keyframe_interval) {
+  const size_t prefix_size = sizeof(UNIX_TARGET_PREFIX) - 1;
+  struct stat status;
+
+  close();
+  if (game_count < 1 || game_count > MAX_SPECTATED_GAMES ||
+      keyframe_interval < 1) {
+    errno = EINVAL;
+    return false;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  if (!strcmp(target, "-")) {
+    descriptor = dup(STDOUT_FILENO);
+  } else if (!strncmp(target, UNIX_TARGET_PREFIX, prefix_size)) {
+    struct sockaddr_un address;
+
+    if (!get_unix_address(target + prefix_size, address) ||
+        (listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+      return false;
+    }
+    // A socket left behind by a writer which did not close is replaced.
+    unlink(address.sun_path);
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) ||
+        listen(listener, SOMAXCONN) ||
+        fcntl(listener, F_SETFL, O_NONBLOCK)) {
+      ::close(listener);
+      listener = -1;
+      return false;
+    }
+    socket_path = address.sun_path;
+  } else {
+    descriptor = ::open(target, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  }
+  if (descriptor < 0 && listener < 0) {
+    return false;
+  }
+
+  this->game_count = game_count;
+  this->keyframe_interval = keyframe_interval;
+  last_keyframe = -1;
+  keyframes.clear();
+  for (int i = 0; i < game_count; i++) {
+    forget_game(known[i]);
+  }
+  memset(header, 0, sizeof(header));
+  memcpy(header, SPECTATOR_MAGIC, sizeof(SPECTATOR_MAGIC));
+  header[3] = SPECTATOR_VERSION;
+  header[4] = game_count;
+  for (int i = 0; i < 4; i++) {
+    header[8 + i] = (uint32_t)TICK_LENGTH >> i * 8;
+    header[12 + i] = (uint32_t)keyframe_interval >> i * 8;
+  }
+  bytes_written = SPECTATOR_HEADER_SIZE;
+  records_written = 0;
+
+  if (descriptor >= 0) {
+    seekable = !fstat(descriptor, &status) && S_ISREG(status.st_mode);
+    if (!write_fully(descriptor, header, sizeof(header))) {
+      close();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SpectatorWriter::write_tick(long tick, const GameState *const games[]) {
+  bool written;
+
+  if (!is_open()) {
+    return false;
+  }
+  if (last_keyframe < 0 || tick - last_keyframe >= keyframe_interval) {
+    if (seekable) {
+      keyframes.push_back(make_pair((uint32_t)tick, (uint64_t)bytes_written));
+    }
+    append_keyframe(tick, games, known);
+    last_keyframe = tick;
+  } else {
+    uint8_t message[MAX_MESSAGE_SIZE];
+
+    begin_record(RECORD_TICK);
+    put_number(record, tick, 4);
+    for (int i = 0; i < game_count; i++) {
+      int size = encode_delta(i, *games[i], 0, ALL_ROWS, known[i], message);
+
+      record.insert(record.end(), message, message + size);
+    }
+    end_record();
+    // Nothing changed, so the tick needs no record.
+    if (record.size() == RECORD_HEADER_SIZE + 4) {
+      accept_viewers(tick, games);
+      return true;
+    }
+  }
+  written = broadcast();
+  accept_viewers(tick, games);
+  return written;
+}
+
+bool SpectatorWriter::close() {
+  bool written = true;
+
+  if (descriptor >= 0) {
+    if (seekable) {
+      uint64_t offset = bytes_written;
+
+      begin_record(RECORD_INDEX);
+      put_number(record, keyframes.size(), 4);
+      for (size_t i = 0; i < keyframes.size(); i++) {
+        put_number(record, keyframes[i].first, 4);
+        put_number(record, keyframes[i].second, 8);
+      }
+      put_number(record, offset, 8);
+      end_record();
+      written = broadcast();
+    }
+    written = !::close(descriptor) && written;
+    descriptor = -1;
+  }
+  for (size_t i = 0; i < viewers.size(); i++) {
+    ::close(viewers[i].descriptor);
+  }
+  viewers.clear();
+  if (listener >= 0) {
+    ::close(listener);
+    unlink(socket_path.c_str());
+    listener = -1;
+  }
+  seekable = false;
+  return written;
+}
+
+/**
+ * Starts a record in the record buffer, leaving its size to end_record().
+ * @param type
+ */
+void SpectatorWriter::begin_record(int type) {
+  record.clear();
+  record.push_back(type);
+  put_number(record, 0, 4);
+}
+
+/**
+ * Fills in the size of the record in the record buffer.
+ */
+void SpectatorWriter::end_record() {
+  uint32_t size = record.size() - RECORD_HEADER_SIZE;
+
+  for (int i = 0; i < 4; i++) {
+    record[1 + i] = size >> i * 8;
+  }
+}
+
+/**
+ * Writes a keyframe of the games into the record buffer.
+ * @param tick
+ * @param games
+ * @param known what is known of each game, which is forgotten so that the
+ *        keyframe holds the whole of it, then updated to match
+ */
+void SpectatorWriter::append_keyframe(long tick,
+                                      const GameState *const games[],
+                                      remote_game known[]) {
+  uint8_t message[MAX_MESSAGE_SIZE];
+
+  begin_record(RECORD_KEYFRAME);
+  put_number(record, tick, 4);
+  for (int i = 0; i < game_count; i++) {
+    int size;
+
+    forget_game(known[i]);
+    size = encode_delta(i, *games[i], 0, ALL_ROWS, known[i], message);
+    record.insert(record.end(), message, message + size);
+  }
+  end_record();
+}
+
+/**
+ * Sends bytes to a viewer without waiting, keeping those which cannot be
+ * sent yet behind any already waiting.
+ * @param target
+ * @param data
+ * @param size
+ * @return false if the viewer has gone, or fallen too far behind
+ */
+bool SpectatorWriter::send_to(viewer &target, const uint8_t *data,
+                              size_t size) {
+  vector<uint8_t> &backlog = target.backlog;
+
+  if (!backlog.empty()) {
+    ssize_t sent = send(target.descriptor, backlog.data(), backlog.size(), 0);
+
+    if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      return false;
+    }
+    if (sent > 0) {
+      backlog.erase(backlog.begin(), backlog.begin() + sent);
+    }
+  }
+  if (backlog.empty() && size) {
+    ssize_t sent = send(target.descriptor, data, size, 0);
+
+    if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      return false;
+    }
+    if (sent > 0) {
+      data += sent;
+      size -= sent;
+    }
+  }
+  backlog.insert(backlog.end(), data, data + size);
+  return backlog.size() <= (size_t)MAX_VIEWER_BACKLOG;
+}
+
+/**
+ * Writes the record in the record buffer to the file or pipe, and sends it
+ * to every viewer, disconnecting those which cannot take it.
+ * @return false if it could not be written to the file or pipe
+ */
+bool SpectatorWriter::broadcast() {
+  bool written = descriptor < 0 ||
+      write_fully(descriptor, record.data(), record.size());
+
+  for (size_t i = 0; i < viewers.size();) {
+    if (send_to(viewers[i], record.data(), record.size())) {
+      i++;
+      continue;
+    }
+    ::close(viewers[i].descriptor);
+    viewers[i] = viewers.back();
+    viewers.pop_back();
+  }
+  bytes_written += record.size();
+  records_written++;
+  return written;
+}
+
+/**
+ * Lets in the viewers waiting to connect to the socket, and sends each the
+ * header and a keyframe of the games as they are.
+ * @param tick
+ * @param games
+ */
+void SpectatorWriter::accept_viewers(long tick,
+                                     const GameState *const games[]) {
+  remote_game joined[MAX_SPECTATED_GAMES];
+  bool keyframe_ready = false;
+  int accepted;
+
+  if (listener < 0) {
+    return;
+  }
+  while ((accepted = accept(listener, NULL, NULL)) >= 0) {
+    viewer joining;
+
+    joining.descriptor = accepted;
+    if (fcntl(accepted, F_SETFL, O_NONBLOCK)) {
+      ::close(accepted);
+      continue;
+    }
+    // The keyframe leaves what is known of the games as it was.
+    if (!keyframe_ready) {
+      append_keyframe(tick, games, joined);
+      keyframe_ready = true;
+    }
+    if (!send_to(joining, header, sizeof(header)) ||
+        !send_to(joining, record.data(), record.size())) {
+      ::close(accepted);
+      continue;
+    }
+    viewers.push_back(joining);
+  }
+}
+
+SpectatorReader::SpectatorReader()
+    : bytes_read(0), file(NULL), game_count(0), keyframe_interval(0),
+      tick(0), synced(false) {
+}
+
+SpectatorReader::~SpectatorReader() {
+  close();
+}
+
+bool SpectatorReader::open(const char *source) {
+  const size_t prefix_size = sizeof(UNIX_TARGET_PREFIX) - 1;
+  uint8_t header[SPECTATOR_HEADER_SIZE];
+
+  close();
+  if (!strcmp(source, "-")) {
+    file = fdopen(dup(STDIN_FILENO), "rb");
+  } else if (!strncmp(source, UNIX_TARGET_PREFIX, prefix_size)) {
+    struct sockaddr_un address;
+    int descriptor;
+
+    if (!get_unix_address(source + prefix_size, address) ||
+        (descriptor = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+      return false;
+    }
+    if (connect(descriptor, (struct sockaddr *)&address, sizeof(address)) ||
+        !(file = fdopen(descriptor, "rb"))) {
+      ::close(descriptor);
+      return false;
+    }
+  } else {
+    file = fopen(source, "rb");
+  }
+  if (!file) {
+    return false;
+  }
+
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+      memcmp(header, SPECTATOR_MAGIC, sizeof(SPECTATOR_MAGIC)) ||
+      header[3] != SPECTATOR_VERSION || header[4] < 1 ||
+      header[4] > MAX_SPECTATED_GAMES) {
+    close();
+    errno = EINVAL;
+    return false;
+  }
+  game_count = header[4];
+  keyframe_interval = get_number(header + 12, 4);
+  tick = 0;
+  synced = false;
+  bytes_read = sizeof(header);
+  keyframes.clear();
+  return true;
+}
+
+void SpectatorReader::close() {
+  if (file) {
+    fclose(file);
+    file = NULL;
+  }
+}
+
+int SpectatorReader::read_record() {
+  int type;
+  int result = read_body(type);
+
+  if (result <= 0) {
+    return result;
+  }
+  return apply_record(type) ? type : -1;
+}
+
+bool SpectatorReader::seek(long tick) {
+  size_t k;
+
+  if (!file || (keyframes.empty() && !read_index())) {
+    return false;
+  }
+  // The last keyframe at or before the tick.
+  for (k = keyframes.size(); k > 0 && keyframes[k - 1].first > tick; k--) {
+  }
+  if (!k || fseeko(file, keyframes[k - 1].second, SEEK_SET)) {
+    return false;
+  }
+  synced = false;
+  for (;;) {
+    off_t offset = ftello(file);
+    int type;
+    int result = read_body(type);
+
+    if (!result) {
+      break;
+    }
+    /**
+     * The record after the tick is left to be read next, as is one cut
+     * short, which may be being written.
+     */
+    if (result > 0 && (type == RECORD_TICK || type == RECORD_KEYFRAME) &&
+        body.size() >= 4 && (long)get_number(body.data(), 4) > tick) {
+      // Nothing changed between the last record applied and the tick.
+      this->tick = tick;
+      fseeko(file, offset, SEEK_SET);
+      break;
+    }
+    if (result < 0) {
+      fseeko(file, offset, SEEK_SET);
+      break;
+    }
+    if (!apply_record(type)) {
+      return false;
+    }
+  }
+  return synced;
+}
+
+/**
+ * Loads the keyframe offsets from the index at the end of a file, or, if
+ * it has none, e.g. because it is still being written, by scanning the
+ * record headers.
+ * @return false if the stream cannot seek, or has no keyframes
+ */
+bool SpectatorReader::read_index() {
+  uint8_t bytes[8];
+  off_t end;
+
+  keyframes.clear();
+  if (fseeko(file, 0, SEEK_END) || (end = ftello(file)) < 0) {
+    return false;
+  }
+  if (end >= SPECTATOR_HEADER_SIZE + RECORD_HEADER_SIZE + 4 + 8 &&
+      !fseeko(file, end - 8, SEEK_SET) && fread(bytes, 1, 8, file) == 8) {
+    uint64_t offset = get_number(bytes, 8);
+    int type;
+
+    if (offset >= (uint64_t)SPECTATOR_HEADER_SIZE && offset < (uint64_t)end &&
+        !fseeko(file, offset, SEEK_SET) && read_body(type) > 0 &&
+        type == RECORD_INDEX && ftello(file) == end && body.size() >= 12) {
+      uint64_t count = get_number(body.data(), 4);
+
+      if (body.size() == 4 + count * 12 + 8) {
+        for (uint64_t i = 0; i < count; i++) {
+          const uint8_t *entry = body.data() + 4 + i * 12;
+          keyframes.push_back(make_pair((uint32_t)get_number(entry, 4),
+                                        get_number(entry + 4, 8)));
+        }
+        return !keyframes.empty();
+      }
+    }
+  }
+
+  if (fseeko(file, SPECTATOR_HEADER_SIZE, SEEK_SET)) {
+    return false;
+  }
+  for (;;) {
+    off_t offset = ftello(file);
+    uint8_t record_header[RECORD_HEADER_SIZE + 4];
+    uint32_t size;
+
+    if (fread(record_header, 1, RECORD_HEADER_SIZE, file) !=
+        RECORD_HEADER_SIZE) {
+      break;
+    }
+    size = get_number(record_header + 1, 4);
+    // A record cut short, being written, ends the scan.
+    if (offset + RECORD_HEADER_SIZE + (off_t)size > end) {
+      break;
+    }
+    if (record_header[0] == RECORD_KEYFRAME && size >= 4) {
+      if (fread(record_header + RECORD_HEADER_SIZE, 1, 4, file) != 4) {
+        break;
+      }
+      keyframes.push_back(make_pair(
+          (uint32_t)get_number(record_header + RECORD_HEADER_SIZE, 4),
+          (uint64_t)offset));
+    }
+    if (fseeko(file, offset + RECORD_HEADER_SIZE + size, SEEK_SET)) {
+      break;
+    }
+  }
+  return !keyframes.empty();
+}
+
+/**
+ * Reads the next record's body.
+ * @param type filled in with the record type
+ * @return 1 if a record was read, 0 at the end of the stream, or -1 if it
+ *         is truncated or the record is too large
+ */
+int SpectatorReader::read_body(int &type) {
+  uint8_t record_header[RECORD_HEADER_SIZE];
+  size_t got = fread(record_header, 1, sizeof(record_header), file);
+  uint32_t size;
+
+  if (!got) {
+    return 0;
+  }
+  if (got != sizeof(record_header)) {
+    return -1;
+  }
+  type = record_header[0];
+  size = get_number(record_header + 1, 4);
+  if (size > MAX_RECORD_SIZE) {
+    return -1;
+  }
+  body.resize(size);
+  if (fread(body.data(), 1, size, file) != size) {
+    return -1;
+  }
+  bytes_read += sizeof(record_header) + size;
+  return 1;
+}
+
+/**
+ * Applies the record just read to the games. Records of types which are
+ * not known are skipped.
+ * @param type
+ * @return false if the record is malformed
+ */
+bool SpectatorReader::apply_record(int type) {
+  const uint8_t *data;
+  int size;
+
+  if (type != RECORD_TICK && type != RECORD_KEYFRAME) {
+    return true;
+  }
+  if (body.size() < 4) {
+    return false;
+  }
+  data = body.data() + 4;
+  size = body.size() - 4;
+  tick = get_number(body.data(), 4);
+  if (type == RECORD_KEYFRAME) {
+    for (int i = 0; i < game_count; i++) {
+      forget_game(games[i]);
+    }
+    synced = true;
+  }
+  if (!synced) {
+    return true;
+  }
+  while (size > 0) {
+    int message_type;
+    const uint8_t *payload;
+    int payload_size;
+    int message_size = read_message(data, size, message_type, payload,
+                                    payload_size);
+
+    if (message_size <= 0 || message_type != MESSAGE_DELTA ||
+        !apply_delta(payload, payload_size, games, game_count)) {
+      return false;
+    }
+    data += message_size;
+    size -= message_size;
+  }
+  return true;
+}
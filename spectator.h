@@ -0,0 +1,213 @@
+#ifndef SPECTATOR_H
+#define SPECTATOR_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "versus.h"
+
+// The most games a stream can hold.
+const int MAX_SPECTATED_GAMES = 64;
+// How often keyframes are written by default, in ticks.
+const int DEFAULT_KEYFRAME_INTERVAL = 1000;
+// The most bytes a viewer can have waiting to be sent to it.
+const int MAX_VIEWER_BACKLOG = 1 << 20;
+// The prefix of a target which is a Unix socket.
+const char UNIX_TARGET_PREFIX[] = "unix:";
+
+/**
+ * Spectator stream records. Each starts with a type byte and 4 bytes of
+ * body size.
+ *
+ *   RECORD_TICK: 4 bytes of tick, then a MESSAGE_DELTA for each game which
+ *                changed, its index being that of the game. Ticks in which
+ *                no game changed have no record.
+ *   RECORD_KEYFRAME: 4 bytes of tick, then a MESSAGE_DELTA for every game,
+ *                    holding the whole game, so a viewer can start from it.
+ *   RECORD_INDEX: 4 bytes of count, then for each keyframe its tick and the
+ *                 8 byte offset of its record, then the 8 byte offset of the
+ *                 index record itself.
+ *
+ * The stream starts with a 16 byte header: 'T' 'S' 'S' SPECTATOR_VERSION,
+ * the number of games, 3 reserved bytes, then the tick length in
+ * microseconds and the keyframe interval in ticks, 4 bytes each. Numbers are
+ * little endian. A stream written to a file ends with an index record, so
+ * that the last 8 bytes of the file locate it.
+ */
+const int SPECTATOR_VERSION = 1;
+const int RECORD_TICK = 1;
+const int RECORD_KEYFRAME = 2;
+const int RECORD_INDEX = 3;
+const int SPECTATOR_HEADER_SIZE = 16;
+const int RECORD_HEADER_SIZE = 5;
+
+/**
+ * Broadcasts games to spectators as a stream of deltas, so that viewers can
+ * show them live, or seek within a recording, without simulating them.
+ *
+ * The target is "-" for the standard output, e.g. a pipe, "unix:PATH" to
+ * listen on a Unix socket which any number of viewers can connect to, or
+ * the path of a file. A viewer which connects is sent the header and a
+ * keyframe of the games as they are, then every record after it. A viewer
+ * which falls more than MAX_VIEWER_BACKLOG bytes behind is disconnected, so
+ * that it cannot hold up the games; writes to a pipe or a file block.
+ *
+ * Each tick, every line of each game is compared with what the viewers
+ * know of it, so the games' own change flags are left to the frontend.
+ */
+class SpectatorWriter {
+ public:
+  SpectatorWriter();
+  ~SpectatorWriter();
+
+  /**
+   * Opens a stream, and writes its header. SIGPIPE is ignored from then on,
+   * so that a viewer which goes away shows as a failed write.
+   * @param target "-", "unix:PATH" or the path of a file
+   * @param game_count how many games the stream holds, up to
+   *        MAX_SPECTATED_GAMES
+   * @param keyframe_interval how often keyframes are written, in ticks
+   * @return false if the target could not be opened
+   */
+  bool open(const char *target, int game_count,
+            int keyframe_interval = DEFAULT_KEYFRAME_INTERVAL);
+
+  /**
+   * Writes the changes to the games since the last tick, or a keyframe every
+   * keyframe interval, and lets in any viewers waiting to connect.
+   * @param tick the time of the games, in ticks, which never goes back
+   * @param games the games, as many as the stream holds
+   * @return false if the stream could not be written
+   */
+  bool write_tick(long tick, const GameState *const games[]);
+
+  /**
+   * Writes the index to a file, and closes the stream.
+   * @return false if the index could not be written
+   */
+  bool close();
+
+  bool is_open() const {
+    return descriptor >= 0 || listener >= 0;
+  }
+
+  /**
+   * How many bytes of header and records the stream has taken, counted once
+   * however many viewers it is sent to.
+   */
+  long bytes_written;
+  long records_written;
+
+ private:
+  struct viewer {
+    int descriptor;
+    std::vector<uint8_t> backlog; // Bytes which could not be sent yet.
+  };
+
+  void begin_record(int type);
+  void end_record();
+  void append_keyframe(long tick, const GameState *const games[],
+                       remote_game known[]);
+  bool send_to(viewer &target, const uint8_t *data, size_t size);
+  bool broadcast();
+  void accept_viewers(long tick, const GameState *const games[]);
+
+  int descriptor; // The file or pipe written to, or -1.
+  bool seekable; // True if it is a regular file, which gets an index.
+  int listener; // The Unix socket viewers connect to, or -1.
+  std::string socket_path;
+  std::vector<viewer> viewers;
+  int game_count;
+  int keyframe_interval;
+  long last_keyframe; // The tick of the last keyframe, or -1.
+  uint8_t header[SPECTATOR_HEADER_SIZE];
+  std::vector<uint8_t> record; // The record being written.
+  // The ticks and offsets of the keyframes written to the file.
+  std::vector<std::pair<uint32_t, uint64_t> > keyframes;
+  // What the records written so far have told the viewers of each game.
+  remote_game known[MAX_SPECTATED_GAMES];
+};
+
+/**
+ * Reads a spectator stream, rebuilding the games from its records. The
+ * records before the first keyframe are skipped, since the games they
+ * change are not known.
+ */
+class SpectatorReader {
+ public:
+  SpectatorReader();
+  ~SpectatorReader();
+
+  /**
+   * Opens a stream and reads its header.
+   * @param source "-" for the standard input, "unix:PATH" to connect to a
+   *        writer's socket, or the path of a file
+   * @return false if it could not be opened, or is not a spectator stream
+   */
+  bool open(const char *source);
+
+  void close();
+
+  /**
+   * Reads the next record and applies it to the games, waiting for it if
+   * the stream is live.
+   * @return the RECORD_ type of the record, 0 at the end of the stream, or
+   *         -1 if the stream is truncated or corrupt
+   */
+  int read_record();
+
+  /**
+   * Moves to a tick of a file, i.e. to the last keyframe at or before it,
+   * then applies the records up to it. The file's index is used if it has
+   * one, otherwise the record headers are scanned to build it. If the file
+   * ends before the tick, it stays at the last record, whose tick
+   * get_tick() returns.
+   * @param tick
+   * @return false if the stream is not a file, or has no keyframe that early
+   */
+  bool seek(long tick);
+
+  // The tick of the last record applied.
+  long get_tick() const {
+    return tick;
+  }
+
+  int get_game_count() const {
+    return game_count;
+  }
+
+  int get_keyframe_interval() const {
+    return keyframe_interval;
+  }
+
+  // True once a keyframe has been applied, so the games are known.
+  bool is_synced() const {
+    return synced;
+  }
+
+  const remote_game &get_game(int index) const {
+    return games[index];
+  }
+
+  // How many bytes of records have been read.
+  long bytes_read;
+
+ private:
+  bool read_index();
+  int read_body(int &type);
+  bool apply_record(int type);
+
+  FILE *file;
+  int game_count;
+  int keyframe_interval;
+  long tick;
+  bool synced;
+  std::vector<uint8_t> body; // The body of the last record read.
+  std::vector<std::pair<uint32_t, uint64_t> > keyframes;
+  remote_game games[MAX_SPECTATED_GAMES];
+};
+
+#endif
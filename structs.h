@@ -1,6 +1,19 @@
+#ifndef STRUCTS_H
+#define STRUCTS_H
+
 // Models a colour represented as an (red, green, blue) tuple.
 struct colour {
   float r;
   float g;
   float b;
 };
+
+// Models an axis-aligned rectangle of the display.
+struct rectangle {
+  float left;
+  float bottom;
+  float right;
+  float top;
+};
+
+#endif
@@ -0,0 +1,144 @@
+#include <algorithm>
+
+using namespace std;
+
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(int threads)
+    : queues(threads > 0 ? threads :
+             max(1, (int)thread::hardware_concurrency())),
+      job(NULL), item_count(0), chunk_size(1), generation(0), active(0),
+      stopping(false) {
+  for (int i = 1; i < size(); i++) {
+    this->threads.push_back(thread(&ThreadPool::worker_loop, this, i));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> guard(pool_lock);
+    stopping = true;
+  }
+  work_ready.notify_all();
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+}
+
+void ThreadPool::parallel_for(long count, long grain, const Job &job) {
+  long chunks;
+  int workers = size();
+
+  if (count <= 0) {
+    return;
+  }
+  grain = max(1L, grain);
+  chunks = (count + grain - 1) / grain;
+
+  // With a single worker or a single chunk, there is nothing to share.
+  if (workers == 1 || chunks == 1) {
+    for (long begin = 0; begin < count; begin += grain) {
+      job(begin, min(count, begin + grain), 0);
+    }
+    return;
+  }
+
+  // Give each worker an equal share of the chunks.
+  for (int i = 0; i < workers; i++) {
+    lock_guard<mutex> guard(queues[i].lock);
+    queues[i].next = chunks * i / workers;
+    queues[i].end = chunks * (i + 1) / workers;
+  }
+
+  {
+    lock_guard<mutex> guard(pool_lock);
+    this->job = &job;
+    item_count = count;
+    chunk_size = grain;
+    active = workers - 1;
+    generation++;
+  }
+  work_ready.notify_all();
+
+  run_chunks(0);
+
+  // Wait for the background workers to finish their last chunk.
+  unique_lock<mutex> guard(pool_lock);
+  while (active) {
+    work_done.wait(guard);
+  }
+  this->job = NULL;
+}
+
+void ThreadPool::worker_loop(int worker) {
+  long seen = 0;
+
+  while (true) {
+    {
+      unique_lock<mutex> guard(pool_lock);
+      while (!stopping && generation == seen) {
+        work_ready.wait(guard);
+      }
+      if (stopping) {
+        return;
+      }
+      seen = generation;
+    }
+
+    run_chunks(worker);
+
+    lock_guard<mutex> guard(pool_lock);
+    if (--active == 0) {
+      work_done.notify_one();
+    }
+  }
+}
+
+void ThreadPool::run_chunks(int worker) {
+  long chunk;
+  long begin;
+
+  do {
+    while (take_chunk(worker, chunk)) {
+      begin = chunk * chunk_size;
+      (*job)(begin, min(item_count, begin + chunk_size), worker);
+    }
+  } while (steal_chunks(worker));
+}
+
+bool ThreadPool::take_chunk(int worker, long &chunk) {
+  lock_guard<mutex> guard(queues[worker].lock);
+
+  if (queues[worker].next >= queues[worker].end) {
+    return false;
+  }
+  chunk = queues[worker].next++;
+  return true;
+}
+
+bool ThreadPool::steal_chunks(int worker) {
+  int workers = size();
+  long stolen_begin;
+  long stolen_end;
+
+  // Try the other workers in turn, starting with the next one.
+  for (int i = 1; i < workers; i++) {
+    WorkQueue &victim = queues[(worker + i) % workers];
+    {
+      lock_guard<mutex> guard(victim.lock);
+      long left = victim.end - victim.next;
+      if (left <= 0) {
+        continue;
+      }
+      // Take the back half, rounded up so that a single chunk can be stolen.
+      stolen_end = victim.end;
+      stolen_begin = victim.end - (left + 1) / 2;
+      victim.end = stolen_begin;
+    }
+    lock_guard<mutex> guard(queues[worker].lock);
+    queues[worker].next = stolen_begin;
+    queues[worker].end = stolen_end;
+    return true;
+  }
+  return false;
+}
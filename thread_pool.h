@@ -0,0 +1,73 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A work-stealing thread pool. Each worker owns a range of chunks, which it
+ * processes from the front; when it runs out, it steals half of the chunks
+ * left at the back of another worker's range. The thread that calls
+ * parallel_for() takes part as worker 0.
+ */
+class ThreadPool {
+ public:
+  /**
+   * The function run for each chunk, given the first and one past the last
+   * item index of the chunk, and the index of the worker running it.
+   */
+  typedef std::function<void(long, long, int)> Job;
+
+  /**
+   * Starts the worker threads.
+   * @param threads the number of workers, including the calling thread; 0
+   *        uses one worker per hardware thread
+   */
+  explicit ThreadPool(int threads = 0);
+  ~ThreadPool();
+
+  /**
+   * Returns the number of workers, including the calling thread.
+   * @return
+   */
+  int size() const { return (int)queues.size(); }
+
+  /**
+   * Runs the given job over the items [0, count), split into chunks of at most
+   * grain items, and returns once every chunk has been processed.
+   * @param count the number of items
+   * @param grain the maximum number of items in a chunk
+   * @param job
+   */
+  void parallel_for(long count, long grain, const Job &job);
+
+ private:
+  // The range of chunks [next, end) left to a worker. Padded to a cache line.
+  struct alignas(64) WorkQueue {
+    std::mutex lock;
+    long next;
+    long end;
+  };
+
+  void worker_loop(int worker);
+  void run_chunks(int worker);
+  bool take_chunk(int worker, long &chunk);
+  bool steal_chunks(int worker);
+
+  std::vector<WorkQueue> queues;
+  std::vector<std::thread> threads;
+  std::mutex pool_lock;
+  std::condition_variable work_ready;
+  std::condition_variable work_done;
+  const Job *job;
+  long item_count;
+  long chunk_size;
+  long generation; // Incremented for every parallel_for() call.
+  int active; // Background workers still running the current job.
+  bool stopping;
+};
+
+#endif
@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+#include "versus.h"
+
+// The bytes a row takes in a delta: its mask, then its colours.
+const int ROW_DELTA_SIZE = 2 + GAME_BOARD_WIDTH / 2;
+
+static_assert(2 + 2 + 3 + GAME_BOARD_HEIGHT * ROW_DELTA_SIZE + 2 + 1 + 5 + 1 +
+                  1 <= MAX_MESSAGE_SIZE,
+              "A delta holding everything fits in one message.");
+
+/**
+ * Packs a falling piece into the piece field of a delta.
+ * @param has_piece false if there is no falling piece
+ * @param type
+ * @param rotation
+ * @param x
+ * @param y
+ * @return
+ */
+static uint16_t pack_piece(bool has_piece, int type, int rotation, int x,
+                           int y) {
+  if (!has_piece) {
+    return NO_PIECE;
+  }
+  return type | rotation << 3 | x << 5 | y << 9;
+}
+
+int read_message(const uint8_t *data, int size, int &type,
+                 const uint8_t *&payload, int &payload_size) {
+  if (size < 1) {
+    return 0;
+  }
+  if (!data[0]) {
+    return -1;
+  }
+  if (size < 1 + data[0]) {
+    return 0;
+  }
+  type = data[1];
+  payload = data + 2;
+  payload_size = data[0] - 1;
+  return 1 + data[0];
+}
+
+int write_message(int type, const uint8_t *payload, int payload_size,
+                  uint8_t message[MAX_MESSAGE_SIZE]) {
+  message[0] = payload_size + 1;
+  message[1] = type;
+  memcpy(message + 2, payload, payload_size);
+  return payload_size + 2;
+}
+
+void forget_game(remote_game &game) {
+  memset(&game, 0, sizeof(game));
+  for (int y = 0; y < GAME_BOARD_HEIGHT; y++) {
+    game.board_rows[y] = ~FULL_ROW;
+  }
+  game.next_piece_type = -1;
+  game.score = -1;
+  game.garbage = -1;
+}
+
+int encode_delta(int index, const GameState &game, int garbage, uint32_t rows,
+                 remote_game &known, uint8_t message[MAX_MESSAGE_SIZE]) {
+  uint8_t *payload = message + 2;
+  uint8_t *data = payload + 2;
+  int flags = 0;
+  uint16_t piece = pack_piece(!game.new_piece && !game.game_over,
+                              game.current_piece_type, game.piece_rotation,
+                              game.piece_x, game.piece_y);
+
+  // Only the lines which differ from those known are sent.
+  if (rows) {
+    uint8_t *mask = data;
+    uint32_t sent_rows = 0;
+
+    data += 3;
+    for (int y = 0; y < GAME_BOARD_HEIGHT; y++) {
+      if (!(rows & 1u << y) ||
+          (known.board_rows[y] == game.board_rows[y] &&
+           !memcmp(known.board_colours[y], game.board_colours[y],
+                   GAME_BOARD_WIDTH))) {
+        continue;
+      }
+      sent_rows |= 1u << y;
+      known.board_rows[y] = game.board_rows[y];
+      memcpy(known.board_colours[y], game.board_colours[y], GAME_BOARD_WIDTH);
+      data[0] = game.board_rows[y];
+      data[1] = game.board_rows[y] >> 8;
+      for (int x = 0; x < GAME_BOARD_WIDTH; x += 2) {
+        data[2 + x / 2] = game.board_colours[y][x] |
+            game.board_colours[y][x + 1] << 4;
+      }
+      data += ROW_DELTA_SIZE;
+    }
+    if (sent_rows) {
+      flags |= DELTA_ROWS;
+      mask[0] = sent_rows;
+      mask[1] = sent_rows >> 8;
+      mask[2] = sent_rows >> 16;
+    } else {
+      data = mask;
+    }
+  }
+
+  if (piece != pack_piece(known.has_piece, known.piece_type,
+                          known.piece_rotation, known.piece_x,
+                          known.piece_y)) {
+    flags |= DELTA_PIECE;
+    known.has_piece = piece != NO_PIECE;
+    known.piece_type = game.current_piece_type;
+    known.piece_rotation = game.piece_rotation;
+    known.piece_x = game.piece_x;
+    known.piece_y = game.piece_y;
+    *data++ = piece;
+    *data++ = piece >> 8;
+  }
+  if (game.next_piece_type != known.next_piece_type) {
+    flags |= DELTA_NEXT_PIECE;
+    known.next_piece_type = game.next_piece_type;
+    *data++ = game.next_piece_type;
+  }
+  if (game.score != known.score || game.difficulty != known.difficulty) {
+    flags |= DELTA_SCORE;
+    known.score = game.score;
+    known.difficulty = game.difficulty;
+    for (int i = 0; i < 4; i++) {
+      *data++ = (uint32_t)game.score >> i * 8;
+    }
+    *data++ = game.difficulty;
+  }
+  if (garbage != known.garbage) {
+    flags |= DELTA_GARBAGE;
+    known.garbage = garbage;
+    *data++ = min(garbage, 255);
+  }
+  if (game.game_over != known.game_over) {
+    flags |= DELTA_GAME_OVER;
+    known.game_over = game.game_over;
+    *data++ = game.game_over;
+  }
+  if (!flags) {
+    return 0;
+  }
+
+  payload[0] = index;
+  payload[1] = flags;
+  message[0] = data - payload + 1;
+  message[1] = MESSAGE_DELTA;
+  return data - message;
+}
+
+bool apply_delta(const uint8_t *payload, int size, remote_game games[],
+                 int game_count) {
+  const uint8_t *end = payload + size;
+  int flags;
+
+  if (size < 2 || payload[0] >= game_count) {
+    return false;
+  }
+  remote_game &game = games[payload[0]];
+  flags = payload[1];
+  payload += 2;
+
+  if (flags & DELTA_ROWS) {
+    uint32_t rows;
+
+    if (end - payload < 3) {
+      return false;
+    }
+    rows = payload[0] | payload[1] << 8 | payload[2] << 16;
+    payload += 3;
+    if (rows & ~ALL_ROWS) {
+      return false;
+    }
+    for (int y = 0; y < GAME_BOARD_HEIGHT; y++) {
+      if (!(rows & 1u << y)) {
+        continue;
+      }
+      if (end - payload < ROW_DELTA_SIZE) {
+        return false;
+      }
+      game.board_rows[y] = payload[0] | payload[1] << 8;
+      for (int x = 0; x < GAME_BOARD_WIDTH; x++) {
+        game.board_colours[y][x] = payload[2 + x / 2] >> (x & 1) * 4 & 15;
+      }
+      payload += ROW_DELTA_SIZE;
+    }
+  }
+  if (flags & DELTA_PIECE) {
+    uint16_t piece;
+
+    if (end - payload < 2) {
+      return false;
+    }
+    piece = payload[0] | payload[1] << 8;
+    payload += 2;
+    game.has_piece = piece != NO_PIECE;
+    if (game.has_piece) {
+      if ((piece & 7) >= PIECE_TYPES) {
+        return false;
+      }
+      game.piece_type = piece & 7;
+      game.piece_rotation = piece >> 3 & 3;
+      game.piece_x = piece >> 5 & 15;
+      game.piece_y = piece >> 9 & 31;
+    }
+  }
+  if (flags & DELTA_NEXT_PIECE) {
+    if (end - payload < 1) {
+      return false;
+    }
+    if (*payload >= PIECE_TYPES) {
+      return false;
+    }
+    game.next_piece_type = *payload++;
+  }
+  if (flags & DELTA_SCORE) {
+    if (end - payload < 5) {
+      return false;
+    }
+    game.score = (int)(payload[0] | payload[1] << 8 | payload[2] << 16 |
+                       (uint32_t)payload[3] << 24);
+    game.difficulty = payload[4];
+    payload += 5;
+  }
+  if (flags & DELTA_GARBAGE) {
+    if (end - payload < 1) {
+      return false;
+    }
+    game.garbage = *payload++;
+  }
+  if (flags & DELTA_GAME_OVER) {
+    if (end - payload < 1) {
+      return false;
+    }
+    game.game_over = *payload++;
+  }
+  return payload == end;
+}
+
+void VersusMatch::start(uint64_t seed, int difficulty) {
+  for (int p = 0; p < 2; p++) {
+    games[p].initialise(difficulty, seed);
+    // Spawn the first pieces straight away.
+    games[p].move_piece(0);
+    slept[p] = 0;
+    garbage[p] = 0;
+    lines_seen[p] = 0;
+    pieces_seen[p] = games[p].pieces_spawned;
+    // Nothing has been sent yet, so the first delta holds the whole game.
+    forget_game(sent[p]);
+  }
+  holes.seed(mix_seed(seed), UNIFORM_PIECES);
+}
+
+void VersusMatch::apply_input(int player, int input) {
+  GameState &game = games[player];
+
+  if (is_over() || input < INPUT_LEFT || input > INPUT_DROP) {
+    return;
+  }
+  game.apply_input(input);
+  // A dropped piece is followed by the next one on the next step.
+  if (input == INPUT_DROP) {
+    slept[player] = game.get_gravity_interval();
+  }
+  settle(player);
+}
+
+void VersusMatch::step(int microseconds) {
+  for (int p = 0; p < 2 && !is_over(); p++) {
+    slept[p] += microseconds;
+    if (slept[p] >= games[p].get_gravity_interval()) {
+      games[p].move_piece(0);
+      slept[p] = 0;
+      settle(p);
+    }
+  }
+}
+
+int VersusMatch::get_winner() const {
+  if (games[0].game_over != games[1].game_over) {
+    return games[0].game_over ? 1 : 0;
+  }
+  return games[1].score > games[0].score ? 1 : 0;
+}
+
+int VersusMatch::take_delta(int player, uint8_t message[MAX_MESSAGE_SIZE]) {
+  GameState &game = games[player];
+  /**
+   * Only the lines the game marked as changed are compared with those sent,
+   * so a piece which moves without landing compares none.
+   */
+  uint32_t rows = game.changes & (CHANGE_BOARD | CHANGE_LINES) ?
+      game.changed_rows : 0;
+
+  game.changes = 0;
+  game.changed_rows = 0;
+  return encode_delta(player, game, garbage[player], rows, sent[player],
+                      message);
+}
+
+/**
+ * Sends the garbage earned by the lines a player has cleared since the game
+ * was last settled, and adds any garbage waiting for the player under a
+ * piece which has spawned since.
+ * @param player
+ */
+void VersusMatch::settle(int player) {
+  GameState &game = games[player];
+  int cleared = game.total_lines - lines_seen[player];
+
+  if (cleared) {
+    int sent_lines = GARBAGE_LINES[min(cleared, 4)];
+    int cancelled = min(sent_lines, garbage[player]);
+
+    lines_seen[player] = game.total_lines;
+    garbage[player] -= cancelled;
+    garbage[1 - player] += sent_lines - cancelled;
+  }
+  if (game.pieces_spawned != pieces_seen[player]) {
+    pieces_seen[player] = game.pieces_spawned;
+    if (garbage[player]) {
+      game.add_garbage(garbage[player], holes.next_below(GAME_BOARD_WIDTH));
+      garbage[player] = 0;
+    }
+  }
+}
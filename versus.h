@@ -0,0 +1,206 @@
+#ifndef VERSUS_H
+#define VERSUS_H
+
+#include <cstdint>
+
+#include "structs.h"
+#include "constants.h"
+#include "engine.h"
+
+// The port the versus server listens on unless told otherwise.
+const int VERSUS_PORT = 7324;
+
+/**
+ * The versus protocol, spoken over a stream socket. Every message is a
+ * length byte, counting the type byte and the payload, then the type, then
+ * the payload:
+ *
+ *   MESSAGE_INPUT (client): one INPUT_ code, applied to the client's game.
+ *   MESSAGE_START (server): the match has started, and the client plays as
+ *                 the player given by one byte, 0 or 1.
+ *   MESSAGE_DELTA (server): what changed in a player's game, as described
+ *                 below. Sent for both players, at most once per tick each;
+ *                 the first of a match holds the whole game.
+ *   MESSAGE_END (server): the match is over, won by the player given by one
+ *                 byte. The client is then queued for its next match.
+ *
+ * Numbers are little endian.
+ */
+const int MESSAGE_INPUT = 1;
+const int MESSAGE_START = 2;
+const int MESSAGE_DELTA = 3;
+const int MESSAGE_END = 4;
+// The longest message, including its length byte.
+const int MAX_MESSAGE_SIZE = 256;
+
+/**
+ * A delta starts with the index of its game, the player in a match, then
+ * flags for the parts which are present, in the order their data follows:
+ *
+ *   DELTA_ROWS: a 3 byte mask of the lines which changed, then for each,
+ *               from the bottom, its 2 byte row mask and 5 bytes holding the
+ *               colours of its cells, 4 bits each, the even columns in the
+ *               low bits.
+ *   DELTA_PIECE: 2 bytes holding the falling piece's type in bits 0-2, its
+ *                rotation in bits 3-4, its x in bits 5-8 and its y in bits
+ *                9-13, or 0xffff while there is none.
+ *   DELTA_NEXT_PIECE: 1 byte.
+ *   DELTA_SCORE: 4 bytes of score, then 1 byte of difficulty.
+ *   DELTA_GARBAGE: 1 byte, how many garbage lines are waiting to be added.
+ *   DELTA_GAME_OVER: 1 byte, 1 if the game is over, or 0 if it was over and
+ *                    has started again.
+ */
+const int DELTA_ROWS = 1;
+const int DELTA_PIECE = 2;
+const int DELTA_NEXT_PIECE = 4;
+const int DELTA_SCORE = 8;
+const int DELTA_GARBAGE = 16;
+const int DELTA_GAME_OVER = 32;
+// The piece field of a delta when there is no falling piece.
+const uint16_t NO_PIECE = 0xffff;
+
+// How many garbage lines clearing 0 to 4 lines at once sends.
+const int GARBAGE_LINES[5] = {0, 0, 1, 2, 4};
+
+/**
+ * What a client knows of a player's game, rebuilt from the deltas. It is
+ * cleared when a match starts, or a spectator stream's keyframe arrives.
+ */
+struct remote_game {
+  uint16_t board_rows[GAME_BOARD_HEIGHT];
+  uint8_t board_colours[GAME_BOARD_HEIGHT][GAME_BOARD_WIDTH];
+  bool has_piece;
+  int piece_type;
+  int piece_rotation;
+  int piece_x;
+  int piece_y;
+  int next_piece_type;
+  int score;
+  int difficulty;
+  int garbage;
+  bool game_over;
+};
+
+/**
+ * Splits the first whole message off a buffer of received bytes.
+ * @param data
+ * @param size
+ * @param type filled in with the message type
+ * @param payload filled in with the start of the payload
+ * @param payload_size filled in with the size of the payload
+ * @return the size of the message, 0 if it has not all been received, or -1
+ *         if it is malformed
+ */
+int read_message(const uint8_t *data, int size, int &type,
+                 const uint8_t *&payload, int &payload_size);
+
+/**
+ * Writes a message with a payload of at most MAX_MESSAGE_SIZE - 2 bytes.
+ * @param type
+ * @param payload
+ * @param payload_size
+ * @param message filled in with the message
+ * @return the size of the message
+ */
+int write_message(int type, const uint8_t *payload, int payload_size,
+                  uint8_t message[MAX_MESSAGE_SIZE]);
+
+/**
+ * Sets what is known of a game to values no game has, so that the next delta
+ * encoded against it holds the whole game.
+ * @param game
+ */
+void forget_game(remote_game &game);
+
+/**
+ * Encodes the changes to a game since what is known of it, as a whole
+ * MESSAGE_DELTA, and updates what is known to match.
+ * @param index the index of the game, which the delta starts with
+ * @param game
+ * @param garbage the garbage lines waiting to be added to the game
+ * @param rows the lines which may have changed, of which only those which
+ *        differ from what is known are sent
+ * @param known what the receivers know of the game
+ * @param message filled in with the message
+ * @return the size of the message, or 0 if nothing has changed
+ */
+int encode_delta(int index, const GameState &game, int garbage, uint32_t rows,
+                 remote_game &known, uint8_t message[MAX_MESSAGE_SIZE]);
+
+/**
+ * Applies the payload of a MESSAGE_DELTA to what is known of a game.
+ * @param payload
+ * @param size
+ * @param games the games the deltas are for, of which the one this delta is
+ *        for is updated
+ * @param game_count how many games there are, 2 in a match
+ * @return false if the payload is malformed
+ */
+bool apply_delta(const uint8_t *payload, int size, remote_game games[],
+                 int game_count);
+
+/**
+ * A match between two players, which the server runs: it applies their
+ * inputs and gravity, sends garbage lines to the opponent of a player who
+ * clears two lines or more, and encodes the changes of each game as
+ * deltas. Garbage which is waiting is cancelled by the lines its player
+ * clears, and the rest is pushed up under the next piece to spawn.
+ */
+class VersusMatch {
+ public:
+  /**
+   * Starts the match. Both players get the same piece sequence.
+   * @param seed
+   * @param difficulty the starting difficulty
+   */
+  void start(uint64_t seed, int difficulty);
+
+  /**
+   * Applies an input to a player's game.
+   * @param player 0 or 1
+   * @param input one of the INPUT_ codes
+   */
+  void apply_input(int player, int input);
+
+  /**
+   * Advances gravity in both games.
+   * @param microseconds the time passed since the last step
+   */
+  void step(int microseconds);
+
+  /**
+   * Encodes the changes to a player's game since its last delta, as a whole
+   * MESSAGE_DELTA.
+   * @param player
+   * @param message filled in with the message
+   * @return the size of the message, or 0 if nothing has changed
+   */
+  int take_delta(int player, uint8_t message[MAX_MESSAGE_SIZE]);
+
+  bool is_over() const {
+    return games[0].game_over || games[1].game_over;
+  }
+
+  /**
+   * Returns the winner of a match which is over: the player still playing,
+   * or the higher score if both games ended at once.
+   * @return 0 or 1
+   */
+  int get_winner() const;
+
+  GameState games[2];
+
+ private:
+  void settle(int player);
+
+  int slept[2]; // The time since each piece was last lowered, in microseconds.
+  int garbage[2]; // The garbage lines waiting to be added to each game.
+  // The lines cleared and pieces spawned in each game when last settled.
+  int lines_seen[2];
+  int pieces_seen[2];
+  // What the deltas sent so far have told the clients of each game.
+  remote_game sent[2];
+  PieceGenerator holes; // Picks the column of each garbage hole.
+};
+
+#endif
@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "versus.h"
+
+// The most events handled per call to epoll_wait.
+const int MAX_EVENTS = 256;
+// The size of the buffer each client receives into.
+const int RECEIVE_BUFFER_SIZE = 16384;
+
+// Options for a load test, set from the command line.
+struct client_options {
+  int clients;
+  int port;
+  int seconds;
+  int rate; // How many inputs each client sends per second.
+  uint64_t seed;
+};
+
+// One simulated player, and what it knows of its match.
+struct load_client {
+  int descriptor;
+  bool playing; // True between the start and the end of a match.
+  int player;
+  remote_game games[2];
+  uint8_t input[RECEIVE_BUFFER_SIZE]; // Received bytes of partial messages.
+  int input_size;
+  long input_time; // When the oldest unanswered input was sent, or 0.
+};
+
+// What the clients have seen, over the whole test.
+struct load_stats {
+  long matches_started;
+  long matches_ended;
+  long inputs;
+  long messages;
+  long bytes;
+  long board_errors; // Cells whose colour and occupancy disagree.
+  vector<long> latencies; // From an input to the next delta of its game.
+};
+
+/**
+ * Returns the time of a monotonic clock.
+ * @return the time, in microseconds
+ */
+static long get_microseconds() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+/**
+ * Counts the cells of a game rebuilt from deltas whose colour does not agree
+ * with the occupancy of its line, which a lost or misapplied delta shows as.
+ * @param game
+ * @return
+ */
+static int count_board_errors(const remote_game &game) {
+  int errors = 0;
+
+  for (int y = 0; y < GAME_BOARD_HEIGHT; y++) {
+    for (int x = 0; x < GAME_BOARD_WIDTH; x++) {
+      bool occupied = game.board_rows[y] >> x & 1;
+      errors += occupied != (game.board_colours[y][x] != BACKGROUND);
+    }
+  }
+  return errors;
+}
+
+/**
+ * Connects a client to the server.
+ * @param port
+ * @return the socket, or -1 if it could not connect
+ */
+static int connect_client(int port) {
+  struct sockaddr_in address;
+  int descriptor = socket(AF_INET, SOCK_STREAM, 0);
+  int enable = 1;
+
+  if (descriptor < 0) {
+    return -1;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(descriptor, (struct sockaddr *)&address, sizeof(address))) {
+    close(descriptor);
+    return -1;
+  }
+  setsockopt(descriptor, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+  return descriptor;
+}
+
+/**
+ * Reads what the server has sent a client, and applies it.
+ * @param client
+ * @param stats
+ * @return false if the connection was closed or a message was malformed
+ */
+static bool read_client(load_client &client, load_stats &stats) {
+  for (;;) {
+    ssize_t received = recv(client.descriptor,
+                            client.input + client.input_size,
+                            RECEIVE_BUFFER_SIZE - client.input_size,
+                            MSG_DONTWAIT);
+    int offset = 0;
+    int size;
+    int type;
+    const uint8_t *payload;
+    int payload_size;
+
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    }
+    if (received <= 0) {
+      return false;
+    }
+    client.input_size += received;
+    stats.bytes += received;
+    while ((size = read_message(client.input + offset,
+                                client.input_size - offset, type, payload,
+                                payload_size)) > 0) {
+      stats.messages++;
+      if (type == MESSAGE_START && payload_size == 1) {
+        memset(client.games, 0, sizeof(client.games));
+        client.playing = true;
+        client.player = payload[0];
+        client.input_time = 0;
+        stats.matches_started++;
+      } else if (type == MESSAGE_DELTA) {
+        if (!apply_delta(payload, payload_size, client.games, 2)) {
+          return false;
+        }
+        if (payload[0] == client.player && client.input_time) {
+          stats.latencies.push_back(get_microseconds() - client.input_time);
+          client.input_time = 0;
+        }
+      } else if (type == MESSAGE_END && payload_size == 1) {
+        stats.board_errors += count_board_errors(client.games[0]) +
+            count_board_errors(client.games[1]);
+        client.playing = false;
+        stats.matches_ended++;
+      } else {
+        return false;
+      }
+      offset += size;
+    }
+    if (size < 0) {
+      return false;
+    }
+    client.input_size -= offset;
+    memmove(client.input, client.input + offset, client.input_size);
+  }
+}
+
+/**
+ * Picks a random input, mostly moves and rotations, as a player makes them.
+ * @param random
+ * @return one of the INPUT_ codes
+ */
+static int pick_input(PieceGenerator &random) {
+  const int inputs[] = {INPUT_LEFT, INPUT_RIGHT, INPUT_ROTATE, INPUT_DOWN,
+                        INPUT_LEFT, INPUT_RIGHT, INPUT_ROTATE, INPUT_DROP};
+
+  return inputs[random.next_below(sizeof(inputs) / sizeof(inputs[0]))];
+}
+
+/**
+ * Prints how to use the program.
+ * @param program
+ */
+void print_usage(const char *program) {
+  fprintf(stderr, "Usage: %s [--clients N] [--port N] [--seconds N] "
+          "[--rate N] [--seed N]\n", program);
+}
+
+/**
+ * Reads the options from the command line.
+ * @param argc
+ * @param argv
+ * @param options filled in with the options read
+ * @return false if the command line is invalid
+ */
+bool read_options(int argc, char *argv[], client_options &options) {
+  options.clients = 2;
+  options.port = VERSUS_PORT;
+  options.seconds = 10;
+  options.rate = 10;
+  options.seed = 1;
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 == argc) {
+      return false;
+    }
+    if (!strcmp(argv[i], "--clients")) {
+      options.clients = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--port")) {
+      options.port = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--seconds")) {
+      options.seconds = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--rate")) {
+      options.rate = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--seed")) {
+      options.seed = strtoull(argv[++i], NULL, 10);
+    } else {
+      return false;
+    }
+  }
+  return options.clients > 0 && options.port > 0 && options.port < 65536 &&
+         options.seconds > 0 && options.rate >= 0 &&
+         options.rate <= 1000000 / TICK_LENGTH;
+}
+
+/**
+ * Plays as many clients at once against a versus server, each sending random
+ * inputs at a steady rate, and reports what they received and how long an
+ * input took to show up in a delta.
+ */
+int main(int argc, char *argv[]) {
+  client_options options;
+  load_stats stats = {};
+  vector<load_client> clients;
+  struct epoll_event events[MAX_EVENTS];
+  struct epoll_event event;
+  struct itimerspec interval;
+  PieceGenerator random;
+  int epoll_descriptor = epoll_create1(0);
+  int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  long start;
+  long end;
+  double seconds;
+
+  if (!read_options(argc, argv, options)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  random.seed(options.seed, UNIFORM_PIECES);
+
+  clients.resize(options.clients);
+  for (int i = 0; i < options.clients; i++) {
+    clients[i].descriptor = connect_client(options.port);
+    if (clients[i].descriptor < 0) {
+      perror("Cannot connect to the server");
+      return 1;
+    }
+    clients[i].playing = false;
+    clients[i].input_size = 0;
+    clients[i].input_time = 0;
+    event.events = EPOLLIN;
+    event.data.u32 = i;
+    epoll_ctl(epoll_descriptor, EPOLL_CTL_ADD, clients[i].descriptor, &event);
+  }
+  interval.it_interval.tv_sec = 0;
+  interval.it_interval.tv_nsec = TICK_LENGTH * 1000L;
+  interval.it_value = interval.it_interval;
+  timerfd_settime(timer, 0, &interval, NULL);
+  event.events = EPOLLIN;
+  event.data.u32 = options.clients;
+  epoll_ctl(epoll_descriptor, EPOLL_CTL_ADD, timer, &event);
+
+  start = get_microseconds();
+  end = start + options.seconds * 1000000L;
+  while (get_microseconds() < end) {
+    int count = epoll_wait(epoll_descriptor, events, MAX_EVENTS, 100);
+
+    for (int e = 0; e < count; e++) {
+      uint32_t index = events[e].data.u32;
+      uint64_t expirations;
+
+      if (index < (uint32_t)options.clients) {
+        if (!read_client(clients[index], stats)) {
+          fprintf(stderr, "Client %u lost its connection\n", index);
+          return 1;
+        }
+        continue;
+      }
+      // Each client sends an input on rate ticks of every second.
+      if (read(timer, &expirations, sizeof(expirations)) !=
+          sizeof(expirations)) {
+        continue;
+      }
+      for (int i = 0; i < options.clients; i++) {
+        load_client &client = clients[i];
+        uint8_t message[MAX_MESSAGE_SIZE];
+        uint8_t input;
+
+        if (!client.playing ||
+            random.next_below(1000000 / TICK_LENGTH) >=
+                (uint32_t)options.rate) {
+          continue;
+        }
+        input = pick_input(random);
+        if (send(client.descriptor, message,
+                 write_message(MESSAGE_INPUT, &input, 1, message),
+                 MSG_NOSIGNAL) < 0) {
+          fprintf(stderr, "Client %d lost its connection\n", i);
+          return 1;
+        }
+        if (!client.input_time) {
+          client.input_time = get_microseconds();
+        }
+        stats.inputs++;
+      }
+    }
+  }
+  seconds = (get_microseconds() - start) / 1e6;
+
+  sort(stats.latencies.begin(), stats.latencies.end());
+  printf("clients: %d\n", options.clients);
+  printf("seconds: %.3f\n", seconds);
+  printf("matches started: %ld\n", stats.matches_started);
+  printf("matches ended: %ld\n", stats.matches_ended);
+  printf("inputs/sec: %.0f\n", stats.inputs / seconds);
+  printf("messages/sec: %.0f\n", stats.messages / seconds);
+  printf("KB/sec: %.1f\n", stats.bytes / seconds / 1024.0);
+  printf("board errors: %ld\n", stats.board_errors);
+  if (!stats.latencies.empty()) {
+    printf("input latency us p50: %ld\n",
+           stats.latencies[(stats.latencies.size() - 1) / 2]);
+    printf("input latency us p99: %ld\n",
+           stats.latencies[(stats.latencies.size() - 1) * 99 / 100]);
+    printf("input latency us max: %ld\n", stats.latencies.back());
+  }
+  return stats.board_errors ? 1 : 0;
+}
@@ -0,0 +1,575 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "versus.h"
+
+// The most bytes waiting to be sent to a client before it is dropped.
+const size_t MAX_PENDING_OUTPUT = 65536;
+// The most events handled per call to epoll_wait.
+const int MAX_EVENTS = 256;
+
+// Options for the server, set from the command line.
+struct server_options {
+  int port;
+  int difficulty; // The starting difficulty of every match.
+  uint64_t seed; // The seed each match's seed is derived from.
+  bool stats; // True to print the tick timings every second.
+};
+
+// A connected client.
+struct server_client {
+  bool connected;
+  int match; // The match the client plays in, or -1 while waiting for one.
+  int player;
+  bool writing; // True while the socket is watched for room to write.
+  bool dirty; // True if it has output to flush at the end of the tick.
+  bool dropped; // True if it fell too far behind and must be disconnected.
+  uint8_t input[MAX_MESSAGE_SIZE]; // Received bytes of a partial message.
+  int input_size;
+  vector<uint8_t> output;
+  size_t output_sent; // How much of the output has been sent.
+};
+
+// A match and the clients playing it.
+struct server_match {
+  VersusMatch match;
+  int clients[2]; // The descriptor of each player, or -1 once they have left.
+  bool running;
+};
+
+/**
+ * Returns the time of a monotonic clock.
+ * @return the time, in microseconds
+ */
+static long get_microseconds() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+/**
+ * Hosts versus matches for the clients which connect to it, on one thread.
+ * Clients are paired in the order they connect, and each pair plays until
+ * one of them tops out, after which both are queued for their next match.
+ *
+ * Everything is driven by one epoll loop: the listening socket, the client
+ * sockets, and a timer which ticks every TICK_LENGTH. Inputs are applied to
+ * their match as soon as they are read. Each tick steps every match, takes
+ * the deltas of its two games once and queues them to both of its clients,
+ * then flushes every client which has output in one send each, so a tick
+ * costs one system call per client however much changed.
+ */
+class VersusServer {
+ public:
+  explicit VersusServer(const server_options &options)
+      : options(options), epoll_descriptor(-1), listener(-1), timer(-1),
+        match_count(0), tick_count(0), bytes_sent(0), inputs(0),
+        matches_ended(0) {
+  }
+
+  /**
+   * Listens on the loopback interface and starts the tick timer.
+   * @return false if either failed
+   */
+  bool open() {
+    struct sockaddr_in address;
+    struct itimerspec interval;
+    int enable = 1;
+
+    listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listener < 0) {
+      return false;
+    }
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(options.port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) ||
+        listen(listener, SOMAXCONN)) {
+      return false;
+    }
+
+    timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timer < 0) {
+      return false;
+    }
+    interval.it_interval.tv_sec = 0;
+    interval.it_interval.tv_nsec = TICK_LENGTH * 1000L;
+    interval.it_value = interval.it_interval;
+    if (timerfd_settime(timer, 0, &interval, NULL)) {
+      return false;
+    }
+
+    epoll_descriptor = epoll_create1(0);
+    return epoll_descriptor >= 0 && watch(listener, EPOLLIN, EPOLL_CTL_ADD) &&
+        watch(timer, EPOLLIN, EPOLL_CTL_ADD);
+  }
+
+  /**
+   * Handles events until the process is stopped.
+   */
+  void run() {
+    struct epoll_event events[MAX_EVENTS];
+
+    for (;;) {
+      int count = epoll_wait(epoll_descriptor, events, MAX_EVENTS, -1);
+
+      if (count < 0 && errno != EINTR) {
+        perror("epoll_wait");
+        return;
+      }
+      for (int i = 0; i < count; i++) {
+        int descriptor = events[i].data.fd;
+
+        if (descriptor == listener) {
+          accept_clients();
+        } else if (descriptor == timer) {
+          tick();
+        } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+          disconnect(descriptor);
+        } else {
+          if (events[i].events & EPOLLIN) {
+            read_client(descriptor);
+          }
+          if (events[i].events & EPOLLOUT) {
+            flush(descriptor);
+          }
+        }
+      }
+    }
+  }
+
+ private:
+  /**
+   * Adds a descriptor to the epoll set, or changes the events it is watched
+   * for.
+   * @param descriptor
+   * @param events
+   * @param operation EPOLL_CTL_ADD or EPOLL_CTL_MOD
+   * @return false if it could not be
+   */
+  bool watch(int descriptor, uint32_t events, int operation) {
+    struct epoll_event event;
+
+    event.events = events;
+    event.data.fd = descriptor;
+    return !epoll_ctl(epoll_descriptor, operation, descriptor, &event);
+  }
+
+  /**
+   * Accepts every pending connection, and queues the clients for a match.
+   */
+  void accept_clients() {
+    int descriptor;
+    int enable = 1;
+
+    while ((descriptor = accept4(listener, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+      setsockopt(descriptor, IPPROTO_TCP, TCP_NODELAY, &enable,
+                 sizeof(enable));
+      if ((size_t)descriptor >= clients.size()) {
+        clients.resize(descriptor + 1);
+      }
+      server_client &client = clients[descriptor];
+      client.connected = true;
+      client.match = -1;
+      client.writing = false;
+      client.dirty = false;
+      client.dropped = false;
+      client.input_size = 0;
+      client.output.clear();
+      client.output_sent = 0;
+      if (!watch(descriptor, EPOLLIN, EPOLL_CTL_ADD)) {
+        close(descriptor);
+        client.connected = false;
+        continue;
+      }
+      waiting.push_back(descriptor);
+    }
+    pair_clients();
+  }
+
+  /**
+   * Starts a match for every two clients waiting for one.
+   */
+  void pair_clients() {
+    while (waiting.size() >= 2) {
+      int players[2] = {waiting[0], waiting[1]};
+      int index;
+
+      waiting.pop_front();
+      waiting.pop_front();
+      if (free_matches.empty()) {
+        index = matches.size();
+        matches.emplace_back();
+      } else {
+        index = free_matches.back();
+        free_matches.pop_back();
+      }
+      server_match &match = matches[index];
+      match.match.start(mix_seed(options.seed + match_count++),
+                        options.difficulty);
+      match.running = true;
+      for (int p = 0; p < 2; p++) {
+        uint8_t message[MAX_MESSAGE_SIZE];
+        uint8_t player = p;
+
+        match.clients[p] = players[p];
+        clients[players[p]].match = index;
+        clients[players[p]].player = p;
+        send_message(players[p], message,
+                     write_message(MESSAGE_START, &player, 1, message));
+      }
+    }
+  }
+
+  /**
+   * Reads what a client has sent, and applies the inputs in it.
+   * @param descriptor
+   */
+  void read_client(int descriptor) {
+    server_client &client = clients[descriptor];
+
+    while (client.connected) {
+      ssize_t received = recv(descriptor, client.input + client.input_size,
+                              MAX_MESSAGE_SIZE - client.input_size, 0);
+      int offset = 0;
+      int size;
+      int type;
+      const uint8_t *payload;
+      int payload_size;
+
+      if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+      }
+      if (received <= 0) {
+        disconnect(descriptor);
+        return;
+      }
+      client.input_size += received;
+      while ((size = read_message(client.input + offset,
+                                  client.input_size - offset, type, payload,
+                                  payload_size)) > 0) {
+        // Clients only send inputs; anything else ends their connection.
+        if (type != MESSAGE_INPUT || payload_size != 1) {
+          disconnect(descriptor);
+          return;
+        }
+        if (client.match >= 0 && matches[client.match].running) {
+          matches[client.match].match.apply_input(client.player, payload[0]);
+          inputs++;
+        }
+        offset += size;
+      }
+      if (size < 0) {
+        disconnect(descriptor);
+        return;
+      }
+      client.input_size -= offset;
+      memmove(client.input, client.input + offset, client.input_size);
+    }
+  }
+
+  /**
+   * Queues a message to a client, to be flushed at the end of the tick. A
+   * client which has too much output waiting is dropped then.
+   * @param descriptor
+   * @param message
+   * @param size
+   */
+  void send_message(int descriptor, const uint8_t *message, int size) {
+    server_client &client = clients[descriptor];
+
+    client.output.insert(client.output.end(), message, message + size);
+    if (client.output.size() - client.output_sent > MAX_PENDING_OUTPUT) {
+      client.dropped = true;
+    }
+    if (!client.dirty) {
+      client.dirty = true;
+      dirty.push_back(descriptor);
+    }
+  }
+
+  /**
+   * Ends a match, tells the clients still in it who won, and queues them for
+   * their next match.
+   * @param index
+   * @param winner
+   */
+  void end_match(int index, int winner) {
+    server_match &match = matches[index];
+    uint8_t message[MAX_MESSAGE_SIZE];
+    uint8_t player = winner;
+    int size = write_message(MESSAGE_END, &player, 1, message);
+
+    match.running = false;
+    free_matches.push_back(index);
+    matches_ended++;
+    for (int p = 0; p < 2; p++) {
+      if (match.clients[p] >= 0) {
+        send_message(match.clients[p], message, size);
+        clients[match.clients[p]].match = -1;
+        waiting.push_back(match.clients[p]);
+      }
+    }
+  }
+
+  /**
+   * Steps every match by the ticks which have passed, sends the deltas and
+   * flushes the output of every client.
+   */
+  void tick() {
+    uint64_t expirations;
+    long start = get_microseconds();
+
+    if (read(timer, &expirations, sizeof(expirations)) !=
+        sizeof(expirations)) {
+      return;
+    }
+    for (size_t i = 0; i < matches.size(); i++) {
+      server_match &match = matches[i];
+      uint8_t message[MAX_MESSAGE_SIZE];
+      int size;
+
+      if (!match.running) {
+        continue;
+      }
+      match.match.step(expirations * TICK_LENGTH);
+      for (int p = 0; p < 2; p++) {
+        if (!(size = match.match.take_delta(p, message))) {
+          continue;
+        }
+        for (int c = 0; c < 2; c++) {
+          if (match.clients[c] >= 0) {
+            send_message(match.clients[c], message, size);
+          }
+        }
+      }
+      if (match.match.is_over()) {
+        end_match(i, match.match.get_winner());
+      }
+    }
+    pair_clients();
+
+    /**
+     * Clients can be added to the list while it is flushed, when dropping one
+     * ends its match.
+     */
+    for (size_t i = 0; i < dirty.size(); i++) {
+      server_client &client = clients[dirty[i]];
+
+      client.dirty = false;
+      if (!client.connected) {
+        continue;
+      }
+      if (client.dropped) {
+        disconnect(dirty[i]);
+      } else if (!client.writing) {
+        flush(dirty[i]);
+      }
+    }
+    dirty.clear();
+
+    if (options.stats) {
+      record_tick(get_microseconds() - start, expirations);
+    }
+  }
+
+  /**
+   * Sends as much of a client's output as the socket takes, and watches the
+   * socket for room to write the rest.
+   * @param descriptor
+   */
+  void flush(int descriptor) {
+    server_client &client = clients[descriptor];
+
+    while (client.output_sent < client.output.size()) {
+      ssize_t sent = send(descriptor, &client.output[client.output_sent],
+                          client.output.size() - client.output_sent,
+                          MSG_NOSIGNAL);
+
+      if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        if (!client.writing) {
+          client.writing = true;
+          watch(descriptor, EPOLLIN | EPOLLOUT, EPOLL_CTL_MOD);
+        }
+        return;
+      }
+      if (sent < 0) {
+        disconnect(descriptor);
+        return;
+      }
+      client.output_sent += sent;
+      bytes_sent += sent;
+    }
+    client.output.clear();
+    client.output_sent = 0;
+    if (client.writing) {
+      client.writing = false;
+      watch(descriptor, EPOLLIN, EPOLL_CTL_MOD);
+    }
+  }
+
+  /**
+   * Closes a client's connection. Its opponent wins the match it was in.
+   * @param descriptor
+   */
+  void disconnect(int descriptor) {
+    server_client &client = clients[descriptor];
+
+    if (!client.connected) {
+      return;
+    }
+    epoll_ctl(epoll_descriptor, EPOLL_CTL_DEL, descriptor, NULL);
+    close(descriptor);
+    client.connected = false;
+    client.output.clear();
+    client.output_sent = 0;
+    if (client.match >= 0) {
+      server_match &match = matches[client.match];
+      match.clients[client.player] = -1;
+      end_match(client.match, 1 - client.player);
+    } else {
+      waiting.erase(remove(waiting.begin(), waiting.end(), descriptor),
+                    waiting.end());
+    }
+  }
+
+  /**
+   * Records how long a tick took, and prints the statistics of the ticks once
+   * a second's worth have been recorded.
+   * @param duration the time the tick took, in microseconds
+   * @param expirations how many ticks it covered
+   */
+  void record_tick(long duration, uint64_t expirations) {
+    long total = 0;
+    long running = 0;
+    long connected = 0;
+
+    tick_durations.push_back(duration);
+    tick_count += expirations;
+    if (tick_count < 1000000 / TICK_LENGTH) {
+      return;
+    }
+    for (size_t i = 0; i < tick_durations.size(); i++) {
+      total += tick_durations[i];
+    }
+    sort(tick_durations.begin(), tick_durations.end());
+    for (size_t i = 0; i < matches.size(); i++) {
+      running += matches[i].running;
+    }
+    for (size_t i = 0; i < clients.size(); i++) {
+      connected += clients[i].connected;
+    }
+    printf("matches %ld, clients %ld, ticks %zu (%ld late), "
+           "tick us mean %.1f p99 %ld max %ld, inputs %ld, ended %ld, "
+           "sent %.1f KB\n", running, connected, tick_durations.size(),
+           tick_count - (long)tick_durations.size(),
+           (double)total / tick_durations.size(),
+           tick_durations[(tick_durations.size() - 1) * 99 / 100],
+           tick_durations.back(), inputs, matches_ended,
+           bytes_sent / 1024.0);
+    fflush(stdout);
+    tick_durations.clear();
+    tick_count = 0;
+    bytes_sent = 0;
+    inputs = 0;
+    matches_ended = 0;
+  }
+
+  server_options options;
+  int epoll_descriptor;
+  int listener;
+  int timer;
+  vector<server_client> clients; // Indexed by descriptor.
+  vector<server_match> matches;
+  vector<int> free_matches; // The matches which are over, for reuse.
+  deque<int> waiting; // The clients waiting for a match, in order.
+  vector<int> dirty; // The clients with output to flush this tick.
+  uint64_t match_count; // How many matches have been started.
+  // The statistics of the ticks since they were last printed.
+  vector<long> tick_durations;
+  long tick_count;
+  long bytes_sent;
+  long inputs;
+  long matches_ended;
+};
+
+/**
+ * Prints how to use the program.
+ * @param program
+ */
+void print_usage(const char *program) {
+  fprintf(stderr, "Usage: %s [--port N] [--difficulty N] [--seed N] "
+          "[--stats]\n", program);
+}
+
+/**
+ * Reads the options from the command line.
+ * @param argc
+ * @param argv
+ * @param options filled in with the options read
+ * @return false if the command line is invalid
+ */
+bool read_options(int argc, char *argv[], server_options &options) {
+  options.port = VERSUS_PORT;
+  options.difficulty = 1;
+  options.seed = time(NULL);
+  options.stats = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--stats")) {
+      options.stats = true;
+      continue;
+    }
+    if (i + 1 == argc) {
+      return false;
+    }
+    if (!strcmp(argv[i], "--port")) {
+      options.port = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--difficulty")) {
+      options.difficulty = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--seed")) {
+      options.seed = strtoull(argv[++i], NULL, 10);
+    } else {
+      return false;
+    }
+  }
+  return options.port > 0 && options.port < 65536 &&
+         options.difficulty >= 1 && options.difficulty <= MAX_DIFFICULTY;
+}
+
+int main(int argc, char *argv[]) {
+  server_options options;
+
+  if (!read_options(argc, argv, options)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  VersusServer server(options);
+  if (!server.open()) {
+    perror("Cannot start the server");
+    return 1;
+  }
+  printf("Listening on 127.0.0.1:%d\n", options.port);
+  fflush(stdout);
+  server.run();
+  return 1;
+}